@@ -32,6 +32,7 @@ import androidx.annotation.Nullable;
 import com.android.net.module.util.IBpfMap;
 import com.android.net.module.util.IBpfMap.ThrowingBiConsumer;
 import com.android.net.module.util.SharedLog;
+import com.android.net.module.util.Struct.S32;
 import com.android.net.module.util.bpf.Tether4Key;
 import com.android.net.module.util.bpf.Tether4Value;
 import com.android.net.module.util.bpf.TetherStatsKey;
@@ -63,6 +64,12 @@ public class BpfCoordinatorShimImpl
     // PFKEYv2 constants. See include/uapi/linux/pfkeyv2.h.
     private static final int PF_KEY_V2 = 2;
 
+    // TETHER_IIF_RULES_* bits of tether_iif_rules_map values. See offload.h.
+    private static final int IIF_RULES_DOWNSTREAM6 = 1 << 0;
+    private static final int IIF_RULES_UPSTREAM6 = 1 << 1;
+    private static final int IIF_RULES_DOWNSTREAM4 = 1 << 2;
+    private static final int IIF_RULES_UPSTREAM4 = 1 << 3;
+
     @NonNull
     private final SharedLog mLog;
 
@@ -94,6 +101,17 @@ public class BpfCoordinatorShimImpl
     @Nullable
     private final IBpfMap<TetherDevKey, TetherDevValue> mBpfDevMap;
 
+    // BPF map of which forwarding maps have rules for a given input interface, used by the BPF
+    // programs to skip interfaces without any rules. Kept in sync with mRuleCountOnIif.
+    @Nullable
+    private final IBpfMap<S32, S32> mBpfIifRulesMap;
+
+    // Number of rules in each of the forwarding maps per input interface index, indexed by the
+    // IIF_RULES_* bit number. Interfaces without any rules have no entry.
+    // Note that except the constructor, any calls to clear() a forwarding map need to clear
+    // this counter and mBpfIifRulesMap as well.
+    private final SparseArray<int[]> mRuleCountOnIif = new SparseArray<>();
+
     // Tracking IPv4 rule count while any rule is using the given upstream interfaces. Used for
     // reducing the BPF map iteration query. The count is increased or decreased when the rule is
     // added or removed successfully on mBpfDownstream4Map. Counting the rules on downstream4 map
@@ -118,6 +136,7 @@ public class BpfCoordinatorShimImpl
         mBpfStatsMap = deps.getBpfStatsMap();
         mBpfLimitMap = deps.getBpfLimitMap();
         mBpfDevMap = deps.getBpfDevMap();
+        mBpfIifRulesMap = deps.getBpfIifRulesMap();
 
         // Clear the stubs of the maps for handling the system service crash if any.
         // Doesn't throw the exception and clear the stubs as many as possible.
@@ -156,13 +175,59 @@ public class BpfCoordinatorShimImpl
         } catch (ErrnoException e) {
             mLog.e("Could not clear mBpfDevMap: " + e);
         }
+        try {
+            if (mBpfIifRulesMap != null) mBpfIifRulesMap.clear();
+        } catch (ErrnoException e) {
+            mLog.e("Could not clear mBpfIifRulesMap: " + e);
+        }
     }
 
     @Override
     public boolean isInitialized() {
         return mBpfDownstream4Map != null && mBpfUpstream4Map != null && mBpfDownstream6Map != null
                 && mBpfUpstream6Map != null && mBpfStatsMap != null && mBpfLimitMap != null
-                && mBpfDevMap != null;
+                && mBpfDevMap != null && mBpfIifRulesMap != null;
+    }
+
+    private static int iifRulesOf(@NonNull final int[] counts) {
+        int rules = 0;
+        for (int i = 0; i < counts.length; i++) {
+            if (counts[i] > 0) rules |= 1 << i;
+        }
+        return rules;
+    }
+
+    /**
+     * Accounts for a rule added to (delta 1) or removed from (delta -1) the forwarding map
+     * identified by the given IIF_RULES_* bit, and updates mBpfIifRulesMap if this changes
+     * whether that map has any rules for the given input interface.
+     */
+    private void updateIifRuleCount(int ifIndex, int rule, int delta) {
+        int[] counts = mRuleCountOnIif.get(ifIndex);
+        if (counts == null) {
+            counts = new int[Integer.numberOfTrailingZeros(IIF_RULES_UPSTREAM4) + 1];
+            mRuleCountOnIif.put(ifIndex, counts);
+        }
+        final int oldRules = iifRulesOf(counts);
+        final int index = Integer.numberOfTrailingZeros(rule);
+        counts[index] += delta;
+        if (counts[index] < 0) {
+            Log.wtf(TAG, "Negative rule count for interface " + ifIndex + " rule " + rule);
+            counts[index] = 0;
+        }
+        final int newRules = iifRulesOf(counts);
+        if (newRules == 0) mRuleCountOnIif.remove(ifIndex);
+        if (newRules == oldRules) return;
+
+        try {
+            if (newRules == 0) {
+                mBpfIifRulesMap.deleteEntry(new S32(ifIndex));
+            } else {
+                mBpfIifRulesMap.updateEntry(new S32(ifIndex), new S32(newRules));
+            }
+        } catch (ErrnoException e) {
+            mLog.e("Could not update rules of interface " + ifIndex + ": " + e);
+        }
     }
 
     @Override
@@ -179,6 +244,7 @@ public class BpfCoordinatorShimImpl
             mLog.e("Could not insert upstream IPv6 entry: " + e);
             return false;
         }
+        updateIifRuleCount(key.iif, IIF_RULES_UPSTREAM6, 1);
         return true;
     }
 
@@ -187,8 +253,11 @@ public class BpfCoordinatorShimImpl
         // RFC7421_PREFIX_LENGTH = 64 which is the most commonly used IPv6 subnet prefix length.
         if (rule.sourcePrefix.getPrefixLength() != RFC7421_PREFIX_LENGTH) return false;
 
+        final TetherUpstream6Key key = rule.makeTetherUpstream6Key();
         try {
-            mBpfUpstream6Map.deleteEntry(rule.makeTetherUpstream6Key());
+            if (mBpfUpstream6Map.deleteEntry(key)) {
+                updateIifRuleCount(key.iif, IIF_RULES_UPSTREAM6, -1);
+            }
         } catch (ErrnoException e) {
             mLog.e("Could not delete upstream IPv6 entry: " + e);
             return false;
@@ -202,7 +271,10 @@ public class BpfCoordinatorShimImpl
         final Tether6Value value = rule.makeTether6Value();
 
         try {
+            // Rules are updated in place when the neighbor's mac address changes.
+            final boolean isNew = !mBpfDownstream6Map.containsKey(key);
             mBpfDownstream6Map.updateEntry(key, value);
+            if (isNew) updateIifRuleCount(key.iif, IIF_RULES_DOWNSTREAM6, 1);
         } catch (ErrnoException e) {
             mLog.e("Could not update entry: ", e);
             return false;
@@ -213,8 +285,11 @@ public class BpfCoordinatorShimImpl
 
     @Override
     public boolean removeIpv6DownstreamRule(@NonNull final Ipv6DownstreamRule rule) {
+        final TetherDownstream6Key key = rule.makeTetherDownstream6Key();
         try {
-            mBpfDownstream6Map.deleteEntry(rule.makeTetherDownstream6Key());
+            if (mBpfDownstream6Map.deleteEntry(key)) {
+                updateIifRuleCount(key.iif, IIF_RULES_DOWNSTREAM6, -1);
+            }
         } catch (ErrnoException e) {
             // Silent if the rule did not exist.
             if (e.errno != OsConstants.ENOENT) {
@@ -350,8 +425,10 @@ public class BpfCoordinatorShimImpl
                 final int upstreamIfindex = (int) key.iif;
                 int count = mRule4CountOnUpstream.get(upstreamIfindex, 0 /* default */);
                 mRule4CountOnUpstream.put(upstreamIfindex, ++count);
+                updateIifRuleCount(upstreamIfindex, IIF_RULES_DOWNSTREAM4, 1);
             } else {
                 mBpfUpstream4Map.insertEntry(key, value);
+                updateIifRuleCount((int) key.iif, IIF_RULES_UPSTREAM4, 1);
             }
         } catch (ErrnoException e) {
             mLog.e("Could not insert entry (" + key + ", " + value + "): " + e);
@@ -373,6 +450,7 @@ public class BpfCoordinatorShimImpl
                 // Decrease the rule count while a deleting rule is not using a given upstream
                 // interface anymore.
                 final int upstreamIfindex = (int) key.iif;
+                updateIifRuleCount(upstreamIfindex, IIF_RULES_DOWNSTREAM4, -1);
                 Integer count = mRule4CountOnUpstream.get(upstreamIfindex);
                 if (count == null) {
                     Log.wtf(TAG, "Could not delete count for interface " + upstreamIfindex);
@@ -387,6 +465,7 @@ public class BpfCoordinatorShimImpl
                 }
             } else {
                 if (!mBpfUpstream4Map.deleteEntry(key)) return false;  // Rule did not exist
+                updateIifRuleCount((int) key.iif, IIF_RULES_UPSTREAM4, -1);
             }
         } catch (ErrnoException e) {
             mLog.e("Could not delete entry (key: " + key + ")", e);
@@ -472,7 +551,8 @@ public class BpfCoordinatorShimImpl
                 mapStatus(mBpfUpstream4Map, "mBpfUpstream4Map"),
                 mapStatus(mBpfStatsMap, "mBpfStatsMap"),
                 mapStatus(mBpfLimitMap, "mBpfLimitMap"),
-                mapStatus(mBpfDevMap, "mBpfDevMap")
+                mapStatus(mBpfDevMap, "mBpfDevMap"),
+                mapStatus(mBpfIifRulesMap, "mBpfIifRulesMap")
         });
     }
 
@@ -14,13 +14,26 @@
  * limitations under the License.
  */
 
+#include <arpa/inet.h>
+#include <errno.h>
 #include <jni.h>
 #include <nativehelper/JNIHelp.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#define BPF_FD_JUST_USE_INT
+#include "BpfSyscallWrappers.h"
+#include "bpf/BpfUtils.h"
 
 #include "offload.h"
 
 namespace android {
 
+static const char* kFlow4StatsMapPath = "/sys/fs/bpf/tethering/map_offload_tether_flow4_stats_map";
+
 static jobjectArray getBpfCounterNames(JNIEnv *env) {
     size_t size = BPF_TETHER_ERR__MAX;
     jobjectArray ret = env->NewObjectArray(size, env->FindClass("java/lang/String"), nullptr);
@@ -30,12 +43,68 @@ static jobjectArray getBpfCounterNames(JNIEnv *env) {
     return ret;
 }
 
+// Returns the n flows with the most bytes in tether_flow4_stats_map, summed across all cpus,
+// formatted for dumpsys.  Returns an empty array if the map is not available.
+static jobjectArray getTopFlows4(JNIEnv* env, jclass clazz, jint n) {
+    std::vector<std::pair<Tether4Key, Tether4FlowStatsValue>> flows;
+
+    const int cpus = bpf::getNumPossibleCpus();
+    const int fd = bpf::mapRetrieveRO(kFlow4StatsMapPath);
+    if (cpus > 0 && fd >= 0) {
+        std::vector<Tether4FlowStatsValue> perCpu(cpus);
+        Tether4Key key;
+        int rv = bpf::getFirstMapKey(fd, &key);
+        while (!rv) {
+            // The flow might have been evicted in the meantime, just skip it if so.
+            if (!bpf::findMapEntry(fd, &key, perCpu.data())) {
+                Tether4FlowStatsValue total = {};
+                for (const auto& v : perCpu) {
+                    total.packets += v.packets;
+                    total.bytes += v.bytes;
+                }
+                flows.emplace_back(key, total);
+            }
+            rv = bpf::getNextMapKey(fd, &key, &key);
+        }
+    }
+    if (fd >= 0) close(fd);
+
+    const size_t count = std::min(flows.size(), static_cast<size_t>(std::max(n, 0)));
+    std::partial_sort(flows.begin(), flows.begin() + count, flows.end(),
+            [](const auto& a, const auto& b) { return a.second.bytes > b.second.bytes; });
+
+    jobjectArray ret = env->NewObjectArray(count, env->FindClass("java/lang/String"), nullptr);
+    for (size_t i = 0; i < count; i++) {
+        const Tether4Key& k = flows[i].first;
+        char src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &k.src4, src, sizeof(src));
+        inet_ntop(AF_INET, &k.dst4, dst, sizeof(dst));
+        // Same format as BpfCoordinator's l4protoToString().
+        char proto[16];
+        if (k.l4Proto == IPPROTO_TCP) {
+            snprintf(proto, sizeof(proto), "tcp");
+        } else if (k.l4Proto == IPPROTO_UDP) {
+            snprintf(proto, sizeof(proto), "udp");
+        } else {
+            snprintf(proto, sizeof(proto), "unknown(%u)", k.l4Proto);
+        }
+        char line[128];
+        snprintf(line, sizeof(line), "%s %u %s:%u -> %s:%u: %llu %llu",
+                 proto, k.iif, src, ntohs(k.srcPort), dst, ntohs(k.dstPort),
+                 (unsigned long long)flows[i].second.packets,
+                 (unsigned long long)flows[i].second.bytes);
+        env->SetObjectArrayElement(ret, i, env->NewStringUTF(line));
+    }
+    return ret;
+}
+
 /*
  * JNI registration.
  */
 static const JNINativeMethod gMethods[] = {
     /* name, signature, funcPtr */
     { "getBpfCounterNames", "()[Ljava/lang/String;", (void*) getBpfCounterNames },
+    { "getTopFlows4", "(I)[Ljava/lang/String;", (void*) getTopFlows4 },
 };
 
 int register_com_android_networkstack_tethering_BpfCoordinator(JNIEnv* env) {
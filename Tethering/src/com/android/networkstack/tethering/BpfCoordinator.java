@@ -34,6 +34,7 @@ import static com.android.networkstack.tethering.BpfUtils.DOWNSTREAM;
 import static com.android.networkstack.tethering.BpfUtils.UPSTREAM;
 import static com.android.networkstack.tethering.TetheringConfiguration.DEFAULT_TETHER_OFFLOAD_POLL_INTERVAL_MS;
 import static com.android.networkstack.tethering.TetheringConfiguration.TETHER_ACTIVE_SESSIONS_METRICS;
+import static com.android.networkstack.tethering.TetheringConfiguration.TETHER_FLOW_STATS;
 import static com.android.networkstack.tethering.UpstreamNetworkState.isVcnInterface;
 import static com.android.networkstack.tethering.util.TetheringUtils.getTetheringJniLibraryName;
 
@@ -126,6 +127,7 @@ public class BpfCoordinator {
 
     private static final String TAG = BpfCoordinator.class.getSimpleName();
     private static final int DUMP_TIMEOUT_MS = 10_000;
+    private static final int DUMP_TOP_FLOWS4 = 20;
     private static final MacAddress NULL_MAC_ADDRESS = MacAddress.fromString(
             "00:00:00:00:00:00");
     private static final String TETHER_DOWNSTREAM4_MAP_PATH = makeMapPath(DOWNSTREAM, 4);
@@ -136,6 +138,7 @@ public class BpfCoordinator {
     private static final String TETHER_LIMIT_MAP_PATH = makeMapPath("limit");
     private static final String TETHER_ERROR_MAP_PATH = makeMapPath("error");
     private static final String TETHER_DEV_MAP_PATH = makeMapPath("dev");
+    private static final String TETHER_IIF_RULES_MAP_PATH = makeMapPath("iif_rules");
     private static final String DUMPSYS_RAWMAP_ARG_STATS = "--stats";
     private static final String DUMPSYS_RAWMAP_ARG_UPSTREAM4 = "--upstream4";
 
@@ -150,6 +153,8 @@ public class BpfCoordinator {
         return makeMapPath((downstream ? "downstream" : "upstream") + ipVersion);
     }
 
+    // Note: the BPF program only updates a rule's lastUsed once it is at least a second old
+    // (see TETHER4_LAST_USED_GRANULARITY_NS in offload.h), which this interval easily tolerates.
     @VisibleForTesting
     static final int CONNTRACK_TIMEOUT_UPDATE_INTERVAL_MS = 60_000;
     // The interval is set to 5 minutes to strike a balance between minimizing
@@ -327,6 +332,9 @@ public class BpfCoordinator {
 
     private final boolean mSupportActiveSessionsMetrics;
 
+    // Whether IPv4 rules are added with Tether4Value.FLAG_FLOW_STATS.
+    private final boolean mEnableFlowStats;
+
     // Runnable that used by scheduling next refreshing of conntrack metrics sampling.
     private final Runnable mScheduledConntrackMetricsSampling = () -> {
         uploadConntrackMetricsSample();
@@ -483,6 +491,17 @@ public class BpfCoordinator {
             }
         }
 
+        /** Get iif rules BPF map. */
+        @Nullable public IBpfMap<S32, S32> getBpfIifRulesMap() {
+            if (!isAtLeastS()) return null;
+            try {
+                return new BpfMap<>(TETHER_IIF_RULES_MAP_PATH, S32.class, S32.class);
+            } catch (ErrnoException e) {
+                Log.e(TAG, "Cannot create iif rules map: " + e);
+                return null;
+            }
+        }
+
         /** Get error BPF map. */
         @Nullable public IBpfMap<S32, S32> getBpfErrorMap() {
             if (!isAtLeastS()) return null;
@@ -501,6 +520,13 @@ public class BpfCoordinator {
                     lastMaxSessionCount);
         }
 
+        /**
+         * Get the n offloaded IPv4 flows with the most bytes, formatted for dumpsys.
+         */
+        @NonNull public String[] getTopFlows4(int n) {
+            return BpfCoordinator.getTopFlows4(n);
+        }
+
         /**
          * @see DeviceConfigUtils#isTetheringFeatureEnabled
          */
@@ -547,6 +573,8 @@ public class BpfCoordinator {
         // BPF IPv4 forwarding only supports on S+.
         mSupportActiveSessionsMetrics = mDeps.isAtLeastS()
                 && mDeps.isFeatureEnabled(mDeps.getContext(), TETHER_ACTIVE_SESSIONS_METRICS);
+        mEnableFlowStats = mDeps.isAtLeastS()
+                && mDeps.isFeatureEnabled(mDeps.getContext(), TETHER_FLOW_STATS);
     }
 
     /**
@@ -1371,6 +1399,27 @@ public class BpfCoordinator {
                 + mBpfConntrackEventConsumer.getLastMaxConnectionCount());
         pw.println("getCurrentConnectionCount: "
                 + mBpfConntrackEventConsumer.getCurrentConnectionCount());
+
+        pw.println();
+        pw.println("mEnableFlowStats: " + mEnableFlowStats);
+        if (mEnableFlowStats) {
+            pw.println("Top IPv4 flows:");
+            pw.increaseIndent();
+            dumpTopFlows4(pw);
+            pw.decreaseIndent();
+        }
+    }
+
+    private void dumpTopFlows4(@NonNull IndentingPrintWriter pw) {
+        final String[] flows = mDeps.getTopFlows4(DUMP_TOP_FLOWS4);
+        if (flows.length == 0) {
+            pw.println("<empty>");
+            return;
+        }
+        pw.println("proto iif src -> dst: packets bytes");
+        for (String flow : flows) {
+            pw.println(flow);
+        }
     }
 
     private void dumpStats(@NonNull IndentingPrintWriter pw) {
@@ -2152,24 +2201,27 @@ public class BpfCoordinator {
 
         @NonNull
         private Tether4Value makeTetherUpstream4Value(@NonNull ConntrackEvent e,
-                @NonNull UpstreamInfo upstreamInfo) {
-            return new Tether4Value(upstreamInfo.ifIndex,
+                @NonNull Tether4Key key, @NonNull UpstreamInfo upstreamInfo) {
+            return new Tether4Value(key, upstreamInfo.ifIndex,
                     NULL_MAC_ADDRESS /* ethDstMac (rawip) */,
                     NULL_MAC_ADDRESS /* ethSrcMac (rawip) */, ETH_P_IP,
                     upstreamInfo.mtu, toIpv4MappedAddressBytes(e.tupleReply.dstIp),
                     toIpv4MappedAddressBytes(e.tupleReply.srcIp), e.tupleReply.dstPort,
-                    e.tupleReply.srcPort, 0 /* lastUsed, filled by bpf prog only */);
+                    e.tupleReply.srcPort, 0 /* lastUsed, filled by bpf prog only */,
+                    mEnableFlowStats ? Tether4Value.FLAG_FLOW_STATS : 0);
         }
 
         @NonNull
         private Tether4Value makeTetherDownstream4Value(@NonNull ConntrackEvent e,
-                @NonNull ClientInfo c, @NonNull UpstreamInfo upstreamInfo) {
-            return new Tether4Value(c.downstreamIfindex,
+                @NonNull Tether4Key key, @NonNull ClientInfo c,
+                @NonNull UpstreamInfo upstreamInfo) {
+            return new Tether4Value(key, c.downstreamIfindex,
                     c.clientMac, c.downstreamMac, ETH_P_IP, upstreamInfo.mtu,
                     toIpv4MappedAddressBytes(e.tupleOrig.dstIp),
                     toIpv4MappedAddressBytes(e.tupleOrig.srcIp),
                     e.tupleOrig.dstPort, e.tupleOrig.srcPort,
-                    0 /* lastUsed, filled by bpf prog only */);
+                    0 /* lastUsed, filled by bpf prog only */,
+                    mEnableFlowStats ? Tether4Value.FLAG_FLOW_STATS : 0);
         }
 
         private boolean allowOffload(ConntrackEvent e) {
@@ -2220,9 +2272,10 @@ public class BpfCoordinator {
 
             if (mIpv4UpstreamInfo == null || mIpv4UpstreamInfo.ifIndex != upstreamIndex) return;
 
-            final Tether4Value upstream4Value = makeTetherUpstream4Value(e, mIpv4UpstreamInfo);
-            final Tether4Value downstream4Value = makeTetherDownstream4Value(e, tetherClient,
+            final Tether4Value upstream4Value = makeTetherUpstream4Value(e, upstream4Key,
                     mIpv4UpstreamInfo);
+            final Tether4Value downstream4Value = makeTetherDownstream4Value(e, downstream4Key,
+                    tetherClient, mIpv4UpstreamInfo);
 
             maybeAddDevMap(upstreamIndex, tetherClient.downstreamIfindex);
             maybeSetLimit(upstreamIndex);
@@ -2682,4 +2735,5 @@ public class BpfCoordinator {
     }
 
     private static native String[] getBpfCounterNames();
+    private static native String[] getTopFlows4(int n);
 }
@@ -25,6 +25,7 @@ import androidx.annotation.NonNull;
 import com.android.net.module.util.InterfaceParams;
 import com.android.net.module.util.TcUtils;
 
+import java.io.File;
 import java.io.IOException;
 
 /**
@@ -69,6 +70,15 @@ public class BpfUtils {
         return path;
     }
 
+    // On 5.10+ kernels the IPv6 programs can resolve the next hop themselves (bpf_fib_lookup() and
+    // bpf_redirect_neigh()), and then ignore the mac addresses in the tether6 map entries.
+    // These are optional and thus not necessarily present, in which case use the static mac ones.
+    private static String makeIpv6ProgPath(boolean downstream, boolean ether) {
+        final String path = makeProgPath(downstream, 6, ether);
+        final String neighPath = path + "_neigh";
+        return new File(neighPath).exists() ? neighPath : path;
+    }
+
     /**
      * Attach BPF program
      *
@@ -103,7 +113,7 @@ public class BpfUtils {
                 // tc filter add dev .. ingress prio 1 protocol ipv6 bpf object-pinned
                 // /sys/fs/bpf/... direct-action
                 TcUtils.tcFilterAddDevBpf(params.index, INGRESS, PRIO_TETHER6, (short) ETH_P_IPV6,
-                        makeProgPath(downstream, 6, ether));
+                        makeIpv6ProgPath(downstream, ether));
             } catch (IOException e) {
                 throw new IOException("tc filter add dev (" + params.index + "[" + iface
                         + "]) ingress prio PRIO_TETHER6 protocol ipv6 failure: " + e);
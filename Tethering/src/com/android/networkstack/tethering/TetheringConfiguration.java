@@ -150,6 +150,12 @@ public class TetheringConfiguration {
      */
     public static final String TETHER_ACTIVE_SESSIONS_METRICS = "tether_active_sessions_metrics";
 
+    /**
+     * A feature flag to control whether offloaded IPv4 flows should be counted individually,
+     * see {@link BpfCoordinator#dump}. Disabled by default.
+     */
+    public static final String TETHER_FLOW_STATS = "tether_flow_stats";
+
     public final String[] tetherableUsbRegexs;
     public final String[] tetherableWifiRegexs;
     public final String[] tetherableWigigRegexs;
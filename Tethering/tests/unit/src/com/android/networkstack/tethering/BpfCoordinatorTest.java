@@ -62,6 +62,7 @@ import static com.android.networkstack.tethering.BpfUtils.DOWNSTREAM;
 import static com.android.networkstack.tethering.BpfUtils.UPSTREAM;
 import static com.android.networkstack.tethering.TetheringConfiguration.DEFAULT_TETHER_OFFLOAD_POLL_INTERVAL_MS;
 import static com.android.networkstack.tethering.TetheringConfiguration.TETHER_ACTIVE_SESSIONS_METRICS;
+import static com.android.networkstack.tethering.TetheringConfiguration.TETHER_FLOW_STATS;
 import static com.android.testutils.MiscAsserts.assertSameElements;
 
 import static org.junit.Assert.assertArrayEquals;
@@ -119,6 +120,7 @@ import com.android.internal.util.IndentingPrintWriter;
 import com.android.net.module.util.CollectionUtils;
 import com.android.net.module.util.IBpfMap;
 import com.android.net.module.util.InterfaceParams;
+import com.android.net.module.util.IpUtils;
 import com.android.net.module.util.NetworkStackConstants;
 import com.android.net.module.util.SharedLog;
 import com.android.net.module.util.Struct.S32;
@@ -162,6 +164,7 @@ import java.io.StringWriter;
 import java.net.Inet4Address;
 import java.net.Inet6Address;
 import java.net.InetAddress;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.HashMap;
@@ -363,7 +366,8 @@ public class BpfCoordinatorTest {
             }
 
             public Tether4Value build() {
-                return new Tether4Value(mOif, mEthDstMac, mEthSrcMac, mEthProto, mPmtu,
+                return new Tether4Value(new TestUpstream4Key.Builder().build(), mOif,
+                        mEthDstMac, mEthSrcMac, mEthProto, mPmtu,
                         mSrc46, mDst46, mSrcPort, mDstPort, mLastUsed);
             }
         }
@@ -388,7 +392,8 @@ public class BpfCoordinatorTest {
             }
 
             public Tether4Value build() {
-                return new Tether4Value(mOif, mEthDstMac, mEthSrcMac, mEthProto, mPmtu,
+                return new Tether4Value(new TestDownstream4Key.Builder().build(), mOif,
+                        mEthDstMac, mEthSrcMac, mEthProto, mPmtu,
                         mSrc46, mDst46, mSrcPort, mDstPort, mLastUsed);
             }
         }
@@ -488,6 +493,8 @@ public class BpfCoordinatorTest {
             spy(new TestBpfMap<>(TetherDevKey.class, TetherDevValue.class));
     private final IBpfMap<S32, S32> mBpfErrorMap =
             spy(new TestBpfMap<>(S32.class, S32.class));
+    private final IBpfMap<S32, S32> mBpfIifRulesMap =
+            spy(new TestBpfMap<>(S32.class, S32.class));
     private BpfCoordinator.Dependencies mDeps =
             spy(new BpfCoordinator.Dependencies() {
                     @NonNull
@@ -573,6 +580,11 @@ public class BpfCoordinatorTest {
                         return mBpfErrorMap;
                     }
 
+                    @Nullable
+                    public IBpfMap<S32, S32> getBpfIifRulesMap() {
+                        return mBpfIifRulesMap;
+                    }
+
                     @Override
                     public void sendTetheringActiveSessionsReported(int lastMaxSessionCount) {
                         // No-op.
@@ -1618,6 +1630,7 @@ public class BpfCoordinatorTest {
         verify(mBpfUpstream6Map).clear();
         verify(mBpfStatsMap).clear();
         verify(mBpfLimitMap).clear();
+        verify(mBpfIifRulesMap).clear();
     }
 
     @Test
@@ -2013,6 +2026,83 @@ public class BpfCoordinatorTest {
         verify(mBpfDevMap, never()).updateEntry(any(), any());
     }
 
+    // TETHER_IIF_RULES_* bits, see offload.h.
+    private static final int IIF_RULES_DOWNSTREAM6 = 1 << 0;
+    private static final int IIF_RULES_UPSTREAM6 = 1 << 1;
+    private static final int IIF_RULES_DOWNSTREAM4 = 1 << 2;
+    private static final int IIF_RULES_UPSTREAM4 = 1 << 3;
+
+    private void assertIifRules(int ifIndex, int expectedRules) throws Exception {
+        final S32 rules = mBpfIifRulesMap.getValue(new S32(ifIndex));
+        assertEquals(expectedRules, rules == null ? 0 : rules.val);
+        // Interfaces without rules must not have an entry at all.
+        if (expectedRules == 0) assertNull(rules);
+    }
+
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.R)
+    public void testIifRulesMapRule6() throws Exception {
+        final BpfCoordinator coordinator = makeBpfCoordinator();
+
+        // Upstream rules are matched on the downstream interface.
+        dispatchIpv6UpstreamChanged(
+                coordinator, mIpServer, UPSTREAM_IFINDEX, UPSTREAM_IFACE, UPSTREAM_PREFIXES);
+        assertIifRules(DOWNSTREAM_IFINDEX, IIF_RULES_UPSTREAM6);
+        assertIifRules(UPSTREAM_IFINDEX, 0);
+
+        // Downstream rules are matched on the upstream interface. A neighbor changing its mac
+        // address updates its rule in place, which must not be counted as a new rule.
+        recvNewNeigh(DOWNSTREAM_IFINDEX, NEIGH_A, NUD_REACHABLE, MAC_A);
+        recvNewNeigh(DOWNSTREAM_IFINDEX, NEIGH_B, NUD_REACHABLE, MAC_B);
+        recvNewNeigh(DOWNSTREAM_IFINDEX, NEIGH_A, NUD_REACHABLE, MAC_B);
+        assertIifRules(UPSTREAM_IFINDEX, IIF_RULES_DOWNSTREAM6);
+
+        recvDelNeigh(DOWNSTREAM_IFINDEX, NEIGH_A, NUD_STALE, MAC_B);
+        assertIifRules(UPSTREAM_IFINDEX, IIF_RULES_DOWNSTREAM6);
+        recvDelNeigh(DOWNSTREAM_IFINDEX, NEIGH_B, NUD_STALE, MAC_B);
+        assertIifRules(UPSTREAM_IFINDEX, 0);
+
+        dispatchIpv6UpstreamChanged(coordinator, mIpServer, NO_UPSTREAM, null, NO_PREFIXES);
+        assertIifRules(DOWNSTREAM_IFINDEX, 0);
+    }
+
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.R)
+    public void testIifRulesMapRule4() throws Exception {
+        final BpfCoordinator coordinator = makeBpfCoordinator();
+        initBpfCoordinatorForRule4(coordinator);
+        assertIifRules(UPSTREAM_IFINDEX, 0);
+        assertIifRules(DOWNSTREAM_IFINDEX, 0);
+
+        mConsumer.accept(new TestConntrackEvent.Builder()
+                .setMsgType(IPCTNL_MSG_CT_NEW)
+                .setProto(IPPROTO_TCP)
+                .build());
+        mConsumer.accept(new TestConntrackEvent.Builder()
+                .setMsgType(IPCTNL_MSG_CT_NEW)
+                .setProto(IPPROTO_UDP)
+                .build());
+        assertIifRules(UPSTREAM_IFINDEX, IIF_RULES_DOWNSTREAM4);
+        assertIifRules(DOWNSTREAM_IFINDEX, IIF_RULES_UPSTREAM4);
+
+        mConsumer.accept(new TestConntrackEvent.Builder()
+                .setMsgType(IPCTNL_MSG_CT_DELETE)
+                .setProto(IPPROTO_UDP)
+                .build());
+        assertIifRules(UPSTREAM_IFINDEX, IIF_RULES_DOWNSTREAM4);
+        assertIifRules(DOWNSTREAM_IFINDEX, IIF_RULES_UPSTREAM4);
+
+        // Removing the last rule on the upstream also clears its stats.
+        updateStatsEntryForTetherOffloadGetAndClearStats(
+                buildTestTetherStatsParcel(UPSTREAM_IFINDEX, 0, 0, 0, 0));
+        mConsumer.accept(new TestConntrackEvent.Builder()
+                .setMsgType(IPCTNL_MSG_CT_DELETE)
+                .setProto(IPPROTO_TCP)
+                .build());
+        assertIifRules(UPSTREAM_IFINDEX, 0);
+        assertIifRules(DOWNSTREAM_IFINDEX, 0);
+    }
+
     @FeatureFlag(name = TETHER_ACTIVE_SESSIONS_METRICS)
     // BPF IPv4 forwarding only supports on S+.
     @IgnoreUpTo(Build.VERSION_CODES.R)
@@ -2085,6 +2175,40 @@ public class BpfCoordinatorTest {
         }
     }
 
+    @FeatureFlag(name = TETHER_FLOW_STATS)
+    // BPF IPv4 forwarding only supports on S+.
+    @IgnoreUpTo(Build.VERSION_CODES.R)
+    @Test
+    public void testFlowStats_enabled() throws Exception {
+        doTestFlowStats(true);
+    }
+
+    @FeatureFlag(name = TETHER_FLOW_STATS, enabled = false)
+    @IgnoreUpTo(Build.VERSION_CODES.R)
+    @Test
+    public void testFlowStats_disabled() throws Exception {
+        doTestFlowStats(false);
+    }
+
+    private void doTestFlowStats(final boolean enableFlowStats) throws Exception {
+        final BpfCoordinator coordinator = makeBpfCoordinator();
+        initBpfCoordinatorForRule4(coordinator);
+
+        mConsumer.accept(new TestConntrackEvent.Builder()
+                .setMsgType(IPCTNL_MSG_CT_NEW)
+                .setProto(IPPROTO_TCP)
+                .build());
+        final int expectedFlags = enableFlowStats ? Tether4Value.FLAG_FLOW_STATS : 0;
+        verify(mBpfUpstream4Map).insertEntry(any(), argThat(v -> v.flags == expectedFlags));
+        verify(mBpfDownstream4Map).insertEntry(any(), argThat(v -> v.flags == expectedFlags));
+
+        final String flow = "tcp 1001 140.112.8.116:443 -> 1.0.0.1:62449: 3 180";
+        doReturn(new String[] {flow}).when(mDeps).getTopFlows4(anyInt());
+        final StringWriter stringWriter = new StringWriter();
+        coordinator.dump(new IndentingPrintWriter(stringWriter, " "));
+        assertEquals(enableFlowStats, stringWriter.toString().contains(flow));
+    }
+
     // Helper method to assert all counter values inside consumer.
     private void assertConsumerCountersEquals(int expectedCount) {
         assertEquals(expectedCount, mConsumer.getCurrentConnectionCount());
@@ -2335,6 +2459,63 @@ public class BpfCoordinatorTest {
         checkRefreshConntrackTimeout(bpfDownstream4Map, tcpKey, tcpValue, udpKey, udpValue);
     }
 
+    // Builds an IPv4 TCP packet with a small payload and valid checksums.
+    private static ByteBuffer makeTcp4Packet(final byte[] src4, final byte[] dst4,
+            final int srcPort, final int dstPort, final int ttl) {
+        final ByteBuffer buf = ByteBuffer.allocate(20 + 20 + 4);
+        buf.put(0, (byte) 0x45);  // version 4, ihl 5
+        buf.putShort(2, (short) buf.capacity());
+        buf.put(8, (byte) ttl);
+        buf.put(9, (byte) IPPROTO_TCP);
+        buf.position(12);
+        buf.put(src4, 0, 4);
+        buf.put(dst4, 0, 4);
+        buf.putShort(20, (short) srcPort);
+        buf.putShort(22, (short) dstPort);
+        buf.put(32, (byte) 0x50);  // data offset 5
+        buf.putInt(40, 0x61626364);
+        buf.putShort(10, IpUtils.ipChecksum(buf, 0));
+        buf.putShort(36, IpUtils.tcpChecksum(buf, 0, 20, 24));
+        return buf;
+    }
+
+    // Applies a checksum delta like the kernel's csum_replace_by_diff() does.
+    private static short applyCsumDelta(final short check, final int delta) {
+        int sum = (~check & 0xffff) + delta;
+        sum = (sum & 0xffff) + (sum >>> 16);
+        sum = (sum & 0xffff) + (sum >>> 16);
+        return (short) ~sum;
+    }
+
+    private void checkTether4ValueChecksumDeltas(final Tether4Key key, final Tether4Value value) {
+        final byte[] src4 = Arrays.copyOfRange(value.src46, 12, 16);
+        final byte[] dst4 = Arrays.copyOfRange(value.dst46, 12, 16);
+        final ByteBuffer pkt = makeTcp4Packet(key.src4, key.dst4, key.srcPort, key.dstPort, 64);
+
+        // Translate the packet like the bpf program does.
+        pkt.put(8, (byte) 63);
+        pkt.position(12);
+        pkt.put(src4);
+        pkt.put(dst4);
+        pkt.putShort(20, (short) value.srcPort);
+        pkt.putShort(22, (short) value.dstPort);
+        pkt.putShort(10, applyCsumDelta(pkt.getShort(10), value.l3CsumDelta));
+        pkt.putShort(36, applyCsumDelta(applyCsumDelta(pkt.getShort(36),
+                value.l4PseudoCsumDelta), value.l4PortsCsumDelta));
+
+        final ByteBuffer expected = makeTcp4Packet(src4, dst4, value.srcPort, value.dstPort, 63);
+        assertEquals(expected.getShort(10), pkt.getShort(10));
+        assertEquals(expected.getShort(36), pkt.getShort(36));
+    }
+
+    @Test
+    public void testTether4ValueChecksumDeltas() throws Exception {
+        checkTether4ValueChecksumDeltas(UPSTREAM4_RULE_KEY_A, UPSTREAM4_RULE_VALUE_A);
+        checkTether4ValueChecksumDeltas(DOWNSTREAM4_RULE_KEY_A, DOWNSTREAM4_RULE_VALUE_A);
+        checkTether4ValueChecksumDeltas(UPSTREAM4_RULE_KEY_B, UPSTREAM4_RULE_VALUE_B);
+        checkTether4ValueChecksumDeltas(DOWNSTREAM4_RULE_KEY_B, DOWNSTREAM4_RULE_VALUE_B);
+    }
+
     @Test
     @IgnoreUpTo(Build.VERSION_CODES.R)
     public void testNotAllowOffloadByConntrackMessageDestinationPort() throws Exception {
@@ -2421,17 +2602,19 @@ public class BpfCoordinatorTest {
     //
     private static final Tether4Key UPSTREAM4_RULE_KEY_A = makeUpstream4Key(
             DOWNSTREAM_IFINDEX, DOWNSTREAM_MAC, PRIVATE_ADDR, PRIVATE_PORT);
-    private static final Tether4Value UPSTREAM4_RULE_VALUE_A = makeUpstream4Value(PUBLIC_PORT);
+    private static final Tether4Value UPSTREAM4_RULE_VALUE_A = makeUpstream4Value(
+            UPSTREAM4_RULE_KEY_A, PUBLIC_PORT);
     private static final Tether4Key DOWNSTREAM4_RULE_KEY_A = makeDownstream4Key(PUBLIC_PORT);
     private static final Tether4Value DOWNSTREAM4_RULE_VALUE_A = makeDownstream4Value(
-            DOWNSTREAM_IFINDEX, MAC_A, DOWNSTREAM_MAC, PRIVATE_ADDR, PRIVATE_PORT);
+            DOWNSTREAM4_RULE_KEY_A, DOWNSTREAM_IFINDEX, MAC_A, DOWNSTREAM_MAC, PRIVATE_ADDR, PRIVATE_PORT);
 
     private static final Tether4Key UPSTREAM4_RULE_KEY_B = makeUpstream4Key(
             DOWNSTREAM_IFINDEX2, DOWNSTREAM_MAC2, PRIVATE_ADDR2, PRIVATE_PORT2);
-    private static final Tether4Value UPSTREAM4_RULE_VALUE_B = makeUpstream4Value(PUBLIC_PORT2);
+    private static final Tether4Value UPSTREAM4_RULE_VALUE_B = makeUpstream4Value(
+            UPSTREAM4_RULE_KEY_B, PUBLIC_PORT2);
     private static final Tether4Key DOWNSTREAM4_RULE_KEY_B = makeDownstream4Key(PUBLIC_PORT2);
     private static final Tether4Value DOWNSTREAM4_RULE_VALUE_B = makeDownstream4Value(
-            DOWNSTREAM_IFINDEX2, MAC_B, DOWNSTREAM_MAC2, PRIVATE_ADDR2, PRIVATE_PORT2);
+            DOWNSTREAM4_RULE_KEY_B, DOWNSTREAM_IFINDEX2, MAC_B, DOWNSTREAM_MAC2, PRIVATE_ADDR2, PRIVATE_PORT2);
 
     private static final ConntrackEvent CONNTRACK_EVENT_A = makeTestConntrackEvent(
             PUBLIC_PORT, PRIVATE_ADDR, PRIVATE_PORT);
@@ -2455,8 +2638,9 @@ public class BpfCoordinatorTest {
     }
 
     @NonNull
-    private static Tether4Value makeUpstream4Value(final short publicPort) {
-        return new Tether4Value(UPSTREAM_IFINDEX,
+    private static Tether4Value makeUpstream4Value(@NonNull final Tether4Key key,
+            final short publicPort) {
+        return new Tether4Value(key, UPSTREAM_IFINDEX,
                 MacAddress.ALL_ZEROS_ADDRESS /* ethDstMac (rawip) */,
                 MacAddress.ALL_ZEROS_ADDRESS /* ethSrcMac (rawip) */, ETH_P_IP,
                 NetworkStackConstants.ETHER_MTU, toIpv4MappedAddressBytes(PUBLIC_ADDR),
@@ -2465,10 +2649,11 @@ public class BpfCoordinatorTest {
     }
 
     @NonNull
-    private static Tether4Value makeDownstream4Value(final int downstreamIfindex,
-            @NonNull final MacAddress clientMac, @NonNull final MacAddress downstreamMac,
-            @NonNull final Inet4Address privateAddr, final short privatePort) {
-        return new Tether4Value(downstreamIfindex, clientMac, downstreamMac,
+    private static Tether4Value makeDownstream4Value(@NonNull final Tether4Key key,
+            final int downstreamIfindex, @NonNull final MacAddress clientMac,
+            @NonNull final MacAddress downstreamMac, @NonNull final Inet4Address privateAddr,
+            final short privatePort) {
+        return new Tether4Value(key, downstreamIfindex, clientMac, downstreamMac,
                 ETH_P_IP, NetworkStackConstants.ETHER_MTU, toIpv4MappedAddressBytes(REMOTE_ADDR),
                 toIpv4MappedAddressBytes(privateAddr), REMOTE_PORT, privatePort, 0 /* lastUsed */);
     }
@@ -2633,15 +2818,15 @@ public class BpfCoordinatorTest {
         // Add the rules for client A and client B.
         final Tether4Key upstream4KeyA = makeUpstream4Key(
                 DOWNSTREAM_IFINDEX, DOWNSTREAM_MAC, PRIVATE_ADDR, PRIVATE_PORT);
-        final Tether4Value upstream4ValueA = makeUpstream4Value(PUBLIC_PORT);
+        final Tether4Value upstream4ValueA = makeUpstream4Value(upstream4KeyA, PUBLIC_PORT);
         final Tether4Key downstream4KeyA = makeDownstream4Key(PUBLIC_PORT);
-        final Tether4Value downstream4ValueA = makeDownstream4Value(
+        final Tether4Value downstream4ValueA = makeDownstream4Value(downstream4KeyA,
                 DOWNSTREAM_IFINDEX, MAC_A, DOWNSTREAM_MAC, PRIVATE_ADDR, PRIVATE_PORT);
         final Tether4Key upstream4KeyB = makeUpstream4Key(
                 DOWNSTREAM_IFINDEX, DOWNSTREAM_MAC2, PRIVATE_ADDR2, PRIVATE_PORT2);
-        final Tether4Value upstream4ValueB = makeUpstream4Value(PUBLIC_PORT2);
+        final Tether4Value upstream4ValueB = makeUpstream4Value(upstream4KeyB, PUBLIC_PORT2);
         final Tether4Key downstream4KeyB = makeDownstream4Key(PUBLIC_PORT2);
-        final Tether4Value downstream4ValueB = makeDownstream4Value(
+        final Tether4Value downstream4ValueB = makeDownstream4Value(downstream4KeyB,
                 DOWNSTREAM_IFINDEX, MAC_B, DOWNSTREAM_MAC2, PRIVATE_ADDR2, PRIVATE_PORT2);
 
         mBpfUpstream4Map.insertEntry(upstream4KeyA, upstream4ValueA);
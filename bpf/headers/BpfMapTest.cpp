@@ -17,6 +17,7 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <fcntl.h>
@@ -127,6 +128,15 @@ TEST_F(BpfMapTest, basicHelpers) {
     ASSERT_EQ(ENOENT, errno);
 }
 
+TEST_F(BpfMapTest, getMaxEntries) {
+    BpfMap<uint32_t, uint32_t> testMap;
+    ASSERT_FALSE(testMap.getMaxEntries().ok());
+    ASSERT_RESULT_OK(testMap.resetMap(BPF_MAP_TYPE_HASH, TEST_MAP_SIZE, BPF_F_NO_PREALLOC));
+    Result<uint32_t> maxEntries = testMap.getMaxEntries();
+    ASSERT_RESULT_OK(maxEntries);
+    EXPECT_EQ(TEST_MAP_SIZE, maxEntries.value());
+}
+
 TEST_F(BpfMapTest, reset) {
     BpfMap<uint32_t, uint32_t> testMap;
     ASSERT_RESULT_OK(testMap.resetMap(BPF_MAP_TYPE_HASH, TEST_MAP_SIZE, BPF_F_NO_PREALLOC));
@@ -208,6 +218,39 @@ TEST_F(BpfMapTest, iterateWithValue) {
     expectMapEmpty(testMap);
 }
 
+TEST_F(BpfMapTest, iterateWithValueTolerantConcurrentDeletion) {
+    constexpr uint32_t kEntries = 5000;
+    BpfMap<uint32_t, uint32_t> testMap;
+    ASSERT_RESULT_OK(testMap.resetMap(BPF_MAP_TYPE_HASH, kEntries, BPF_F_NO_PREALLOC));
+    populateMap(kEntries, testMap);
+
+    // Delete every odd key from another thread while the walk is in progress.
+    std::thread deleter([&testMap]() {
+        for (uint32_t key = 1; key < kEntries; key += 2) {
+            EXPECT_RESULT_OK(testMap.deleteValue(key));
+        }
+    });
+
+    std::vector<int> visits(kEntries, 0);
+    const auto countVisits = [&visits](const uint32_t& key, const uint32_t& value,
+                                       const BpfMapRO<uint32_t, uint32_t>&) -> Result<void> {
+        EXPECT_GT(kEntries, key);
+        EXPECT_EQ(key * 10, value);
+        if (key < kEntries) visits[key]++;
+        return {};
+    };
+    EXPECT_RESULT_OK(testMap.iterateWithValueTolerant(countVisits));
+    deleter.join();
+
+    for (uint32_t key = 0; key < kEntries; key++) {
+        if (key % 2) {
+            EXPECT_GE(1, visits[key]) << "key " << key;
+        } else {
+            EXPECT_EQ(1, visits[key]) << "key " << key;
+        }
+    }
+}
+
 TEST_F(BpfMapTest, mapIsEmpty) {
     BpfMap<uint32_t, uint32_t> testMap;
     ASSERT_RESULT_OK(testMap.resetMap(BPF_MAP_TYPE_HASH, TEST_MAP_SIZE, BPF_F_NO_PREALLOC));
@@ -26,7 +26,11 @@
 #include "BpfSyscallWrappers.h"
 #include "bpf/BpfUtils.h"
 
+#include <array>
 #include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
 
 namespace android {
 namespace bpf {
@@ -48,7 +52,10 @@ using std::function;
 // be obtained by multiple eBPF map class object and accessed concurrently.
 // Though the map class object and the underlying kernel map are thread safe, it
 // is not safe to iterate over a map while another thread or process is deleting
-// from it. In this case the iteration can return duplicate entries.
+// from it. In this case the iteration can return duplicate entries, or fail
+// outright if an entry vanishes between fetching its key and reading its value.
+// Use iterateWithValueTolerant() for maps that are concurrently pruned (for
+// example by the kernel itself).
 template <class Key, class Value>
 class BpfMapRO {
   public:
@@ -133,6 +140,15 @@ class BpfMapRO {
             const function<Result<void>(const Key& key, const Value& value,
                                         const BpfMapRO<Key, Value>& map)>& filter) const;
 
+    // Like iterateWithValue(), but tolerates entries being deleted concurrently:
+    // entries which disappear before their value can be read are skipped, and if the
+    // kernel restarts the walk from the first bucket (which a hash map does when the
+    // key we are positioned on has been deleted) every key is still handed to the
+    // filter at most once.  Costs O(n) memory to remember the keys already visited.
+    Result<void> iterateWithValueTolerant(
+            const function<Result<void>(const Key& key, const Value& value,
+                                        const BpfMapRO<Key, Value>& map)>& filter) const;
+
 #ifdef BPF_MAP_MAKE_VISIBLE_FOR_TESTING
     const unique_fd& getMap() const { return mMapFd; };
 
@@ -177,6 +193,56 @@ class BpfMapRO {
 
     bool isValid() const { return mMapFd.ok(); }
 
+    // Reads the values of the first N entries (for an ARRAY map: keys 0..N-1) with a single
+    // syscall, instead of one per key.  Batched lookups require a 5.6+ kernel.
+    template <size_t N>
+    Result<std::array<Value, N>> readFirstValues() const {
+        Key outBatch;
+        std::array<Key, N> keys;
+        std::array<Value, N> values;
+        uint32_t count = N;
+        if (lookupMapBatch(mMapFd, &outBatch, keys.data(), values.data(), &count) &&
+            errno != ENOENT) {
+            return ErrnoErrorf("BpfMap::readFirstValues() failed");
+        }
+        if (count != N) return Errorf("BpfMap::readFirstValues() only read {}/{}", count, N);
+        return values;
+    }
+
+    // Reads all entries of the map into 'keys' and 'values', with a single syscall on 5.6+
+    // kernels and by iterating key by key otherwise.  The vectors are reused as scratch space
+    // so that periodic callers do not need to reallocate them on every read.
+    Result<void> readAllEntries(std::vector<Key>* keys, std::vector<Value>* values) const {
+        Result<uint32_t> maxEntries = getMaxEntries();
+        if (maxEntries.ok() && isAtLeastKernelVersion(5, 6, 0)) {
+            Key outBatch;
+            uint32_t count = maxEntries.value();
+            keys->resize(count);
+            values->resize(count);
+            if (!lookupMapBatch(mMapFd, &outBatch, keys->data(), values->data(), &count) ||
+                errno == ENOENT) {
+                keys->resize(count);
+                values->resize(count);
+                return {};
+            }
+        }
+        keys->clear();
+        values->clear();
+        return iterateWithValue([&](const Key& key, const Value& value, const BpfMapRO&) {
+            keys->push_back(key);
+            values->push_back(value);
+            return Result<void>();
+        });
+    }
+
+    // The live capacity of the map, which may differ from the size it was declared
+    // with in the bpf program if the bpfloader applied a max_entries override.
+    Result<uint32_t> getMaxEntries() const {
+        int ret = bpfGetFdMaxEntries(mMapFd);
+        if (ret < 0) return ErrnoErrorf("BpfMap::getMaxEntries() failed");
+        return static_cast<uint32_t>(ret);
+    }
+
     Result<bool> isEmpty() const {
         auto key = getFirstKey();
         if (key.ok()) return false;
@@ -220,6 +286,32 @@ Result<void> BpfMapRO<Key, Value>::iterateWithValue(
     return curKey.error();
 }
 
+template <class Key, class Value>
+Result<void> BpfMapRO<Key, Value>::iterateWithValueTolerant(
+        const function<Result<void>(const Key& key, const Value& value,
+                                    const BpfMapRO<Key, Value>& map)>& filter) const {
+    std::unordered_set<std::string> visited;
+    Result<Key> curKey = getFirstKey();
+    while (curKey.ok()) {
+        const Result<Key>& nextKey = getNextKey(curKey.value());
+        // After a restart we walk over already visited keys again, but only pay one
+        // getNextKey() per key: no value lookup, and no second call to the filter.
+        const std::string rawKey(reinterpret_cast<const char*>(&curKey.value()), sizeof(Key));
+        if (visited.insert(rawKey).second) {
+            Result<Value> curValue = readValue(curKey.value());
+            if (curValue.ok()) {
+                Result<void> status = filter(curKey.value(), curValue.value(), *this);
+                if (!status.ok()) return status;
+            } else if (curValue.error().code() != ENOENT) {
+                return curValue.error();
+            }
+        }
+        curKey = nextKey;
+    }
+    if (curKey.error().code() == ENOENT) return {};
+    return curKey.error();
+}
+
 template <class Key, class Value>
 class BpfMap : public BpfMapRO<Key, Value> {
   protected:
@@ -20,6 +20,7 @@
 #include <linux/if_ether.h>
 #include <linux/pfkeyv2.h>
 #include <net/if.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
@@ -83,6 +84,30 @@ static inline int synchronizeKernelRCU() {
     return 0;
 }
 
+// Returns the number of possible cpus, which is the number of values a lookup in any
+// BPF_MAP_TYPE_PERCPU_* map returns (each rounded up to a multiple of 8 bytes), or -errno.
+static inline int getNumPossibleCpus() {
+    FILE* f = fopen("/sys/devices/system/cpu/possible", "re");
+    if (!f) return -errno;
+    // The file holds a cpu list such as "0-7" or "0,2-3", see Documentation/ABI/.../cpu
+    int cpus = 0;
+    unsigned first, last;
+    int n;
+    while ((n = fscanf(f, "%u", &first)) == 1) {
+        last = first;
+        int c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%u", &last) != 1) break;
+            c = fgetc(f);
+        }
+        if (last < first) break;
+        cpus += last - first + 1;
+        if (c != ',') break;
+    }
+    fclose(f);
+    return cpus > 0 ? cpus : -EINVAL;
+}
+
 static inline int setrlimitForTest() {
     // Set the memory rlimit for the test process if the default MEMLOCK rlimit is not enough.
     struct rlimit limit = {
@@ -235,6 +235,21 @@ static void (*bpf_ringbuf_submit_unsafe)(const void* data, __u64 flags) = (void*
                             usr, grp, md, selinux, pindir, share, minkver,  \
                             maxkver, minloader, maxloader, ignore_eng,      \
                             ignore_user, ignore_userdebug)                  \
+    DEFINE_BPF_RESIZABLE_MAP_BASE(the_map, TYPE, keysize, valuesize,        \
+                                  num_entries, 0, 0, usr, grp, md, selinux, \
+                                  pindir, share, minkver, maxkver,          \
+                                  minloader, maxloader, ignore_eng,         \
+                                  ignore_user, ignore_userdebug)
+
+// As above, but the bpfloader may override num_entries at load time, to anywhere within
+// [num_entries >> shrink_log2, num_entries << grow_log2].  Userspace must thus not
+// assume the compiled in size, but should query the live map's max_entries instead.
+#define DEFINE_BPF_RESIZABLE_MAP_BASE(the_map, TYPE, keysize, valuesize,    \
+                                      num_entries, shrink_log2, grow_log2,  \
+                                      usr, grp, md, selinux, pindir, share, \
+                                      minkver, maxkver, minloader,          \
+                                      maxloader, ignore_eng, ignore_user,   \
+                                      ignore_userdebug)                     \
     const struct bpf_map_def SECTION("maps") the_map = {                    \
         .type = BPF_MAP_TYPE_##TYPE,                                        \
         .key_size = (keysize),                                              \
@@ -254,7 +269,10 @@ static void (*bpf_ringbuf_submit_unsafe)(const void* data, __u64 flags) = (void*
         .ignore_on_eng = (ignore_eng).ignore_on_eng,                        \
         .ignore_on_user = (ignore_user).ignore_on_user,                     \
         .ignore_on_userdebug = (ignore_userdebug).ignore_on_userdebug,      \
+        .max_entries_shrink_log2 = (shrink_log2),                           \
+        .max_entries_grow_log2 = (grow_log2),                               \
     };                                                                      \
+    _Static_assert((shrink_log2) < 32 && (grow_log2) < 32, "bad resize");   \
     BPF_ASSERT_LOADER_VERSION(minloader, ignore_eng, ignore_user, ignore_userdebug);
 
 // Type safe macro to declare a ring buffer and related output functions.
@@ -318,10 +336,19 @@ static void (*bpf_ringbuf_submit_unsafe)(const void* data, __u64 flags) = (void*
 #define DEFINE_BPF_MAP_EXT(the_map, TYPE, KeyType, ValueType, num_entries, usr, grp, md,         \
                            selinux, pindir, share, min_loader, max_loader, ignore_eng,           \
                            ignore_user, ignore_userdebug)                                        \
-  DEFINE_BPF_MAP_BASE(the_map, TYPE, sizeof(KeyType), sizeof(ValueType),                         \
-                      num_entries, usr, grp, md, selinux, pindir, share,                         \
-                      KVER_NONE, KVER_INF, min_loader, max_loader,                               \
-                      ignore_eng, ignore_user, ignore_userdebug);                                \
+    DEFINE_BPF_RESIZABLE_MAP_EXT(the_map, TYPE, KeyType, ValueType, num_entries, 0, 0,           \
+                                 usr, grp, md, selinux, pindir, share, min_loader, max_loader,   \
+                                 ignore_eng, ignore_user, ignore_userdebug)
+
+/* as above, but see DEFINE_BPF_RESIZABLE_MAP_BASE for the meaning of shrink_log2/grow_log2 */
+#define DEFINE_BPF_RESIZABLE_MAP_EXT(the_map, TYPE, KeyType, ValueType, num_entries,             \
+                                     shrink_log2, grow_log2, usr, grp, md, selinux, pindir,      \
+                                     share, min_loader, max_loader, ignore_eng, ignore_user,     \
+                                     ignore_userdebug)                                           \
+  DEFINE_BPF_RESIZABLE_MAP_BASE(the_map, TYPE, sizeof(KeyType), sizeof(ValueType),               \
+                                num_entries, shrink_log2, grow_log2, usr, grp, md, selinux,      \
+                                pindir, share, KVER_NONE, KVER_INF, min_loader, max_loader,      \
+                                ignore_eng, ignore_user, ignore_userdebug);                      \
     BPF_MAP_ASSERT_OK(BPF_MAP_TYPE_##TYPE, (num_entries), (md));                                 \
     _Static_assert(sizeof(KeyType) < 1024, "aosp/2370288 requires < 1024 byte keys");            \
     _Static_assert(sizeof(ValueType) < 65536, "aosp/2370288 requires < 65536 byte values");      \
@@ -387,6 +414,14 @@ static void (*bpf_ringbuf_submit_unsafe)(const void* data, __u64 flags) = (void*
     DEFINE_BPF_MAP_UGM(the_map, TYPE, KeyType, ValueType, num_entries, \
                        DEFAULT_BPF_MAP_UID, gid, 0660)
 
+#define DEFINE_BPF_RESIZABLE_MAP_GRW(the_map, TYPE, KeyType, ValueType, num_entries,        \
+                                     shrink_log2, grow_log2, gid)                           \
+    DEFINE_BPF_RESIZABLE_MAP_EXT(the_map, TYPE, KeyType, ValueType, num_entries,            \
+                                 shrink_log2, grow_log2, DEFAULT_BPF_MAP_UID, gid, 0660,    \
+                                 DEFAULT_BPF_MAP_SELINUX_CONTEXT, DEFAULT_BPF_MAP_PIN_SUBDIR, \
+                                 PRIVATE, BPFLOADER_MIN_VER, BPFLOADER_MAX_VER,             \
+                                 LOAD_ON_ENG, LOAD_ON_USER, LOAD_ON_USERDEBUG)
+
 // LLVM eBPF builtins: they directly generate BPF_LD_ABS/BPF_LD_IND (skb may be ignored?)
 unsigned long long load_byte(void* skb, unsigned long long off) asm("llvm.bpf.load.byte");
 unsigned long long load_half(void* skb, unsigned long long off) asm("llvm.bpf.load.half");
@@ -204,7 +204,12 @@ struct bpf_map_def {
     bool ignore_on_x86_64:1;
     bool ignore_on_riscv64:1;
 
-    char pad0[2];  // manually pad up to 4 byte alignment, may be used for extensions in the future
+    // The following 2 fields were added in version 0.47 (W), they used to be padding, so are
+    // zero in programs compiled before that, and ignored by older bpfloader versions.
+    // They bound how far max_entries may be overridden at load time (via the bpfloader's map
+    // size configuration), ie. to [max_entries >> shrink_log2, max_entries << grow_log2].
+    unsigned char max_entries_shrink_log2;
+    unsigned char max_entries_grow_log2;
 
     unsigned int uid;   // uid_t
 };
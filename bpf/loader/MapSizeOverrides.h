@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+#include "bpf_map_def.h"
+
+namespace android {
+namespace bpf {
+
+// Device specific map capacity overrides, read once by the bpfloader before creating any maps.
+//
+// Each line is of the form '<map pin name> <max_entries>', where the pin name is the basename
+// the map is pinned under in /sys/fs/bpf, for example:
+//
+//   # Busy multi-user device
+//   map_netd_cookie_tag_map 40000
+//   map_offload_tether_downstream4_map 4096
+//
+// Empty lines and everything following a '#' are ignored.
+constexpr const char* kMapSizeOverridesPath = "/vendor/etc/bpf/map_size_overrides.conf";
+
+using MapSizeOverrides = std::unordered_map<std::string, unsigned int>;
+
+// Parses the contents of a map size overrides file into 'overrides'.
+// On a malformed or duplicate entry returns false and sets 'error': the caller is expected
+// to then ignore the file in its entirety, rather than apply only part of it.
+inline bool parseMapSizeOverrides(const std::string& content, MapSizeOverrides* overrides,
+                                  std::string* error) {
+    MapSizeOverrides result;
+    int lineNo = 0;
+    for (const auto& rawLine : base::Split(content, "\n")) {
+        ++lineNo;
+        const std::string line = base::Trim(rawLine.substr(0, rawLine.find('#')));
+        if (line.empty()) continue;
+
+        const auto tokens = base::Tokenize(line, " \t");
+        unsigned int maxEntries;
+        if (tokens.size() != 2 || !base::StartsWith(tokens[0], "map_") ||
+            !base::ParseUint(tokens[1], &maxEntries) || !maxEntries) {
+            *error = base::StringPrintf("line %d: malformed entry '%s'", lineNo, line.c_str());
+            return false;
+        }
+        if (!result.emplace(tokens[0], maxEntries).second) {
+            *error = base::StringPrintf("line %d: duplicate entry for %s", lineNo,
+                                        tokens[0].c_str());
+            return false;
+        }
+    }
+    *overrides = std::move(result);
+    return true;
+}
+
+// Returns whether a map may be created with 'maxEntries' instead of its compiled in size,
+// ie. whether it was declared resizable and the new size is within the declared bounds.
+inline bool isMapSizeOverrideAllowed(const struct bpf_map_def& md, unsigned int maxEntries) {
+    if (!md.max_entries_shrink_log2 && !md.max_entries_grow_log2) return false;
+    if (md.max_entries_shrink_log2 >= 32 || md.max_entries_grow_log2 >= 32) return false;
+    const uint64_t lo = md.max_entries >> md.max_entries_shrink_log2;
+    const uint64_t hi = static_cast<uint64_t>(md.max_entries) << md.max_entries_grow_log2;
+    return maxEntries && lo <= maxEntries && maxEntries <= hi;
+}
+
+}  // namespace bpf
+}  // namespace android
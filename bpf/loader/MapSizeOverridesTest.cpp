@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "MapSizeOverrides.h"
+
+namespace android {
+namespace bpf {
+
+static struct bpf_map_def makeMapDef(unsigned int maxEntries, unsigned char shrinkLog2,
+                                     unsigned char growLog2) {
+    struct bpf_map_def md = {};
+    md.type = BPF_MAP_TYPE_HASH;
+    md.max_entries = maxEntries;
+    md.max_entries_shrink_log2 = shrinkLog2;
+    md.max_entries_grow_log2 = growLog2;
+    return md;
+}
+
+TEST(MapSizeOverridesTest, ParseValid) {
+    MapSizeOverrides overrides;
+    std::string error;
+    ASSERT_TRUE(parseMapSizeOverrides("# comment only\n"
+                                      "\n"
+                                      "map_netd_cookie_tag_map 40000\n"
+                                      "  map_offload_tether_downstream4_map\t4096  # trailing\n",
+                                      &overrides, &error))
+            << error;
+    EXPECT_EQ(2U, overrides.size());
+    EXPECT_EQ(40000U, overrides["map_netd_cookie_tag_map"]);
+    EXPECT_EQ(4096U, overrides["map_offload_tether_downstream4_map"]);
+}
+
+TEST(MapSizeOverridesTest, ParseEmpty) {
+    MapSizeOverrides overrides = {{"map_stale", 1}};
+    std::string error;
+    ASSERT_TRUE(parseMapSizeOverrides("", &overrides, &error));
+    EXPECT_TRUE(overrides.empty());
+}
+
+TEST(MapSizeOverridesTest, ParseRejectsMalformed) {
+    const char* const kBad[] = {
+            "map_netd_cookie_tag_map\n",
+            "map_netd_cookie_tag_map 100 200\n",
+            "map_netd_cookie_tag_map abc\n",
+            "map_netd_cookie_tag_map -1\n",
+            "map_netd_cookie_tag_map 0\n",
+            "map_netd_cookie_tag_map 4294967296\n",
+            "cookie_tag_map 100\n",
+    };
+    for (const char* content : kBad) {
+        MapSizeOverrides overrides = {{"map_untouched", 1}};
+        std::string error;
+        EXPECT_FALSE(parseMapSizeOverrides(content, &overrides, &error)) << content;
+        EXPECT_FALSE(error.empty()) << content;
+        // A bad file must not be partially applied.
+        EXPECT_EQ(1U, overrides.size()) << content;
+    }
+}
+
+TEST(MapSizeOverridesTest, ParseRejectsDuplicate) {
+    MapSizeOverrides overrides;
+    std::string error;
+    EXPECT_FALSE(parseMapSizeOverrides("map_a 10\nmap_b 20\nmap_a 30\n", &overrides, &error));
+    EXPECT_NE(std::string::npos, error.find("line 3"));
+    EXPECT_TRUE(overrides.empty());
+}
+
+TEST(MapSizeOverridesTest, BoundsNotResizable) {
+    const auto md = makeMapDef(1024, 0, 0);
+    EXPECT_FALSE(isMapSizeOverrideAllowed(md, 1024));
+    EXPECT_FALSE(isMapSizeOverrideAllowed(md, 2048));
+}
+
+TEST(MapSizeOverridesTest, BoundsRange) {
+    const auto md = makeMapDef(1024, 2, 4);
+    EXPECT_FALSE(isMapSizeOverrideAllowed(md, 0));
+    EXPECT_FALSE(isMapSizeOverrideAllowed(md, 255));
+    EXPECT_TRUE(isMapSizeOverrideAllowed(md, 256));
+    EXPECT_TRUE(isMapSizeOverrideAllowed(md, 1024));
+    EXPECT_TRUE(isMapSizeOverrideAllowed(md, 16384));
+    EXPECT_FALSE(isMapSizeOverrideAllowed(md, 16385));
+}
+
+TEST(MapSizeOverridesTest, BoundsGrowOnly) {
+    const auto md = makeMapDef(5000, 0, 1);
+    EXPECT_FALSE(isMapSizeOverrideAllowed(md, 4999));
+    EXPECT_TRUE(isMapSizeOverrideAllowed(md, 5000));
+    EXPECT_TRUE(isMapSizeOverrideAllowed(md, 10000));
+    EXPECT_FALSE(isMapSizeOverrideAllowed(md, 10001));
+}
+
+TEST(MapSizeOverridesTest, BoundsNoOverflow) {
+    const auto md = makeMapDef(0x80000000U, 0, 4);
+    EXPECT_TRUE(isMapSizeOverrideAllowed(md, 0xFFFFFFFFU));
+    const auto bad = makeMapDef(1024, 40, 40);
+    EXPECT_FALSE(isMapSizeOverrideAllowed(bad, 1024));
+}
+
+}  // namespace bpf
+}  // namespace android
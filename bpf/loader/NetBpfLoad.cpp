@@ -25,6 +25,7 @@
 #include <fstream>
 #include <inttypes.h>
 #include <iostream>
+#include <linux/magic.h>
 #include <linux/unistd.h>
 #include <log/log.h>
 #include <net/if.h>
@@ -37,10 +38,12 @@
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
 #include <sys/wait.h>
 #include <sysexits.h>
+#include <time.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
@@ -56,6 +59,7 @@
 #include <android/api-level.h>
 
 #include "BpfSyscallWrappers.h"
+#include "MapSizeOverrides.h"
 #include "bpf/BpfUtils.h"
 #include "bpf_map_def.h"
 
@@ -64,6 +68,7 @@ using android::base::GetIntProperty;
 using android::base::GetProperty;
 using android::base::InitLogging;
 using android::base::KernelLogger;
+using android::base::ReadFileToString;
 using android::base::SetProperty;
 using android::base::Split;
 using android::base::StartsWith;
@@ -143,6 +148,36 @@ inline bool isUserdebug() {
 
 static unsigned int page_size = static_cast<unsigned int>(getpagesize());
 
+// Root of the bpffs everything gets pinned under, only ever changed by --dry-run.
+static string bpfFsPath = BPF_FS_PATH;
+
+// Set by --dry-run: load against a private bpffs, without selinux context handling.
+static bool dryRun = false;
+
+// Device specific max_entries overrides, keyed by map pin name, see MapSizeOverrides.h
+static MapSizeOverrides mapSizeOverrides;
+
+// Per-phase wall clock timings, only collected in dry-run mode.
+struct ProgTiming {
+    string name;
+    int64_t loadNs = 0;  // BPF_PROG_LOAD, ie. verification (and jit)
+    int64_t pinNs = 0;   // pin + chmod + chown
+};
+
+struct ObjTiming {
+    string path;
+    int ret = 0;
+    int64_t parseNs = 0;  // ELF section parsing and map relocation
+    int64_t mapsNs = 0;   // map creation and pinning
+    vector<ProgTiming> progs;
+};
+
+static int64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 constexpr const char* lookupSelinuxContext(const domain d) {
     switch (d) {
         case domain::unspecified:   return "";
@@ -588,7 +623,8 @@ static int getSymNameByIdx(ifstream& elfFile, int index, string& name) {
 }
 
 static bool mapMatchesExpectations(const unique_fd& fd, const string& mapName,
-                                   const struct bpf_map_def& mapDef, const enum bpf_map_type type) {
+                                   const struct bpf_map_def& mapDef, const enum bpf_map_type type,
+                                   const unsigned int desired_max_entries) {
     // bpfGetFd... family of functions require at minimum a 4.14 kernel,
     // so on 4.9-T kernels just pretend the map matches our expectations.
     // Additionally we'll get almost equivalent test coverage on newer devices/kernels.
@@ -616,14 +652,6 @@ static bool mapMatchesExpectations(const unique_fd& fd, const string& mapName,
     if (type == BPF_MAP_TYPE_LPM_TRIE)
         desired_map_flags |= BPF_F_NO_PREALLOC;
 
-    // The .h file enforces that this is a power of two, and page size will
-    // also always be a power of two, so this logic is actually enough to
-    // force it to be a multiple of the page size, as required by the kernel.
-    unsigned int desired_max_entries = mapDef.max_entries;
-    if (type == BPF_MAP_TYPE_RINGBUF) {
-        if (desired_max_entries < page_size) desired_max_entries = page_size;
-    }
-
     // The following checks should *never* trigger, if one of them somehow does,
     // it probably means a bpf .o file has been changed/replaced at runtime
     // and bpfloader was manually rerun (normally it should only run *once*
@@ -642,7 +670,7 @@ static bool mapMatchesExpectations(const unique_fd& fd, const string& mapName,
     ALOGE("bpf map name %s mismatch: desired/found: "
           "type:%d/%d key:%u/%d value:%u/%d entries:%u/%d flags:%u/%d",
           mapName.c_str(), type, fd_type, mapDef.key_size, fd_key_size, mapDef.value_size,
-          fd_value_size, mapDef.max_entries, fd_max_entries, desired_map_flags, fd_map_flags);
+          fd_value_size, desired_max_entries, fd_max_entries, desired_map_flags, fd_map_flags);
     return false;
 }
 
@@ -749,6 +777,17 @@ static int createMaps(const char* elfPath, ifstream& elfFile, vector<unique_fd>&
             // programs as being 5.4+...
             type = BPF_MAP_TYPE_HASH;
         }
+        if (type == BPF_MAP_TYPE_LRU_PERCPU_HASH && !isAtLeastKernelVersion(4, 10, 0)) {
+            // LRU maps were added in 4.10, PERCPU_HASH has the same userspace visible api,
+            // it just doesn't evict old entries once full.  Programs actually updating such
+            // maps need to be 4.14+ anyway, so this just keeps userspace simpler on 4.9.
+            type = BPF_MAP_TYPE_PERCPU_HASH;
+        }
+        if (type == BPF_MAP_TYPE_LRU_HASH && !isAtLeastKernelVersion(4, 10, 0)) {
+            // Likewise for the non percpu flavour.  Once full, updates of new keys into the
+            // fallback fail instead of evicting, which is fine for the caches using it.
+            type = BPF_MAP_TYPE_HASH;
+        }
 
         // The .h file enforces that this is a power of two, and page size will
         // also always be a power of two, so this logic is actually enough to
@@ -758,7 +797,26 @@ static int createMaps(const char* elfPath, ifstream& elfFile, vector<unique_fd>&
             if (max_entries < page_size) max_entries = page_size;
         }
 
+        // Map pin name, ie. map_<objName>_<mapName>, also used as the map size override key.
+        const string mapPinName = "map_" + (md[i].shared ? "" : objName) + "_" + mapNames[i];
+
+        const auto sizeOverride = mapSizeOverrides.find(mapPinName);
+        if (sizeOverride != mapSizeOverrides.end()) {
+            if (type != BPF_MAP_TYPE_RINGBUF &&
+                isMapSizeOverrideAllowed(md[i], sizeOverride->second)) {
+                ALOGI("map %s max_entries overridden %u -> %u", mapPinName.c_str(), max_entries,
+                      sizeOverride->second);
+                max_entries = sizeOverride->second;
+            } else {
+                ALOGE("ignoring max_entries override %u for map %s "
+                      "(compiled %u, shrink %u grow %u)",
+                      sizeOverride->second, mapPinName.c_str(), md[i].max_entries,
+                      md[i].max_entries_shrink_log2, md[i].max_entries_grow_log2);
+            }
+        }
+
         domain selinux_context = getDomainFromSelinuxContext(md[i].selinux_context);
+        if (dryRun) selinux_context = domain::unspecified;
         if (specified(selinux_context)) {
             ALOGV("map %s selinux_context [%-32s] -> %d -> '%s' (%s)", mapNames[i].c_str(),
                   md[i].selinux_context, static_cast<int>(selinux_context),
@@ -774,8 +832,7 @@ static int createMaps(const char* elfPath, ifstream& elfFile, vector<unique_fd>&
         // Format of pin location is /sys/fs/bpf/<pin_subdir|prefix>map_<objName>_<mapName>
         // except that maps shared across .o's have empty <objName>
         // Note: <objName> refers to the extension-less basename of the .o file (without @ suffix).
-        string mapPinLoc = string(BPF_FS_PATH) + lookupPinSubdir(pin_subdir, prefix) + "map_" +
-                           (md[i].shared ? "" : objName) + "_" + mapNames[i];
+        string mapPinLoc = bpfFsPath + lookupPinSubdir(pin_subdir, prefix) + mapPinName;
         bool reuse = false;
         unique_fd fd;
         int saved_errno;
@@ -809,11 +866,11 @@ static int createMaps(const char* elfPath, ifstream& elfFile, vector<unique_fd>&
         // When reusing a pinned map, we need to check the map type/sizes/etc match, but for
         // safety (since reuse code path is rare) run these checks even if we just created it.
         // We assume failure is due to pinned map mismatch, hence the 'NOT UNIQUE' return code.
-        if (!mapMatchesExpectations(fd, mapNames[i], md[i], type)) return -ENOTUNIQ;
+        if (!mapMatchesExpectations(fd, mapNames[i], md[i], type, max_entries)) return -ENOTUNIQ;
 
         if (!reuse) {
             if (specified(selinux_context)) {
-                string createLoc = string(BPF_FS_PATH) + lookupPinSubdir(selinux_context) +
+                string createLoc = bpfFsPath + lookupPinSubdir(selinux_context) +
                                    "tmp_map_" + objName + "_" + mapNames[i];
                 ret = bpfFdPin(fd, createLoc.c_str());
                 if (ret) {
@@ -921,7 +978,8 @@ static void applyMapRelo(ifstream& elfFile, vector<unique_fd> &mapFds, vector<co
 }
 
 static int loadCodeSections(const char* elfPath, vector<codeSection>& cs, const string& license,
-                            const char* prefix, const unsigned int bpfloader_ver) {
+                            const char* prefix, const unsigned int bpfloader_ver,
+                            vector<ProgTiming>* timings) {
     unsigned kvers = kernelVersion();
 
     if (!kvers) {
@@ -951,6 +1009,7 @@ static int loadCodeSections(const char* elfPath, vector<codeSection>& cs, const
         unsigned bpfMinVer = cs[i].prog_def->bpfloader_min_ver;
         unsigned bpfMaxVer = cs[i].prog_def->bpfloader_max_ver;
         domain selinux_context = getDomainFromSelinuxContext(cs[i].prog_def->selinux_context);
+        if (dryRun) selinux_context = domain::unspecified;
         domain pin_subdir = getDomainFromPinSubdir(cs[i].prog_def->pin_subdir);
 
         ALOGD("cs[%d].name:%s requires bpfloader version [0x%05x,0x%05x)", i, name.c_str(),
@@ -993,9 +1052,11 @@ static int loadCodeSections(const char* elfPath, vector<codeSection>& cs, const
         name = name.substr(0, name.find_last_of('$'));
 
         bool reuse = false;
+        ProgTiming timing = {.name = name};
+        int64_t start = nowNs();
         // Format of pin location is
         // /sys/fs/bpf/<prefix>prog_<objName>_<progName>
-        string progPinLoc = string(BPF_FS_PATH) + lookupPinSubdir(pin_subdir, prefix) + "prog_" +
+        string progPinLoc = bpfFsPath + lookupPinSubdir(pin_subdir, prefix) + "prog_" +
                             objName + '_' + string(name);
         if (access(progPinLoc.c_str(), F_OK) == 0) {
             fd.reset(retrieveProgram(progPinLoc.c_str()));
@@ -1054,9 +1115,12 @@ static int loadCodeSections(const char* elfPath, vector<codeSection>& cs, const
 
         if (!fd.ok()) return fd.get();
 
+        timing.loadNs = nowNs() - start;
+        start = nowNs();
+
         if (!reuse) {
             if (specified(selinux_context)) {
-                string createLoc = string(BPF_FS_PATH) + lookupPinSubdir(selinux_context) +
+                string createLoc = bpfFsPath + lookupPinSubdir(selinux_context) +
                                    "tmp_prog_" + objName + '_' + string(name);
                 ret = bpfFdPin(fd, createLoc.c_str());
                 if (ret) {
@@ -1094,6 +1158,9 @@ static int loadCodeSections(const char* elfPath, vector<codeSection>& cs, const
             }
         }
 
+        timing.pinNs = nowNs() - start;
+        if (timings) timings->push_back(timing);
+
         int progId = bpfGetFdProgId(fd);
         if (progId == -1) {
             ALOGE("bpfGetFdProgId failed, ret: %d [%d]", progId, errno);
@@ -1106,11 +1173,12 @@ static int loadCodeSections(const char* elfPath, vector<codeSection>& cs, const
 }
 
 int loadProg(const char* const elfPath, const unsigned int bpfloader_ver,
-             const char* const prefix) {
+             const char* const prefix, ObjTiming* timing = nullptr) {
     vector<char> license;
     vector<codeSection> cs;
     vector<unique_fd> mapFds;
     int ret;
+    int64_t start = nowNs();
 
     ifstream elfFile(elfPath, ios::in | ios::binary);
     if (!elfFile.is_open()) return -1;
@@ -1144,7 +1212,10 @@ int loadProg(const char* const elfPath, const unsigned int bpfloader_ver,
     ALOGD("BpfLoader version 0x%05x processing ELF object %s with ver [0x%05x,0x%05x)",
           bpfloader_ver, elfPath, bpfLoaderMinVer, bpfLoaderMaxVer);
 
+    if (timing) timing->parseNs += nowNs() - start;
+    start = nowNs();
     ret = createMaps(elfPath, elfFile, mapFds, prefix, bpfloader_ver);
+    if (timing) timing->mapsNs = nowNs() - start;
     if (ret) {
         ALOGE("Failed to create maps: (ret=%d) in %s", ret, elfPath);
         return ret;
@@ -1153,6 +1224,7 @@ int loadProg(const char* const elfPath, const unsigned int bpfloader_ver,
     for (int i = 0; i < (int)mapFds.size(); i++)
         ALOGV("map_fd found at %d is %d in %s", i, mapFds[i].get(), elfPath);
 
+    start = nowNs();
     ret = readCodeSections(elfFile, cs);
     if (ret == -ENOENT) return 0;  // no programs defined in this .o
     if (ret) {
@@ -1161,8 +1233,10 @@ int loadProg(const char* const elfPath, const unsigned int bpfloader_ver,
     }
 
     applyMapRelo(elfFile, mapFds, cs);
+    if (timing) timing->parseNs += nowNs() - start;
 
-    ret = loadCodeSections(elfPath, cs, string(license.data()), prefix, bpfloader_ver);
+    ret = loadCodeSections(elfPath, cs, string(license.data()), prefix, bpfloader_ver,
+                           timing ? &timing->progs : nullptr);
     if (ret) ALOGE("Failed to load programs, loadCodeSections ret=%d", ret);
 
     return ret;
@@ -1209,7 +1283,8 @@ const Location locations[] = {
         },
 };
 
-static int loadAllElfObjects(const unsigned int bpfloader_ver, const Location& location) {
+static int loadAllElfObjects(const unsigned int bpfloader_ver, const Location& location,
+                             vector<ObjTiming>* timings = nullptr) {
     int retVal = 0;
     DIR* dir;
     struct dirent* ent;
@@ -1222,7 +1297,11 @@ static int loadAllElfObjects(const unsigned int bpfloader_ver, const Location& l
             string progPath(location.dir);
             progPath += s;
 
-            int ret = loadProg(progPath.c_str(), bpfloader_ver, location.prefix);
+            ObjTiming timing = {.path = progPath};
+            int ret = loadProg(progPath.c_str(), bpfloader_ver, location.prefix,
+                               timings ? &timing : nullptr);
+            timing.ret = ret;
+            if (timings) timings->push_back(std::move(timing));
             if (ret) {
                 retVal = ret;
                 ALOGE("Failed to load object: %s, ret: %s", progPath.c_str(), std::strerror(-ret));
@@ -1235,11 +1314,26 @@ static int loadAllElfObjects(const unsigned int bpfloader_ver, const Location& l
     return retVal;
 }
 
+// Missing or malformed overrides are not fatal, we simply fall back to the compiled in sizes.
+static void loadMapSizeOverrides() {
+    string content;
+    if (!ReadFileToString(kMapSizeOverridesPath, &content)) {
+        if (errno != ENOENT) ALOGE("failed to read %s: %s", kMapSizeOverridesPath, strerror(errno));
+        return;
+    }
+    string error;
+    if (!parseMapSizeOverrides(content, &mapSizeOverrides, &error)) {
+        ALOGE("ignoring %s: %s", kMapSizeOverridesPath, error.c_str());
+        return;
+    }
+    ALOGI("loaded %zu map size overrides from %s", mapSizeOverrides.size(), kMapSizeOverridesPath);
+}
+
 static int createSysFsBpfSubDir(const char* const prefix) {
     if (*prefix) {
         mode_t prevUmask = umask(0);
 
-        string s = "/sys/fs/bpf/";
+        string s = bpfFsPath;
         s += prefix;
 
         errno = 0;
@@ -1375,9 +1469,7 @@ static bool isWear() {
     return wear;
 }
 
-static int doLoad(char** argv, char * const envp[]) {
-    const bool runningAsRoot = !getuid();  // true iff U QPR3 or V+
-
+static int effectiveApiLevel() {
     // Any released device will have codename REL instead of a 'real' codename.
     // For safety: default to 'REL' so we default to unreleased=false on failure.
     const bool unreleased = (GetProperty("ro.build.version.codename", "REL") != "REL");
@@ -1405,12 +1497,33 @@ static int doLoad(char** argv, char * const envp[]) {
     //
     // That code has a hack to bump <35 to 35 (to force aosp/main to parse .35rc),
     // but could (should?) perhaps be adjusted to match this.
-    const int effective_api_level = android_get_device_api_level() + (int)unreleased;
+    return android_get_device_api_level() + (int)unreleased;
+}
+
+// Version of Network BpfLoader, which depends on the Android OS version.
+static unsigned int bpfloaderVersion(const int effective_api_level, const bool runningAsRoot) {
     const bool isAtLeastT = (effective_api_level >= __ANDROID_API_T__);
     const bool isAtLeastU = (effective_api_level >= __ANDROID_API_U__);
     const bool isAtLeastV = (effective_api_level >= __ANDROID_API_V__);
     const bool isAtLeastW = (effective_api_level >  __ANDROID_API_V__);  // TODO: switch to W
 
+    unsigned int bpfloader_ver = 42u;    // [42] BPFLOADER_MAINLINE_VERSION
+    if (isAtLeastT) ++bpfloader_ver;     // [43] BPFLOADER_MAINLINE_T_VERSION
+    if (isAtLeastU) ++bpfloader_ver;     // [44] BPFLOADER_MAINLINE_U_VERSION
+    if (runningAsRoot) ++bpfloader_ver;  // [45] BPFLOADER_MAINLINE_U_QPR3_VERSION
+    if (isAtLeastV) ++bpfloader_ver;     // [46] BPFLOADER_MAINLINE_V_VERSION
+    if (isAtLeastW) ++bpfloader_ver;     // [47] BPFLOADER_MAINLINE_W_VERSION
+    return bpfloader_ver;
+}
+
+static int doLoad(char** argv, char * const envp[]) {
+    const bool runningAsRoot = !getuid();  // true iff U QPR3 or V+
+
+    const int effective_api_level = effectiveApiLevel();
+    const bool isAtLeastT = (effective_api_level >= __ANDROID_API_T__);
+    const bool isAtLeastU = (effective_api_level >= __ANDROID_API_U__);
+    const bool isAtLeastV = (effective_api_level >= __ANDROID_API_V__);
+
     const int first_api_level = GetIntProperty("ro.board.first_api_level", effective_api_level);
 
     // last in U QPR2 beta1
@@ -1419,12 +1532,7 @@ static int doLoad(char** argv, char * const envp[]) {
     const bool has_platform_netbpfload_rc = exists("/system/etc/init/netbpfload.rc");
 
     // Version of Network BpfLoader depends on the Android OS version
-    unsigned int bpfloader_ver = 42u;    // [42] BPFLOADER_MAINLINE_VERSION
-    if (isAtLeastT) ++bpfloader_ver;     // [43] BPFLOADER_MAINLINE_T_VERSION
-    if (isAtLeastU) ++bpfloader_ver;     // [44] BPFLOADER_MAINLINE_U_VERSION
-    if (runningAsRoot) ++bpfloader_ver;  // [45] BPFLOADER_MAINLINE_U_QPR3_VERSION
-    if (isAtLeastV) ++bpfloader_ver;     // [46] BPFLOADER_MAINLINE_V_VERSION
-    if (isAtLeastW) ++bpfloader_ver;     // [47] BPFLOADER_MAINLINE_W_VERSION
+    const unsigned int bpfloader_ver = bpfloaderVersion(effective_api_level, runningAsRoot);
 
     ALOGI("NetBpfLoad v0.%u (%s) api:%d/%d kver:%07x (%s) uid:%d rc:%d%d",
           bpfloader_ver, argv[0], android_get_device_api_level(), effective_api_level,
@@ -1616,6 +1724,8 @@ static int doLoad(char** argv, char * const envp[]) {
     // Thus we need to manually create the /sys/fs/bpf/loader subdirectory.
     if (createSysFsBpfSubDir("loader")) return 1;
 
+    loadMapSizeOverrides();
+
     // Load all ELF objects, create programs and maps, and pin them
     for (const auto& location : locations) {
         if (loadAllElfObjects(bpfloader_ver, location) != 0) {
@@ -1659,6 +1769,62 @@ static int doLoad(char** argv, char * const envp[]) {
     return 1;
 }
 
+// Loads every .o found under objDir (laid out like the apex's etc/bpf directory)
+// into a private bpffs mounted at bpffs, and prints a per-object and per-program
+// timing report to stdout.  Skips selinux context handling and does not touch
+// /sys/fs/bpf, so it can be run as root on an already booted device (ie. adb shell)
+// as a loader regression benchmark.  It is still a device binary: objects are
+// filtered by the same device properties (eg. ignore_on_userdebug) as a real load,
+// and the same map size overrides are applied.
+static int doDryRun(const char* const objDir, const char* const bpffs,
+                    const unsigned int bpfloader_ver) {
+    struct statfs sfs;
+    if (statfs(bpffs, &sfs)) {
+        ALOGE("statfs(%s): %d[%s]", bpffs, errno, strerror(errno));
+        return 1;
+    }
+    if (sfs.f_type != BPF_FS_MAGIC) {
+        ALOGE("%s is not a bpffs mount point (f_type 0x%lx)", bpffs, (long)sfs.f_type);
+        return 1;
+    }
+
+    dryRun = true;
+    bpfFsPath = string(bpffs) + "/";
+
+    ALOGI("NetBpfLoad v0.%u dry run: %s -> %s kver:%07x (%s)", bpfloader_ver, objDir,
+          bpfFsPath.c_str(), kernelVersion(), describeArch());
+
+    for (const auto& location : locations) {
+        if (createSysFsBpfSubDir(location.prefix)) return 1;
+    }
+    if (createSysFsBpfSubDir("loader")) return 1;
+
+    // Size the maps exactly like a real load of the same objects would.
+    loadMapSizeOverrides();
+
+    vector<ObjTiming> timings;
+    int retVal = 0;
+    const int64_t start = nowNs();
+    for (const auto& location : locations) {
+        // Re-root the apex relative object directory onto objDir.
+        const string dir = string(objDir) + "/" + (location.dir + strlen(BPFROOT "/"));
+        const Location dryRunLocation = {.dir = dir.c_str(), .prefix = location.prefix};
+        if (loadAllElfObjects(bpfloader_ver, dryRunLocation, &timings)) retVal = 2;
+    }
+    const int64_t totalNs = nowNs() - start;
+
+    for (const auto& obj : timings) {
+        printf("%s: ret=%d parse=%" PRId64 "us maps=%" PRId64 "us\n", obj.path.c_str(), obj.ret,
+               obj.parseNs / 1000, obj.mapsNs / 1000);
+        for (const auto& prog : obj.progs) {
+            printf("    %s: load=%" PRId64 "us pin=%" PRId64 "us\n", prog.name.c_str(),
+                   prog.loadNs / 1000, prog.pinNs / 1000);
+        }
+    }
+    printf("total: %zu objects in %" PRId64 "us\n", timings.size(), totalNs / 1000);
+    return retVal;
+}
+
 }  // namespace bpf
 }  // namespace android
 
@@ -1675,5 +1841,14 @@ int main(int argc, char** argv, char * const envp[]) {
         return 0;
     }
 
+    // netbpfload --dry-run <object dir> <bpffs mount point> [<bpfloader version>]
+    if ((argc == 4 || argc == 5) && !strcmp(argv[1], "--dry-run")) {
+        // Default to the loader version a real load on this device would use.
+        unsigned int bpfloader_ver = android::bpf::bpfloaderVersion(
+                android::bpf::effectiveApiLevel(), !getuid());
+        if (argc == 5) bpfloader_ver = static_cast<unsigned int>(strtoul(argv[4], NULL, 0));
+        return android::bpf::doDryRun(argv[2], argv[3], bpfloader_ver);
+    }
+
     return android::bpf::doLoad(argv, envp);
 }
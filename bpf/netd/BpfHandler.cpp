@@ -20,6 +20,7 @@
 
 #include <linux/bpf.h>
 #include <inttypes.h>
+#include <algorithm>
 
 #include <android-base/unique_fd.h>
 #include <android-modules-utils/sdk_level.h>
@@ -50,6 +51,12 @@ constexpr int TOTAL_UID_STATS_ENTRIES_LIMIT = STATS_MAP_SIZE * 0.9;
 static_assert(STATS_MAP_SIZE - TOTAL_UID_STATS_ENTRIES_LIMIT > 100,
               "The limit for stats map is to high, stats data may be lost due to overflow");
 
+// The stats maps may have been resized by the bpfloader, so the limit actually enforced
+// is derived from the live map size, with the same 90% ratio as the default above.
+static uint32_t totalUidStatsEntriesLimit(uint32_t statsMapSize) {
+    return statsMapSize / 10 * 9;
+}
+
 static Status attachProgramToCgroup(const char* programPath, const unique_fd& cgroupFd,
                                     bpf_attach_type type) {
     unique_fd cgroupProg(retrieveProgram(programPath));
@@ -263,6 +270,18 @@ Status BpfHandler::initMaps() {
 
     RETURN_IF_NOT_OK(mStatsMapA.init(STATS_MAP_A_PATH));
     RETURN_IF_NOT_OK(mStatsMapB.init(STATS_MAP_B_PATH));
+    // Both stats maps are declared identically, so they should always be the same size.
+    auto sizeA = mStatsMapA.getMaxEntries();
+    auto sizeB = mStatsMapB.getMaxEntries();
+    if (sizeA.ok() && sizeB.ok()) {
+        mTotalUidStatsEntriesLimit = totalUidStatsEntriesLimit(std::min(*sizeA, *sizeB));
+        ALOGI("stats map size %u, total uid stats entries limit %u", std::min(*sizeA, *sizeB),
+              mTotalUidStatsEntriesLimit);
+    } else {
+        // Only expected on pre-4.14 kernels, which cannot be resized anyway.
+        ALOGW("Unable to query stats map size, using default limit %u",
+              mTotalUidStatsEntriesLimit);
+    }
     RETURN_IF_NOT_OK(mConfigurationMap.init(CONFIGURATION_MAP_PATH));
     RETURN_IF_NOT_OK(mUidPermissionMap.init(UID_PERMISSION_MAP_PATH));
     // initialized last so mCookieTagMap.isValid() implies everything else is valid too
@@ -272,21 +291,68 @@ Status BpfHandler::initMaps() {
     return netdutils::status::ok;
 }
 
-bool BpfHandler::hasUpdateDeviceStatsPermission(uid_t uid) {
+base::Result<BpfHandler::Configuration> BpfHandler::readConfiguration() const {
+    // Batched lookups exist since 5.6, ie. on 5.10+ Android kernels, and fetch both
+    // entries with one syscall.
+    if (bpf::isAtLeastKernelVersion(5, 10, 0)) {
+        auto values = mConfigurationMap.readFirstValues<CONFIGURATION_MAP_SIZE>();
+        if (!values.ok()) return values.error();
+        return Configuration{
+                .currentStatsMap = (*values)[CURRENT_STATS_MAP_CONFIGURATION_KEY],
+                .uidPermissionGeneration = (*values)[UID_PERMISSION_GENERATION_KEY],
+        };
+    }
+    auto currentStatsMap = mConfigurationMap.readValue(CURRENT_STATS_MAP_CONFIGURATION_KEY);
+    if (!currentStatsMap.ok()) return currentStatsMap.error();
+    // Older kernels would need a second syscall to read the generation, which is no
+    // cheaper than the permission lookup itself, so just don't cache there.
+    return Configuration{.currentStatsMap = *currentStatsMap};
+}
+
+bool BpfHandler::hasUpdateDeviceStatsPermission(uid_t uid, std::optional<uint32_t> generation) {
     // This implementation is the same logic as method ActivityManager#checkComponentPermission.
     // It implies that the real uid can never be the same as PER_USER_RANGE.
     uint32_t appId = uid % PER_USER_RANGE;
+    if ((appId == AID_ROOT) || (appId == AID_SYSTEM) || (appId == AID_DNS)) return true;
+
+    if (generation) {
+        std::lock_guard guard(mPermissionCacheMutex);
+        if (*generation != mPermissionCacheGeneration) {
+            mPermissionCache.clear();
+            mPermissionCacheGeneration = *generation;
+        }
+        const auto it = mPermissionCache.find(appId);
+        if (it != mPermissionCache.end()) return it->second;
+    }
+
     auto permission = mUidPermissionMap.readValue(appId);
-    if (permission.ok() && (permission.value() & BPF_PERMISSION_UPDATE_DEVICE_STATS)) {
-        return true;
+    const bool granted =
+            permission.ok() && (permission.value() & BPF_PERMISSION_UPDATE_DEVICE_STATS);
+
+    // Only cache definite answers, a missing entry means no special permissions.
+    // uid_permission_map is written before the generation is bumped, so the entry just read
+    // is at least as new as 'generation', and will be dropped on the next bump.
+    if (generation && (permission.ok() || permission.error().code() == ENOENT)) {
+        std::lock_guard guard(mPermissionCacheMutex);
+        if (*generation == mPermissionCacheGeneration) mPermissionCache[appId] = granted;
     }
-    return ((appId == AID_ROOT) || (appId == AID_SYSTEM) || (appId == AID_DNS));
+    return granted;
 }
 
 int BpfHandler::tagSocket(int sockFd, uint32_t tag, uid_t chargeUid, uid_t realUid) {
     if (!mCookieTagMap.isValid()) return -EPERM;
 
-    if (chargeUid != realUid && !hasUpdateDeviceStatsPermission(realUid)) return -EPERM;
+    auto configuration = readConfiguration();
+    if (!configuration.ok()) {
+        ALOGE("Failed to get current configuration: %s",
+              strerror(configuration.error().code()));
+        return -configuration.error().code();
+    }
+
+    if (chargeUid != realUid &&
+        !hasUpdateDeviceStatsPermission(realUid, configuration->uidPermissionGeneration)) {
+        return -EPERM;
+    }
 
     // Note that tagging the socket to AID_CLAT is only implemented in JNI ClatCoordinator.
     // The process is not allowed to tag socket to AID_CLAT via tagSocket() which would cause
@@ -347,19 +413,14 @@ int BpfHandler::tagSocket(int sockFd, uint32_t tag, uid_t chargeUid, uid_t realU
         totalEntryCount++;
         return base::Result<void>();
     };
-    auto configuration = mConfigurationMap.readValue(CURRENT_STATS_MAP_CONFIGURATION_KEY);
-    if (!configuration.ok()) {
-        ALOGE("Failed to get current configuration: %s",
-              strerror(configuration.error().code()));
-        return -configuration.error().code();
-    }
-    if (configuration.value() != SELECT_MAP_A && configuration.value() != SELECT_MAP_B) {
-        ALOGE("unknown configuration value: %d", configuration.value());
+    const uint32_t currentStatsMap = configuration->currentStatsMap;
+    if (currentStatsMap != SELECT_MAP_A && currentStatsMap != SELECT_MAP_B) {
+        ALOGE("unknown configuration value: %d", currentStatsMap);
         return -EINVAL;
     }
 
     BpfMapRO<StatsKey, StatsValue>& currentMap =
-            (configuration.value() == SELECT_MAP_A) ? mStatsMapA : mStatsMapB;
+            (currentStatsMap == SELECT_MAP_A) ? mStatsMapA : mStatsMapB;
     base::Result<void> res = currentMap.iterate(countUidStatsEntries);
     if (!res.ok()) {
         ALOGE("Failed to count the stats entry in map: %s",
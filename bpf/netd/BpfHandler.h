@@ -16,6 +16,11 @@
 
 #pragma once
 
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include <android-base/thread_annotations.h>
 #include <netdutils/Status.h>
 #include "bpf/BpfMap.h"
 #include "netd.h"
@@ -56,7 +61,17 @@ class BpfHandler {
     BpfHandler(uint32_t perUidLimit, uint32_t totalLimit);
 
     netdutils::Status initMaps();
-    bool hasUpdateDeviceStatsPermission(uid_t uid);
+
+    struct Configuration {
+        uint32_t currentStatsMap;
+        // Unset if unavailable, in which case permissions are not cached.
+        std::optional<uint32_t> uidPermissionGeneration;
+    };
+    base::Result<Configuration> readConfiguration() const;
+
+    // Permission lookups are answered from mPermissionCache for as long as the
+    // configuration map's UID_PERMISSION_GENERATION_KEY doesn't change.
+    bool hasUpdateDeviceStatsPermission(uid_t uid, std::optional<uint32_t> generation);
 
     BpfMap<uint64_t, UidTagValue> mCookieTagMap;
     BpfMapRO<StatsKey, StatsValue> mStatsMapA;
@@ -69,8 +84,14 @@ class BpfHandler {
     const uint32_t mPerUidStatsEntriesLimit;
 
     // The limit on the total number of stats entries in the per uid stats map. BpfHandler will
-    // block all tagging requests after the limit is reached.
-    const uint32_t mTotalUidStatsEntriesLimit;
+    // block all tagging requests after the limit is reached. Recomputed by initMaps() from the
+    // live stats map size.
+    uint32_t mTotalUidStatsEntriesLimit;
+
+    std::mutex mPermissionCacheMutex;
+    uint32_t mPermissionCacheGeneration GUARDED_BY(mPermissionCacheMutex) = 0;
+    // appId -> whether it holds BPF_PERMISSION_UPDATE_DEVICE_STATS
+    std::unordered_map<uint32_t, bool> mPermissionCache GUARDED_BY(mPermissionCacheMutex);
 
     // For testing
     friend class BpfHandlerTest;
@@ -99,6 +99,11 @@ class BpfHandlerTest : public ::testing::Test {
 
     void expectNoTag(uint64_t cookie) { EXPECT_FALSE(mFakeCookieTagMap.readValue(cookie).ok()); }
 
+    size_t permissionCacheSize() {
+        std::lock_guard guard(mBh.mPermissionCacheMutex);
+        return mBh.mPermissionCache.size();
+    }
+
     void populateFakeStats(uint64_t cookie, uint32_t uid, uint32_t tag, StatsKey* key) {
         UidTagValue cookieMapkey = {.uid = (uint32_t)uid, .tag = tag};
         EXPECT_RESULT_OK(mFakeCookieTagMap.writeValue(cookie, cookieMapkey, BPF_ANY));
@@ -223,6 +228,59 @@ TEST_F(BpfHandlerTest, TestTagSocketWithPermission) {
     expectMapEmpty(mFakeCookieTagMap);
 }
 
+TEST_F(BpfHandlerTest, TestTagSocketPermissionRevoked) {
+    const uid_t realUid = TEST_UID2;
+    ASSERT_RESULT_OK(mFakeUidPermissionMap.writeValue(realUid,
+                     BPF_PERMISSION_UPDATE_DEVICE_STATS, BPF_ANY));
+    int sock = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_NE(-1, sock);
+    EXPECT_EQ(0, mBh.tagSocket(sock, TEST_TAG, TEST_UID, realUid));
+
+    // Revoke the permission the way BpfNetMaps#setNetPermForUids() does: update the map,
+    // then bump the generation.  The very next tag request must be refused.
+    ASSERT_RESULT_OK(mFakeUidPermissionMap.deleteValue(realUid));
+    ASSERT_RESULT_OK(mFakeConfigurationMap.writeValue(UID_PERMISSION_GENERATION_KEY, 1, BPF_ANY));
+    EXPECT_EQ(-EPERM, mBh.tagSocket(sock, TEST_TAG, TEST_UID, realUid));
+
+    // And granting it again is picked up just as quickly.
+    ASSERT_RESULT_OK(mFakeUidPermissionMap.writeValue(realUid,
+                     BPF_PERMISSION_UPDATE_DEVICE_STATS, BPF_ANY));
+    ASSERT_RESULT_OK(mFakeConfigurationMap.writeValue(UID_PERMISSION_GENERATION_KEY, 2, BPF_ANY));
+    EXPECT_EQ(0, mBh.tagSocket(sock, TEST_TAG, TEST_UID, realUid));
+    close(sock);
+}
+
+TEST_F(BpfHandlerTest, TestTagSocketOnBehalfPermissionCached) {
+    // Only 5.10+ kernels read the generation (with a batched lookup), older ones look the
+    // permission up on every tag request.
+    const bool cached = isAtLeastKernelVersion(5, 10, 0);
+    const uid_t realUid = TEST_UID2;
+    ASSERT_RESULT_OK(mFakeUidPermissionMap.writeValue(realUid,
+                     BPF_PERMISSION_UPDATE_DEVICE_STATS, BPF_ANY));
+    int sock = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT_NE(-1, sock);
+    EXPECT_EQ(0, mBh.tagSocket(sock, TEST_TAG, TEST_UID, realUid));
+    EXPECT_EQ(cached ? 1U : 0U, permissionCacheSize());
+
+    // Without a generation bump repeat requests are answered from the cache, without looking
+    // at the map, so changing the map behind BpfHandler's back goes unnoticed.
+    ASSERT_RESULT_OK(mFakeUidPermissionMap.deleteValue(realUid));
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(cached ? 0 : -EPERM, mBh.tagSocket(sock, TEST_TAG, TEST_UID, realUid));
+    }
+    EXPECT_EQ(cached ? 1U : 0U, permissionCacheSize());
+
+    // A generation bump drops the cache, so the map is looked up again.  Denials are cached
+    // just the same.
+    ASSERT_RESULT_OK(mFakeConfigurationMap.writeValue(UID_PERMISSION_GENERATION_KEY, 1, BPF_ANY));
+    EXPECT_EQ(-EPERM, mBh.tagSocket(sock, TEST_TAG, TEST_UID, realUid));
+    EXPECT_EQ(cached ? 1U : 0U, permissionCacheSize());
+    ASSERT_RESULT_OK(mFakeUidPermissionMap.writeValue(realUid,
+                     BPF_PERMISSION_UPDATE_DEVICE_STATS, BPF_ANY));
+    EXPECT_EQ(cached ? -EPERM : 0, mBh.tagSocket(sock, TEST_TAG, TEST_UID, realUid));
+    close(sock);
+}
+
 TEST_F(BpfHandlerTest, TestUntagInvalidSocket) {
     int invalidSocket = -1;
     ASSERT_GT(0, mBh.untagSocket(invalidSocket));
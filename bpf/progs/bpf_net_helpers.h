@@ -115,6 +115,11 @@ static int (*bpf_l4_csum_replace)(struct __sk_buff* skb, __u32 offset, __u64 fro
 static int (*bpf_redirect)(__u32 ifindex, __u64 flags) = (void*)BPF_FUNC_redirect;
 static int (*bpf_redirect_map)(const struct bpf_map_def* map, __u32 key,
                                __u64 flags) = (void*)BPF_FUNC_redirect_map;
+// 5.10+ (the nexthop 'params' argument is not present in earlier pre-release versions)
+static long (*bpf_redirect_neigh)(__u32 ifindex, struct bpf_redir_neigh* params, int plen,
+                                  __u64 flags) = (void*)BPF_FUNC_redirect_neigh;
+static long (*bpf_fib_lookup)(void* ctx, struct bpf_fib_lookup* params, int plen,
+                              __u32 flags) = (void*)BPF_FUNC_fib_lookup;
 
 static int (*bpf_skb_change_head)(struct __sk_buff* skb, __u32 head_room,
                                   __u64 flags) = (void*)BPF_FUNC_skb_change_head;
@@ -169,6 +174,12 @@ struct rawip_bool { bool rawip; };
 #define ETHER ((struct rawip_bool){ .rawip = false })
 #define RAWIP ((struct rawip_bool){ .rawip = true })
 
+// How the L2 header of a forwarded packet is obtained: either from the offload map entry,
+// or from a kernel fib & neighbour lookup at forwarding time.
+struct neigh_bool { bool neigh; };
+#define STATIC_MAC ((struct neigh_bool){ .neigh = false })
+#define FIB_NEIGH ((struct neigh_bool){ .neigh = true })
+
 struct updatetime_bool { bool updatetime; };
 #define NO_UPDATETIME ((struct updatetime_bool){ .updatetime = false })
 #define UPDATETIME ((struct updatetime_bool){ .updatetime = true })
@@ -23,6 +23,10 @@
 
 DEFINE_BPF_MAP_GRW(clat_ingress6_map, HASH, ClatIngress6Key, ClatIngress6Value, 16, AID_SYSTEM)
 
+// Maximum number of IPv6 extension headers stripped during translation, packets with more
+// are left to clatd.  Real traffic rarely carries more than one or two.
+#define CLAT_MAX_EXT_HDRS 4
+
 static inline __always_inline int nat64(struct __sk_buff* skb,
                                         const struct rawip_bool rawip,
                                         const struct kver_uint kver) {
@@ -83,29 +87,58 @@ static inline __always_inline int nat64(struct __sk_buff* skb,
     __be16 ip_id = 0;
     __be16 frag_off = htons(IP_DF);
     __u16 tot_len = ntohs(ip6->payload_len) + sizeof(struct iphdr);  // cannot overflow, see above
+    __u32 ext_len = 0;  // total size of the extension headers to strip
 
-    if (proto == IPPROTO_FRAGMENT) {
-        // Fragment handling requires bpf_skb_adjust_room which is 4.14+
-        if (!KVER_IS_AT_LEAST(kver, 4, 14, 0)) return TC_ACT_PIPE;
+    // Stripping extension headers requires bpf_skb_adjust_room which is 4.14+,
+    // on older kernels they end up in the default case of the switch below.
+    //
+    // RFC 7915 section 5.1: hop-by-hop options, destination options and routing headers
+    // with zero segments left are ignored, ie. simply dropped during translation.
+    if (KVER_IS_AT_LEAST(kver, 4, 14, 0)) {
+        // Bounded by CLAT_MAX_EXT_HDRS and unrolled, since pre-5.3 verifiers reject loops.
+#pragma unroll
+        for (unsigned i = 0; i < CLAT_MAX_EXT_HDRS; ++i) {
+            const __u32 off = l2_header_size + sizeof(*ip6) + ext_len;
+
+            if (proto == IPPROTO_FRAGMENT) {
+                struct frag_hdr frag;
+                if (bpf_skb_load_bytes(skb, off, &frag, sizeof(frag))) return TC_ACT_PIPE;
+                proto = frag.nexthdr;
+                // RFC6145: use bottom 16-bits of network endian 32-bit IPv6 ID field for 16-bit
+                // IPv4 field.  This is equivalent to: ip_id = htons(ntohl(frag.identification));
+                ip_id = frag.identification >> 16;
+                // Conversion of 16-bit IPv6 frag offset to 16-bit IPv4 frag offset field.
+                // IPv6 is '13 bits of offset in multiples of 8' + 2 zero bits + more fragment bit
+                // IPv4 is zero bit + don't frag bit + more frag bit + '13 bits of offset in
+                // multiples of 8'
+                frag_off = ntohs(frag.frag_off);
+                frag_off = ((frag_off & 1) << 13) | (frag_off >> 3);
+                frag_off = htons(frag_off);
+                ext_len += sizeof(struct frag_hdr);
+                // Any further extension headers are part of the fragmentable part of the packet
+                // (and thus are covered by the fragment offsets), so must not be stripped.
+                break;
+            }
+
+            if (proto != IPPROTO_HOPOPTS && proto != IPPROTO_DSTOPTS && proto != IPPROTO_ROUTING)
+                break;
+
+            // Next header, header extension length (in 8 octet units, not including the first
+            // 8 octets), and for routing headers: routing type & segments left.
+            __u8 hdr[4];
+            if (bpf_skb_load_bytes(skb, off, hdr, sizeof(hdr))) return TC_ACT_PIPE;
+            // Packets with segments left must be handled by clatd (RFC 7915 says: MUST NOT be
+            // translated, and an ICMPv6 Parameter Problem message should be returned).
+            if (proto == IPPROTO_ROUTING && hdr[3]) break;
+            proto = hdr[0];
+            ext_len += (hdr[1] + 1) * 8;
+        }
+    }
 
-        // Must have (ethernet and) ipv6 header and ipv6 fragment extension header
-        if (data + l2_header_size + sizeof(*ip6) + sizeof(struct frag_hdr) > data_end)
-            return TC_ACT_PIPE;
-        const struct frag_hdr *frag = (const struct frag_hdr *)(ip6 + 1);
-        proto = frag->nexthdr;
-        // RFC6145: use bottom 16-bits of network endian 32-bit IPv6 ID field for 16-bit IPv4 field.
-        // this is equivalent to: ip_id = htons(ntohl(frag->identification));
-        ip_id = frag->identification >> 16;
-        // Conversion of 16-bit IPv6 frag offset to 16-bit IPv4 frag offset field.
-        // IPv6 is '13 bits of offset in multiples of 8' + 2 zero bits + more fragment bit
-        // IPv4 is zero bit + don't frag bit + more frag bit + '13 bits of offset in multiples of 8'
-        frag_off = ntohs(frag->frag_off);
-        frag_off = ((frag_off & 1) << 13) | (frag_off >> 3);
-        frag_off = htons(frag_off);
-        // Note that by construction tot_len is guaranteed to not underflow here
-        tot_len -= sizeof(struct frag_hdr);
-        // This is a badly formed IPv6 packet with less payload than the size of an IPv6 Frag EH
-        if (tot_len < sizeof(struct iphdr)) return TC_ACT_PIPE;
+    if (ext_len) {
+        // This is a badly formed IPv6 packet with less payload than its extension headers
+        if (tot_len < sizeof(struct iphdr) + ext_len) return TC_ACT_PIPE;
+        tot_len -= ext_len;
     }
 
     switch (proto) {
@@ -191,7 +224,7 @@ static inline __always_inline int nat64(struct __sk_buff* skb,
     //   return -ENOTSUPP;
     bpf_csum_update(skb, sum6);
 
-    // Technically 'kver < KVER_4_14' already implies 'frag_off == htons(IP_DF)' due to logic above,
+    // Technically 'kver < KVER_4_14' already implies 'ext_len == 0' due to logic above,
     // thus the initial 'kver >= KVER_4_14' check here is entirely superfluous.
     //
     // However, we *need* the compiler (when compiling the program for 4.9) to entirely
@@ -204,10 +237,11 @@ static inline __always_inline int nat64(struct __sk_buff* skb,
     //
     // Note: we currently have no TreeHugger coverage for 4.9-T devices (there are no such
     // Pixel or cuttlefish devices), so likely you won't notice for months if this breaks...
-    if (KVER_IS_AT_LEAST(kver, 4, 14, 0) && frag_off != htons(IP_DF)) {
-        // If we're converting an IPv6 Fragment, we need to trim off 8 more bytes
+    if (KVER_IS_AT_LEAST(kver, 4, 14, 0) && ext_len) {
+        // If we're converting a packet with extension headers, we need to trim them off too.
+        // This also updates skb->csum for a CHECKSUM_COMPLETE packet.
         // We're beyond recovery on error here... but hard to imagine how this could fail.
-        if (bpf_skb_adjust_room(skb, -(__s32)sizeof(struct frag_hdr), BPF_ADJ_ROOM_NET, /*flags*/0))
+        if (bpf_skb_adjust_room(skb, -(__s32)ext_len, BPF_ADJ_ROOM_NET, /*flags*/0))
             return TC_ACT_SHOT;
     }
 
@@ -267,8 +301,85 @@ DEFINE_BPF_PROG_KVER_RANGE("schedcls/ingress6/clat_rawip$4_9", AID_ROOT, AID_SYS
 
 DEFINE_BPF_MAP_GRW(clat_egress4_map, HASH, ClatEgress4Key, ClatEgress4Value, 16, AID_SYSTEM)
 
-DEFINE_BPF_PROG("schedcls/egress4/clat_rawip", AID_ROOT, AID_SYSTEM, sched_cls_egress4_clat_rawip)
-(struct __sk_buff* skb) {
+// Largest IPv4/UDP datagram (UDP header and payload) whose zero checksum we compute in bpf,
+// anything longer is left to clatd.  This covers everything fitting in a 1500 byte mtu.
+#define CLAT_UDP_CSUM_MAX_LEN (1500 - sizeof(struct iphdr))
+#define CLAT_UDP_CSUM_CHUNK 64
+
+// Computes the checksum of a rawip IPv4/UDP packet carrying a zero (ie. no) UDP checksum,
+// and writes it into the UDP header.  Returns false (with the packet unmodified) on failure.
+//
+// Since the IPv6 address chosen by ClatdController is checksum neutral, a correct IPv4/UDP
+// checksum remains correct after translation to IPv6.
+//
+// Note: this invalidates all skb->data/data_end derived pointers.
+static inline __always_inline bool udp4_fill_checksum(struct __sk_buff* skb, const __be32 saddr,
+                                                      const __be32 daddr, const __be16 len) {
+    const uint32_t udp_len = ntohs(len);
+    if (udp_len < sizeof(struct udphdr) || udp_len > CLAT_UDP_CSUM_MAX_LEN) return false;
+
+    // bpf_csum_diff() can only sum linear packet data.
+    try_make_writable(skb, sizeof(struct iphdr) + udp_len);
+
+    const void* p = (void*)(long)skb->data + sizeof(struct iphdr);
+    const void* data_end = (void*)(long)skb->data_end;
+
+    // Pseudo header: addresses, protocol & UDP length.  All 16-bit one's complement sums are
+    // computed in native byte order, which (being one's complement) yields the checksum
+    // in network byte order.
+    uint64_t sum = (saddr & 0xFFFF) + (saddr >> 16) + (daddr & 0xFFFF) + (daddr >> 16) +
+                   htons(IPPROTO_UDP) + len;
+
+    // The UDP header (with a zero checksum field) and payload, in bounded chunks to keep the
+    // verifier happy.  bpf_csum_diff() requires multiples of 4 bytes.
+    uint32_t remaining = udp_len;
+    __wsum csum = 0;
+#pragma unroll
+    for (unsigned i = 0; i < CLAT_UDP_CSUM_MAX_LEN / CLAT_UDP_CSUM_CHUNK; ++i) {
+        if (remaining < CLAT_UDP_CSUM_CHUNK) break;
+        if (p + CLAT_UDP_CSUM_CHUNK > data_end) return false;
+        csum = bpf_csum_diff(NULL, 0, (__be32*)p, CLAT_UDP_CSUM_CHUNK, csum);
+        p += CLAT_UDP_CSUM_CHUNK;
+        remaining -= CLAT_UDP_CSUM_CHUNK;
+    }
+    sum += csum;
+#pragma unroll
+    for (unsigned i = 0; i < CLAT_UDP_CSUM_CHUNK / sizeof(__u32) - 1; ++i) {
+        if (remaining < sizeof(__u32)) break;
+        if (p + sizeof(__u32) > data_end) return false;
+        sum += *(__u32*)p;
+        p += sizeof(__u32);
+        remaining -= sizeof(__u32);
+    }
+    if (remaining >= sizeof(__u16)) {
+        if (p + sizeof(__u16) > data_end) return false;
+        sum += *(__u16*)p;
+        p += sizeof(__u16);
+        remaining -= sizeof(__u16);
+    }
+    if (remaining) {
+        // Odd trailing byte: padded with a zero byte, ie. the low byte in native order.
+        if (p + sizeof(__u8) > data_end) return false;
+        sum += *(__u8*)p;
+    }
+
+    // Fold the u64 into 16 bits.
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    // A computed checksum of zero is transmitted as all ones (zero means no checksum).
+    __u16 check = ~sum;
+    if (!check) check = 0xFFFF;
+
+    // This also updates skb->csum of CHECKSUM_COMPLETE packets.
+    return !bpf_skb_store_bytes(skb, sizeof(struct iphdr) + offsetof(struct udphdr, check),
+                                &check, sizeof(check), BPF_F_RECOMPUTE_CSUM);
+}
+
+static inline __always_inline int egress4(struct __sk_buff* skb, const struct kver_uint kver) {
     // Must be meta-ethernet IPv4 frame
     if (skb->protocol != htons(ETH_P_IP)) return TC_ACT_PIPE;
 
@@ -288,6 +399,9 @@ DEFINE_BPF_PROG("schedcls/egress4/clat_rawip", AID_ROOT, AID_SYSTEM, sched_cls_e
     // We cannot handle IP options, just standard 20 byte == 5 dword minimal IPv4 header
     if (ip4->ihl != 5) return TC_ACT_PIPE;
 
+    // Non-zero (in network byte order) iff this is a UDP packet without a checksum.
+    __be16 udp_len = 0;
+
     // Calculate the IPv4 one's complement checksum of the IPv4 header.
     __wsum sum4 = 0;
     for (unsigned i = 0; i < sizeof(*ip4) / sizeof(__u16); ++i) {
@@ -315,11 +429,15 @@ DEFINE_BPF_PROG("schedcls/egress4/clat_rawip", AID_ROOT, AID_SYSTEM, sched_cls_e
         case IPPROTO_UDP:      // See above comment, but must also have UDP header...
             if (data + sizeof(*ip4) + sizeof(struct udphdr) > data_end) return TC_ACT_PIPE;
             const struct udphdr* uh = (const struct udphdr*)(ip4 + 1);
-            // If IPv4/UDP checksum is 0 then fallback to clatd so it can calculate the
-            // checksum.  Otherwise the network or more likely the NAT64 gateway might
-            // drop the packet because in most cases IPv6/UDP packets with a zero checksum
-            // are invalid. See RFC 6935.  TODO: calculate checksum via bpf_csum_diff()
-            if (!uh->check) return TC_ACT_PIPE;
+            // If IPv4/UDP checksum is 0 then it needs to be calculated (see below), since
+            // otherwise the network or more likely the NAT64 gateway might drop the packet
+            // because in most cases IPv6/UDP packets with a zero checksum are invalid.
+            // See RFC 6935.  This only works for unfragmented packets covering the entire
+            // UDP datagram, so the UDP length must match the IPv4 payload length.
+            if (!uh->check) {
+                if (ntohs(uh->len) != ntohs(ip4->tot_len) - sizeof(*ip4)) return TC_ACT_PIPE;
+                udp_len = uh->len;
+            }
             break;
 
         default:  // do not know how to handle anything else
@@ -338,8 +456,9 @@ DEFINE_BPF_PROG("schedcls/egress4/clat_rawip", AID_ROOT, AID_SYSTEM, sched_cls_e
     // Translating without redirecting doesn't make sense.
     if (!v->oif) return TC_ACT_PIPE;
 
-    // This implementation is currently limited to rawip.
-    if (v->oifIsEthernet) return TC_ACT_PIPE;
+    // Ethernet upstreams need the kernel to resolve the next hop and build the ethernet
+    // header for us (see bpf_redirect_neigh() below), which requires a 5.10+ kernel.
+    if (v->oifIsEthernet && !KVER_IS_AT_LEAST(kver, 5, 10, 0)) return TC_ACT_PIPE;
 
     struct ipv6hdr ip6 = {
             .version = 6,                                    // __u8:4
@@ -363,8 +482,13 @@ DEFINE_BPF_PROG("schedcls/egress4/clat_rawip", AID_ROOT, AID_SYSTEM, sched_cls_e
     // Note that there is no L4 checksum update: we are relying on the checksum neutrality
     // of the ipv6 address chosen by netd's ClatdController.
 
-    // Packet mutations begin - point of no return, but if this first modification fails
-    // the packet is probably still pristine, so let clatd handle it.
+    // Packet mutations begin - if filling in the missing UDP checksum or the following
+    // protocol change fails the packet is probably still (or again) a valid IPv4 packet,
+    // so let clatd handle it.  Note: this invalidates 'ip4' (which is no longer used).
+    if (udp_len && !udp4_fill_checksum(skb, k.local4.s_addr, ip6.daddr.in6_u.u6_addr32[3],
+                                       udp_len))
+        return TC_ACT_PIPE;
+
     if (bpf_skb_change_proto(skb, htons(ETH_P_IPV6), 0)) return TC_ACT_PIPE;
 
     // This takes care of updating the skb->csum field for a CHECKSUM_COMPLETE packet.
@@ -394,7 +518,43 @@ DEFINE_BPF_PROG("schedcls/egress4/clat_rawip", AID_ROOT, AID_SYSTEM, sched_cls_e
     __sync_fetch_and_add(&v->bytes, skb->len);
 
     // Redirect to non v4-* interface.  Tcpdump only sees packet after this redirect.
-    return bpf_redirect(v->oif, 0 /* this is effectively BPF_F_EGRESS */);
+    if (!v->oifIsEthernet) return bpf_redirect(v->oif, 0 /* this is effectively BPF_F_EGRESS */);
+
+    // For ethernet the kernel does a fib lookup of the (nat64 prefixed) IPv6 destination via
+    // the output interface, and replaces the ethernet header with the one of the next hop
+    // neighbour.  While that neighbour is still being resolved the packet is queued on it,
+    // just like the ones clatd writes to its raw socket.
+    //
+    // However, bpf_redirect_neigh() drops packets without a mac header, which packets
+    // egressing the (rawip) v4-* tun interface lack, so push a placeholder one.
+    // It is all zeroes (ie. not multicast, which would also be dropped) but for the protocol.
+    // At this point the packet is no longer valid IPv4, so we can't fall back to clatd.
+    if (bpf_skb_change_head(skb, sizeof(struct ethhdr), /*flags*/ 0)) return TC_ACT_SHOT;
+
+    // bpf_skb_change_head() invalidates all pointers - reload them.
+    data = (void*)(long)skb->data;
+    data_end = (void*)(long)skb->data_end;
+
+    // I do not believe this can ever happen, but keep the verifier happy...
+    if (data + sizeof(struct ethhdr) > data_end) return TC_ACT_SHOT;
+
+    ((struct ethhdr*)data)->h_proto = htons(ETH_P_IPV6);
+
+    return bpf_redirect_neigh(v->oif, NULL, 0, 0);
+}
+
+// Note: despite the 'rawip' in the name (which is part of the pinned path used by
+// ClatCoordinator) on 5.10+ this also handles ethernet upstreams.
+DEFINE_BPF_PROG_KVER("schedcls/egress4/clat_rawip$5_10", AID_ROOT, AID_SYSTEM,
+                     sched_cls_egress4_clat_rawip_5_10, KVER_5_10)
+(struct __sk_buff* skb) {
+    return egress4(skb, KVER_5_10);
+}
+
+DEFINE_BPF_PROG_KVER_RANGE("schedcls/egress4/clat_rawip$4_9", AID_ROOT, AID_SYSTEM,
+                           sched_cls_egress4_clat_rawip_4_9, KVER_NONE, KVER_5_10)
+(struct __sk_buff* skb) {
+    return egress4(skb, KVER_NONE);
 }
 
 LICENSE("Apache 2.0");
@@ -23,27 +23,37 @@
 #define ECN_MASK 3
 #define UPDATE_TOS(dscp, tos) ((dscp) << 2) | ((tos) & ECN_MASK)
 
-// The cache is never read nor written by userspace and is indexed by socket cookie % CACHE_MAP_SIZE
-#define CACHE_MAP_SIZE 32  // should be a power of two so we can % cheaply
-DEFINE_BPF_MAP_KERNEL_INTERNAL(socket_policy_cache_map, PERCPU_ARRAY, uint32_t, RuleEntry,
+// The cache is never read nor written by userspace and is keyed by socket cookie, so sockets
+// neither evict each other (unless there are more than CACHE_MAP_SIZE of them, as it is an LRU)
+// nor lose their entry when migrating between cpus.
+//
+// Ideally this would be socket local storage (BPF_MAP_TYPE_SK_STORAGE), but creating those
+// requires BTF, which the bpfloader does not load.
+#define CACHE_MAP_SIZE 1024
+DEFINE_BPF_MAP_KERNEL_INTERNAL(socket_policy_cache_map, LRU_HASH, uint64_t, RuleEntry,
                                CACHE_MAP_SIZE)
 
 DEFINE_BPF_MAP_GRW(ipv4_dscp_policies_map, ARRAY, uint32_t, DscpPolicy, MAX_POLICIES, AID_SYSTEM)
 DEFINE_BPF_MAP_GRW(ipv6_dscp_policies_map, ARRAY, uint32_t, DscpPolicy, MAX_POLICIES, AID_SYSTEM)
 
+// A single element array, incremented by userspace after every change to the policy maps.
+// Cached decisions from an older generation are stale and thus ignored.
+DEFINE_BPF_MAP_GRW(policy_generation_map, ARRAY, uint32_t, uint32_t, 1, AID_SYSTEM)
+
 static inline __always_inline uint64_t calculate_u64(uint64_t v) {
     COMPILER_FORCE_CALCULATION(v);
     return v;
 }
 
-static inline __always_inline void match_policy(struct __sk_buff* skb, const bool ipv4) {
+static inline __always_inline void match_policy(struct __sk_buff* skb, const bool ipv4,
+                                                const struct rawip_bool rawip) {
     void* data = (void*)(long)skb->data;
     const void* data_end = (void*)(long)skb->data_end;
 
-    const int l2_header_size = sizeof(struct ethhdr);
-    struct ethhdr* eth = data;
+    const int l2_header_size = rawip.rawip ? 0 : sizeof(struct ethhdr);
+    void* l3_header = data + l2_header_size;
 
-    if (data + l2_header_size > data_end) return;
+    if (l3_header > data_end) return;
 
     int hdr_size = 0;
 
@@ -51,7 +61,12 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
     uint64_t cookie = bpf_get_socket_cookie(skb);
     if (!cookie) return;
 
-    uint32_t cacheid = cookie % CACHE_MAP_SIZE;
+    // Read before the policy maps, so a concurrent update at worst caches an already
+    // stale decision, rather than a new decision under the old generation.
+    const uint32_t zero = 0;
+    const uint32_t* generation_ptr = bpf_policy_generation_map_lookup_elem(&zero);
+    if (!generation_ptr) return;  // impossible
+    const uint32_t generation = *generation_ptr;
 
     __be16 sport = 0;
     uint16_t dport = 0;
@@ -61,7 +76,7 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
     uint8_t tos = 0;            // Only used for IPv4
     __be32 old_first_be32 = 0;  // Only used for IPv6
     if (ipv4) {
-        const struct iphdr* const iph = (void*)(eth + 1);
+        const struct iphdr* const iph = l3_header;
         hdr_size = l2_header_size + sizeof(struct iphdr);
         // Must have ipv4 header
         if (data + hdr_size > data_end) return;
@@ -82,7 +97,7 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
         protocol = iph->protocol;
         tos = iph->tos;
     } else {
-        struct ipv6hdr* ip6h = (void*)(eth + 1);
+        struct ipv6hdr* ip6h = l3_header;
         hdr_size = l2_header_size + sizeof(struct ipv6hdr);
         // Must have ipv6 header
         if (data + hdr_size > data_end) return;
@@ -115,18 +130,20 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
             return;
     }
 
-    // this array lookup cannot actually fail
-    RuleEntry* existing_rule = bpf_socket_policy_cache_map_lookup_elem(&cacheid);
-
-    if (!existing_rule) return; // impossible
-
-    uint64_t nomatch = 0;
-    nomatch |= v6_not_equal(src_ip, existing_rule->src_ip);
-    nomatch |= v6_not_equal(dst_ip, existing_rule->dst_ip);
-    nomatch |= (skb->ifindex ^ existing_rule->ifindex);
-    nomatch |= (sport ^ existing_rule->src_port);
-    nomatch |= (dport ^ existing_rule->dst_port);
-    nomatch |= (protocol ^ existing_rule->proto);
+    RuleEntry* existing_rule = bpf_socket_policy_cache_map_lookup_elem(&cookie);
+
+    // Even for a given socket the tuple can change (ie. unconnected UDP sockets) so the cached
+    // decision is only valid if it matches.
+    uint64_t nomatch = !existing_rule;
+    if (existing_rule) {
+        nomatch |= v6_not_equal(src_ip, existing_rule->src_ip);
+        nomatch |= v6_not_equal(dst_ip, existing_rule->dst_ip);
+        nomatch |= (skb->ifindex ^ existing_rule->ifindex);
+        nomatch |= (sport ^ existing_rule->src_port);
+        nomatch |= (dport ^ existing_rule->dst_port);
+        nomatch |= (protocol ^ existing_rule->proto);
+        nomatch |= (generation ^ existing_rule->generation);
+    }
     COMPILER_FORCE_CALCULATION(nomatch);
 
     /*
@@ -136,10 +153,11 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
      *   skb->ifindex == existing_rule->ifindex &&
      *   sport == existing_rule->src_port &&
      *   dport == existing_rule->dst_port &&
-     *   protocol == existing_rule->proto
+     *   protocol == existing_rule->proto &&
+     *   generation == existing_rule->generation
      */
 
-    if (!nomatch) {
+    if (existing_rule && !nomatch) {
         if (existing_rule->dscp_val < 0) return;  // cached no-op
 
         if (ipv4) {
@@ -237,7 +255,7 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
     }
 
     // Update cache with found policy.
-    *existing_rule = (RuleEntry){
+    const RuleEntry new_rule = {
         .src_ip = src_ip,
         .dst_ip = dst_ip,
         .ifindex = skb->ifindex,
@@ -245,7 +263,11 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
         .dst_port = dport,
         .proto = protocol,
         .dscp_val = new_dscp,
+        .generation = generation,
     };
+    // The cache is shared between cpus, so the entry must be replaced as a whole by the kernel,
+    // writing through 'existing_rule' could let a concurrent reader see a torn rule.
+    bpf_socket_policy_cache_map_update_elem(&cookie, &new_rule, BPF_ANY);
 
     if (new_dscp < 0) return;
 
@@ -262,20 +284,30 @@ static inline __always_inline void match_policy(struct __sk_buff* skb, const boo
     return;
 }
 
-DEFINE_BPF_PROG_KVER("schedcls/set_dscp_ether", AID_ROOT, AID_SYSTEM, schedcls_set_dscp_ether,
-                     KVER_5_15)
-(struct __sk_buff* skb) {
+static inline __always_inline int set_dscp(struct __sk_buff* skb, const struct rawip_bool rawip) {
     if (skb->pkt_type != PACKET_HOST) return TC_ACT_PIPE;
 
     if (skb->protocol == htons(ETH_P_IP)) {
-        match_policy(skb, true);
+        match_policy(skb, true, rawip);
     } else if (skb->protocol == htons(ETH_P_IPV6)) {
-        match_policy(skb, false);
+        match_policy(skb, false, rawip);
     }
 
     // Always return TC_ACT_PIPE
     return TC_ACT_PIPE;
 }
 
+DEFINE_BPF_PROG_KVER("schedcls/set_dscp_ether", AID_ROOT, AID_SYSTEM, schedcls_set_dscp_ether,
+                     KVER_5_15)
+(struct __sk_buff* skb) {
+    return set_dscp(skb, ETHER);
+}
+
+DEFINE_BPF_PROG_KVER("schedcls/set_dscp_rawip", AID_ROOT, AID_SYSTEM, schedcls_set_dscp_rawip,
+                     KVER_5_15)
+(struct __sk_buff* skb) {
+    return set_dscp(skb, RAWIP);
+}
+
 LICENSE("Apache 2.0");
 CRITICAL("Connectivity");
@@ -53,5 +53,6 @@ typedef struct {
     uint8_t proto;
     int8_t dscp_val;  // -1 none, or 0..63 DSCP value
     uint8_t pad[2];
+    uint32_t generation;  // policy generation this entry was computed for
 } RuleEntry;
-STRUCT_SIZE(RuleEntry, 2 * 16 + 4 + 2 * 2 + 4 * 1);  // 44
+STRUCT_SIZE(RuleEntry, 2 * 16 + 4 + 2 * 2 + 4 * 1 + 4);  // 48
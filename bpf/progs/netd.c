@@ -60,6 +60,33 @@ static const bool TRACE_OFF = false;
     DEFINE_BPF_MAP_UGM(the_map, TYPE, TypeOfKey, TypeOfValue, num_entries, \
                        AID_ROOT, AID_NET_BW_ACCT, 0660)
 
+// The stats related maps below may be resized by the bpfloader's map size configuration
+// to anywhere within [num_entries / 4, num_entries * 4], see DEFINE_BPF_RESIZABLE_MAP_BASE.
+#define NETD_MAP_SHRINK_LOG2 2
+#define NETD_MAP_GROW_LOG2 2
+
+#define DEFINE_BPF_RESIZABLE_MAP_NO_NETD(the_map, TYPE, TypeOfKey, TypeOfValue, num_entries) \
+    DEFINE_BPF_RESIZABLE_MAP_EXT(the_map, TYPE, TypeOfKey, TypeOfValue, num_entries,         \
+                                 NETD_MAP_SHRINK_LOG2, NETD_MAP_GROW_LOG2,                   \
+                                 AID_ROOT, AID_NET_BW_ACCT, 0060, "fs_bpf_net_shared", "",   \
+                                 PRIVATE, BPFLOADER_MIN_VER, BPFLOADER_MAX_VER,              \
+                                 LOAD_ON_ENG, LOAD_ON_USER, LOAD_ON_USERDEBUG)
+
+#define DEFINE_BPF_RESIZABLE_MAP_RO_NETD(the_map, TYPE, TypeOfKey, TypeOfValue, num_entries)  \
+    DEFINE_BPF_RESIZABLE_MAP_EXT(the_map, TYPE, TypeOfKey, TypeOfValue, num_entries,          \
+                                 NETD_MAP_SHRINK_LOG2, NETD_MAP_GROW_LOG2,                    \
+                                 AID_ROOT, AID_NET_BW_ACCT, 0460, "fs_bpf_netd_readonly", "", \
+                                 PRIVATE, BPFLOADER_MIN_VER, BPFLOADER_MAX_VER,               \
+                                 LOAD_ON_ENG, LOAD_ON_USER, LOAD_ON_USERDEBUG)
+
+#define DEFINE_BPF_RESIZABLE_MAP_RW_NETD(the_map, TYPE, TypeOfKey, TypeOfValue, num_entries) \
+    DEFINE_BPF_RESIZABLE_MAP_EXT(the_map, TYPE, TypeOfKey, TypeOfValue, num_entries,         \
+                                 NETD_MAP_SHRINK_LOG2, NETD_MAP_GROW_LOG2,                   \
+                                 AID_ROOT, AID_NET_BW_ACCT, 0660,                            \
+                                 DEFAULT_BPF_MAP_SELINUX_CONTEXT, DEFAULT_BPF_MAP_PIN_SUBDIR, \
+                                 PRIVATE, BPFLOADER_MIN_VER, BPFLOADER_MAX_VER,              \
+                                 LOAD_ON_ENG, LOAD_ON_USER, LOAD_ON_USERDEBUG)
+
 // Bpf map arrays on creation are preinitialized to 0 and do not support deletion of a key,
 // see: kernel/bpf/arraymap.c array_map_delete_elem() returns -EINVAL (from both syscall and ebpf)
 // Additionally on newer kernels the bpf jit can optimize out the lookups.
@@ -71,16 +98,22 @@ DEFINE_BPF_MAP_RO_NETD(configuration_map, ARRAY, uint32_t, uint32_t, CONFIGURATI
 //   uid_counterset_map + uid_owner_map + uid_permission_map
 DEFINE_BPF_MAP_NO_NETD(blocked_ports_map, ARRAY, int, uint64_t,
                        1024 /* 64K ports -> 1024 u64s */)
-DEFINE_BPF_MAP_RW_NETD(cookie_tag_map, HASH, uint64_t, UidTagValue, COOKIE_UID_MAP_SIZE)
+DEFINE_BPF_RESIZABLE_MAP_RW_NETD(cookie_tag_map, HASH, uint64_t, UidTagValue, COOKIE_UID_MAP_SIZE)
 DEFINE_BPF_MAP_NO_NETD(uid_counterset_map, HASH, uint32_t, uint8_t, UID_COUNTERSET_MAP_SIZE)
-DEFINE_BPF_MAP_NO_NETD(app_uid_stats_map, HASH, uint32_t, StatsValue, APP_STATS_MAP_SIZE)
-DEFINE_BPF_MAP_RO_NETD(stats_map_A, HASH, StatsKey, StatsValue, STATS_MAP_SIZE)
-DEFINE_BPF_MAP_RO_NETD(stats_map_B, HASH, StatsKey, StatsValue, STATS_MAP_SIZE)
+DEFINE_BPF_RESIZABLE_MAP_NO_NETD(app_uid_stats_map, HASH, uint32_t, StatsValue, APP_STATS_MAP_SIZE)
+DEFINE_BPF_RESIZABLE_MAP_RO_NETD(stats_map_A, HASH, StatsKey, StatsValue, STATS_MAP_SIZE)
+DEFINE_BPF_RESIZABLE_MAP_RO_NETD(stats_map_B, HASH, StatsKey, StatsValue, STATS_MAP_SIZE)
 DEFINE_BPF_MAP_NO_NETD(iface_stats_map, HASH, uint32_t, StatsValue, IFACE_STATS_MAP_SIZE)
+// Traffic which could not be accounted because the stats map was full, per StatsUpdateErrorKey.
+DEFINE_BPF_MAP_NO_NETD(stats_update_error_map, PERCPU_ARRAY, uint32_t, StatsValue,
+                       STATS_UPDATE_ERROR_MAP_SIZE)
 DEFINE_BPF_MAP_RO_NETD(uid_owner_map, HASH, uint32_t, UidOwnerValue, UID_OWNER_MAP_SIZE)
+DEFINE_BPF_MAP_RO_NETD(uid_owner_map_B, HASH, uint32_t, UidOwnerValue, UID_OWNER_MAP_SIZE)
 DEFINE_BPF_MAP_RO_NETD(uid_permission_map, HASH, uint32_t, uint8_t, UID_OWNER_MAP_SIZE)
 DEFINE_BPF_MAP_NO_NETD(ingress_discard_map, HASH, IngressDiscardKey, IngressDiscardValue,
                        INGRESS_DISCARD_MAP_SIZE)
+DEFINE_BPF_MAP_NO_NETD(ingress_ratelimit_map, HASH, uint32_t, IngressRateLimitValue,
+                       INGRESS_RATELIMIT_MAP_SIZE)
 
 DEFINE_BPF_MAP_RW_NETD(lock_array_test_map, ARRAY, uint32_t, bool, 1)
 DEFINE_BPF_MAP_RW_NETD(lock_hash_test_map, HASH, uint32_t, bool, 1)
@@ -165,7 +198,7 @@ DEFINE_BPF_MAP_RO_NETD(data_saver_enabled_map, ARRAY, uint32_t, bool,
  * Especially since the number of packets is important for any future clat offload correction.
  * (which adjusts upward by 20 bytes per packet to account for ipv4 -> ipv6 header conversion)
  */
-#define DEFINE_UPDATE_STATS(the_stats_map, TypeOfKey)                                            \
+#define DEFINE_UPDATE_STATS(the_stats_map, TypeOfKey, errorKey)                                  \
     static __always_inline inline void update_##the_stats_map(const struct __sk_buff* const skb, \
                                                               const TypeOfKey* const key,        \
                                                               const struct egress_bool egress,   \
@@ -176,6 +209,11 @@ DEFINE_BPF_MAP_RO_NETD(data_saver_enabled_map, ARRAY, uint32_t, bool,
             bpf_##the_stats_map##_update_elem(key, &newValue, BPF_NOEXIST);                      \
             value = bpf_##the_stats_map##_lookup_elem(key);                                      \
         }                                                                                        \
+        if (!value) {                                                                            \
+            /* the map is full: account the traffic as lost, so that it is at least visible */  \
+            const uint32_t errKey = errorKey;                                                    \
+            value = bpf_stats_update_error_map_lookup_elem(&errKey);                             \
+        }                                                                                        \
         if (value) {                                                                             \
             const int mtu = 1500;                                                                \
             uint64_t packets = 1;                                                                \
@@ -199,10 +237,10 @@ DEFINE_BPF_MAP_RO_NETD(data_saver_enabled_map, ARRAY, uint32_t, bool,
         }                                                                                        \
     }
 
-DEFINE_UPDATE_STATS(app_uid_stats_map, uint32_t)
-DEFINE_UPDATE_STATS(iface_stats_map, uint32_t)
-DEFINE_UPDATE_STATS(stats_map_A, StatsKey)
-DEFINE_UPDATE_STATS(stats_map_B, StatsKey)
+DEFINE_UPDATE_STATS(app_uid_stats_map, uint32_t, STATS_UPDATE_ERROR_APP_UID_STATS_MAP)
+DEFINE_UPDATE_STATS(iface_stats_map, uint32_t, STATS_UPDATE_ERROR_IFACE_STATS_MAP)
+DEFINE_UPDATE_STATS(stats_map_A, StatsKey, STATS_UPDATE_ERROR_STATS_MAP_A)
+DEFINE_UPDATE_STATS(stats_map_B, StatsKey, STATS_UPDATE_ERROR_STATS_MAP_B)
 
 // both of these return 0 on success or -EFAULT on failure (and zero out the buffer)
 static __always_inline inline int bpf_skb_load_bytes_net(const struct __sk_buff* const skb,
@@ -362,6 +400,13 @@ static __always_inline inline BpfConfig getConfig(uint32_t configKey) {
     return *config;
 }
 
+static __always_inline inline UidOwnerValue* lookup_uid_owner(uint32_t uid) {
+    if (getConfig(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY) == SELECT_UID_OWNER_MAP_B) {
+        return bpf_uid_owner_map_B_lookup_elem(&uid);
+    }
+    return bpf_uid_owner_map_lookup_elem(&uid);
+}
+
 static __always_inline inline bool ingress_should_discard(struct __sk_buff* skb,
                                                           const struct kver_uint kver) {
     // Require 4.19, since earlier kernels don't have bpf_skb_load_bytes_relative() which
@@ -403,7 +448,7 @@ static __always_inline inline int bpf_owner_match(struct __sk_buff* skb, uint32_
     // BACKGROUND match does not apply to loopback traffic
     if (skb->ifindex == 1) enabledRules &= ~BACKGROUND_MATCH;
 
-    UidOwnerValue* uidEntry = bpf_uid_owner_map_lookup_elem(&uid);
+    UidOwnerValue* uidEntry = lookup_uid_owner(uid);
     uint32_t uidRules = uidEntry ? uidEntry->rule : 0;
     uint32_t allowed_iif = uidEntry ? uidEntry->iif : 0;
 
@@ -596,6 +641,80 @@ DEFINE_SYS_BPF_PROG("schedact/ingress/account", AID_ROOT, AID_NET_ADMIN,
     return TC_ACT_UNSPEC;
 }
 
+// Sets the ECN field of ECN capable (ie. ECT(0) or ECT(1)) IPv4 and IPv6 packets to CE.
+static __always_inline inline void mark_ce(struct __sk_buff* skb, const struct rawip_bool rawip) {
+    const int l2_header_size = rawip.rawip ? 0 : sizeof(struct ethhdr);
+
+    if (skb->protocol == htons(ETH_P_IP)) {
+        // The first 16-bit word of the header: version, ihl and tos.
+        __be16 old_word;
+        if (bpf_skb_load_bytes(skb, l2_header_size, &old_word, sizeof(old_word))) return;
+        const __u8 ecn = ntohs(old_word) & 3;
+        if (ecn == 0 || ecn == 3) return;  // Not-ECT, or already CE
+        const __be16 new_word = old_word | htons(3);
+        // No BPF_F_RECOMPUTE_CSUM: this change and the checksum update cancel out in skb->csum.
+        if (bpf_skb_store_bytes(skb, l2_header_size, &new_word, sizeof(new_word), 0)) return;
+        bpf_l3_csum_replace(skb, l2_header_size + IP4_OFFSET(check), old_word, new_word,
+                            sizeof(__u16));
+    } else if (skb->protocol == htons(ETH_P_IPV6)) {
+        // The second byte of the header holds the bottom nibble of the traffic class,
+        // ie. the 2-bit ECN field, followed by the top nibble of the flow label.
+        __u8 old_byte;
+        if (bpf_skb_load_bytes(skb, l2_header_size + 1, &old_byte, sizeof(old_byte))) return;
+        const __u8 ecn = (old_byte >> 4) & 3;
+        if (ecn == 0 || ecn == 3) return;  // Not-ECT, or already CE
+        const __u8 new_byte = old_byte | 0x30;
+        bpf_skb_store_bytes(skb, l2_header_size + 1, &new_byte, sizeof(new_byte),
+                            BPF_F_RECOMPUTE_CSUM);
+    }
+}
+
+// Ingress rate limiting, a replacement for 'tc-police' followed by 'ingress/account' above.
+// Traffic in excess of the configured rate is first ECN marked, so that TCP senders (and
+// other ECN capable transports) back off before the bucket runs out, and only dropped once
+// the full burst has been used up.
+static __always_inline inline int ingress_ratelimit(struct __sk_buff* skb,
+                                                    const struct rawip_bool rawip) {
+    uint32_t key = skb->ifindex;
+    IngressRateLimitValue* v = bpf_ingress_ratelimit_map_lookup_elem(&key);
+    if (!v || !v->rateInBytesPerSec) return TC_ACT_PIPE;
+
+    const uint64_t now = bpf_ktime_get_ns();
+    uint64_t tat = v->tatNs;
+    if (tat < now) tat = now;  // the bucket has been full for a while
+    const uint64_t backlog = tat - now;
+
+    if (backlog > v->burstNs) {
+        // Account for ingress traffic before it is dropped, admitted traffic is
+        // accounted later by skfilter/ingress/xtbpf in bw_raw_PREROUTING.
+        if (is_received_skb(skb)) update_iface_stats_map(skb, &key, INGRESS, KVER_NONE);
+        return TC_ACT_SHOT;
+    }
+    if (backlog > v->markNs) mark_ce(skb, rawip);
+
+    const uint64_t cost = (uint64_t)skb->len * 1000000000 / v->rateInBytesPerSec;
+    // Racy with other cpus, but the atomic add means concurrent packets are never both
+    // admitted for free, except when the bucket was full (where it does not matter).
+    if (v->tatNs < now) {
+        v->tatNs = now + cost;
+    } else {
+        __sync_fetch_and_add(&v->tatNs, cost);
+    }
+    return TC_ACT_PIPE;
+}
+
+DEFINE_SYS_BPF_PROG("schedcls/ingress/ratelimit_ether", AID_ROOT, AID_SYSTEM,
+                    tc_bpf_ingress_ratelimit_ether_prog)
+(struct __sk_buff* skb) {
+    return ingress_ratelimit(skb, ETHER);
+}
+
+DEFINE_SYS_BPF_PROG("schedcls/ingress/ratelimit_rawip", AID_ROOT, AID_SYSTEM,
+                    tc_bpf_ingress_ratelimit_rawip_prog)
+(struct __sk_buff* skb) {
+    return ingress_ratelimit(skb, RAWIP);
+}
+
 // WARNING: Android T's non-updatable netd depends on the name of this program.
 DEFINE_XTBPF_PROG("skfilter/allowlist/xtbpf", AID_ROOT, AID_NET_ADMIN, xt_bpf_allowlist_prog)
 (struct __sk_buff* skb) {
@@ -610,7 +729,7 @@ DEFINE_XTBPF_PROG("skfilter/allowlist/xtbpf", AID_ROOT, AID_NET_ADMIN, xt_bpf_al
     // Let's treat such cases as 'root' which is_system_uid()
     if (sock_uid == 65534) return XTBPF_MATCH;
 
-    UidOwnerValue* allowlistMatch = bpf_uid_owner_map_lookup_elem(&sock_uid);
+    UidOwnerValue* allowlistMatch = lookup_uid_owner(sock_uid);
     if (allowlistMatch) return allowlistMatch->rule & HAPPY_BOX_MATCH ? XTBPF_MATCH : XTBPF_NOMATCH;
     return XTBPF_NOMATCH;
 }
@@ -619,7 +738,7 @@ DEFINE_XTBPF_PROG("skfilter/allowlist/xtbpf", AID_ROOT, AID_NET_ADMIN, xt_bpf_al
 DEFINE_XTBPF_PROG("skfilter/denylist/xtbpf", AID_ROOT, AID_NET_ADMIN, xt_bpf_denylist_prog)
 (struct __sk_buff* skb) {
     uint32_t sock_uid = bpf_get_socket_uid(skb);
-    UidOwnerValue* denylistMatch = bpf_uid_owner_map_lookup_elem(&sock_uid);
+    UidOwnerValue* denylistMatch = lookup_uid_owner(sock_uid);
     uint32_t penalty_box = PENALTY_BOX_USER_MATCH | PENALTY_BOX_ADMIN_MATCH;
     if (denylistMatch) return denylistMatch->rule & penalty_box ? XTBPF_MATCH : XTBPF_NOMATCH;
     return XTBPF_NOMATCH;
@@ -122,11 +122,13 @@ static const int APP_STATS_MAP_SIZE = 10000;
 static const int STATS_MAP_SIZE = 5000;
 static const int IFACE_INDEX_NAME_MAP_SIZE = 1000;
 static const int IFACE_STATS_MAP_SIZE = 1000;
-static const int CONFIGURATION_MAP_SIZE = 2;
+static const int CONFIGURATION_MAP_SIZE = 4;
 static const int UID_OWNER_MAP_SIZE = 4000;
 static const int INGRESS_DISCARD_MAP_SIZE = 100;
+static const int INGRESS_RATELIMIT_MAP_SIZE = 64;
 static const int PACKET_TRACE_BUF_SIZE = 32 * 1024;
 static const int DATA_SAVER_ENABLED_MAP_SIZE = 1;
+static const int STATS_UPDATE_ERROR_MAP_SIZE = 4;
 
 #ifdef __cplusplus
 
@@ -170,6 +172,10 @@ ASSERT_STRING_EQUAL(XT_BPF_DENYLIST_PROG_PATH,  BPF_NETD_PATH "prog_netd_skfilte
 
 #define TC_BPF_INGRESS_ACCOUNT_PROG_NAME "prog_netd_schedact_ingress_account"
 #define TC_BPF_INGRESS_ACCOUNT_PROG_PATH BPF_NETD_PATH TC_BPF_INGRESS_ACCOUNT_PROG_NAME
+#define TC_BPF_INGRESS_RATELIMIT_ETHER_PROG_PATH \
+    BPF_NETD_PATH "prog_netd_schedcls_ingress_ratelimit_ether"
+#define TC_BPF_INGRESS_RATELIMIT_RAWIP_PROG_PATH \
+    BPF_NETD_PATH "prog_netd_schedcls_ingress_ratelimit_rawip"
 
 #define COOKIE_TAG_MAP_PATH BPF_NETD_PATH "map_netd_cookie_tag_map"
 #define UID_COUNTERSET_MAP_PATH BPF_NETD_PATH "map_netd_uid_counterset_map"
@@ -180,11 +186,14 @@ ASSERT_STRING_EQUAL(XT_BPF_DENYLIST_PROG_PATH,  BPF_NETD_PATH "prog_netd_skfilte
 #define IFACE_STATS_MAP_PATH BPF_NETD_PATH "map_netd_iface_stats_map"
 #define CONFIGURATION_MAP_PATH BPF_NETD_PATH "map_netd_configuration_map"
 #define UID_OWNER_MAP_PATH BPF_NETD_PATH "map_netd_uid_owner_map"
+#define UID_OWNER_MAP_B_PATH BPF_NETD_PATH "map_netd_uid_owner_map_B"
 #define UID_PERMISSION_MAP_PATH BPF_NETD_PATH "map_netd_uid_permission_map"
 #define INGRESS_DISCARD_MAP_PATH BPF_NETD_PATH "map_netd_ingress_discard_map"
+#define INGRESS_RATELIMIT_MAP_PATH BPF_NETD_PATH "map_netd_ingress_ratelimit_map"
 #define PACKET_TRACE_RINGBUF_PATH BPF_NETD_PATH "map_netd_packet_trace_ringbuf"
 #define PACKET_TRACE_ENABLED_MAP_PATH BPF_NETD_PATH "map_netd_packet_trace_enabled_map"
 #define DATA_SAVER_ENABLED_MAP_PATH BPF_NETD_PATH "map_netd_data_saver_enabled_map"
+#define STATS_UPDATE_ERROR_MAP_PATH BPF_NETD_PATH "map_netd_stats_update_error_map"
 
 #endif // __cplusplus
 
@@ -220,6 +229,23 @@ enum StatsMapType : uint32_t {
     SELECT_MAP_B,
 };
 
+// uid_owner_map and uid_owner_map_B always hold the same rules, except while a firewall chain
+// is being replaced: userspace then writes the new chain into the map not currently in use,
+// and flips the configuration entry so that the new chain takes effect all at once.
+enum UidOwnerMapType : uint32_t {
+    SELECT_UID_OWNER_MAP_A,
+    SELECT_UID_OWNER_MAP_B,
+};
+
+// Keys of the per-cpu stats_update_error_map: the stats map which ran out of space.
+// The value is a StatsValue holding the traffic which could not be accounted.
+enum StatsUpdateErrorKey : uint32_t {
+    STATS_UPDATE_ERROR_APP_UID_STATS_MAP,
+    STATS_UPDATE_ERROR_IFACE_STATS_MAP,
+    STATS_UPDATE_ERROR_STATS_MAP_A,
+    STATS_UPDATE_ERROR_STATS_MAP_B,
+};
+
 // TODO: change the configuration object from a bitmask to an object with clearer
 // semantics, like a struct.
 typedef uint32_t BpfConfig;
@@ -245,10 +271,26 @@ typedef struct {
 } IngressDiscardValue;
 STRUCT_SIZE(IngressDiscardValue, 2 * 4);  // 8
 
+// Per ingress interface (ifindex) token bucket, expressed as a theoretical arrival time (GCRA):
+// the backlog 'tatNs - now' is how long it would take to drain the bytes admitted in excess of
+// the rate, ie. how much of the bucket has been used up.
+typedef struct {
+    uint64_t rateInBytesPerSec;  // rate the bucket refills at, never zero
+    uint64_t markNs;   // backlog above which ECN capable packets are CE marked
+    uint64_t burstNs;  // backlog above which packets are dropped, ie. the bucket size
+    uint64_t tatNs;    // theoretical arrival time (bpf_ktime_get_ns), only written by bpf
+} IngressRateLimitValue;
+STRUCT_SIZE(IngressRateLimitValue, 4 * 8);  // 32
+
 // Entry in the configuration map that stores which UID rules are enabled.
 #define UID_RULES_CONFIGURATION_KEY 0
 // Entry in the configuration map that stores which stats map is currently in use.
 #define CURRENT_STATS_MAP_CONFIGURATION_KEY 1
+// Entry in the configuration map that is incremented after every uid_permission_map update,
+// so userspace can cache permission lookups until it changes.
+#define UID_PERMISSION_GENERATION_KEY 2
+// Entry in the configuration map that stores which uid owner map is currently in use.
+#define CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY 3
 // Entry in the data saver enabled map that stores whether data saver is enabled or not.
 #define DATA_SAVER_ENABLED_KEY 0
 
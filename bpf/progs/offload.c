@@ -58,6 +58,58 @@ DEFINE_BPF_MAP_GRW(tether_stats_map, HASH, TetherStatsKey, TetherStatsValue, 16,
 // (tethering allowed when stats[iif].rxBytes + stats[iif].txBytes < limit[iif])
 DEFINE_BPF_MAP_GRW(tether_limit_map, HASH, TetherLimitKey, TetherLimitValue, 16, AID_NETWORK_STACK)
 
+// ----- Per Interface Dispatch -----
+
+// The programs stay attached to interfaces which (currently) have no offloaded flows,
+// this lets them bail out after a single map lookup instead of parsing every packet.
+DEFINE_BPF_MAP_GRW(tether_iif_rules_map, HASH, TetherIifRulesKey, TetherIifRulesValue, 64,
+                   AID_NETWORK_STACK)
+
+static inline __always_inline bool has_iif_rules(const struct __sk_buff* skb,
+                                                 const uint32_t rules) {
+    TetherIifRulesKey k = skb->ifindex;
+    TetherIifRulesValue* v = bpf_tether_iif_rules_map_lookup_elem(&k);
+    return v && (*v & rules);
+}
+
+// Returns the number of packets forwarding this skb will put on the wire, and updates *L3_bytes
+// (initially the L3 length of the skb) to their total L3 size.  LRO/GRO aggregated packets are
+// resegmented on transmit, with each segment repeating the 'hdr_len' bytes of L3 & L4 headers.
+//
+// 5.8+ kernels expose the segmentation the kernel will actually perform via skb->gso_segs (5.1+)
+// and skb->gso_size (5.7+).  Older kernels, or packets whose headers we could not parse
+// (hdr_len == 0), fall back to estimating it from the path mtu, which is not necessarily correct
+// (this should be derived from the connection's mss), and assuming 'approx_hdr_len' bytes of
+// headers (ie. blindly assuming 12 bytes of tcp timestamp option), but worst case we simply
+// undercount, which is still better then not accounting for this overhead at all.
+static inline __always_inline uint64_t count_tx_packets(struct __sk_buff* skb,
+                                                        uint64_t* L3_bytes,
+                                                        const uint32_t hdr_len,
+                                                        const uint32_t approx_hdr_len,
+                                                        const uint32_t pmtu,
+                                                        const struct kver_uint kver) {
+    if (KVER_IS_AT_LEAST(kver, 5, 8, 0) && hdr_len) {
+        const uint32_t gso_size = skb->gso_size;
+        const uint32_t gso_segs = skb->gso_segs;
+
+        // Not a gso packet: it is transmitted as is.
+        if (!gso_size || *L3_bytes <= hdr_len) return 1;
+
+        const uint64_t payload = *L3_bytes - hdr_len;
+        const uint64_t packets = gso_segs ? gso_segs : (payload + gso_size - 1) / gso_size;
+        *L3_bytes = hdr_len * packets + payload;
+        return packets;
+    }
+
+    if (*L3_bytes <= pmtu) return 1;
+
+    const int mss = pmtu - approx_hdr_len;
+    const uint64_t payload = *L3_bytes - approx_hdr_len;
+    const uint64_t packets = (payload + mss - 1) / mss;
+    *L3_bytes = approx_hdr_len * packets + payload;
+    return packets;
+}
+
 // ----- IPv6 Support -----
 
 DEFINE_BPF_MAP_GRW(tether_downstream6_map, HASH, TetherDownstream6Key, Tether6Value, 64,
@@ -69,10 +121,14 @@ DEFINE_BPF_MAP_GRW(tether_downstream64_map, HASH, TetherDownstream64Key, TetherD
 DEFINE_BPF_MAP_GRW(tether_upstream6_map, HASH, TetherUpstream6Key, Tether6Value, 64,
                    AID_NETWORK_STACK)
 
+// <sys/socket.h> cannot be included from bpf code
+#define AF_INET6 10
+
 static inline __always_inline int do_forward6(struct __sk_buff* skb,
                                               const struct rawip_bool rawip,
                                               const struct stream_bool stream,
-                                              __unused const struct kver_uint kver) {
+                                              const struct neigh_bool neigh,
+                                              const struct kver_uint kver) {
     const bool is_ethernet = !rawip.rawip;
 
     // Must be meta-ethernet IPv6 frame
@@ -81,6 +137,9 @@ static inline __always_inline int do_forward6(struct __sk_buff* skb,
     // Require ethernet dst mac address to be our unicast address.
     if (is_ethernet && (skb->pkt_type != PACKET_HOST)) return TC_ACT_PIPE;
 
+    if (!has_iif_rules(skb, stream.down ? TETHER_IIF_RULES_DOWNSTREAM6
+                                        : TETHER_IIF_RULES_UPSTREAM6)) return TC_ACT_PIPE;
+
     const int l2_header_size = is_ethernet ? sizeof(struct ethhdr) : 0;
 
     // Since the program never writes via DPA (direct packet access) auto-pull/unclone logic does
@@ -107,6 +166,9 @@ static inline __always_inline int do_forward6(struct __sk_buff* skb,
     // Let the kernel's stack handle these cases and generate appropriate ICMP errors.
     if (ip6->hop_limit <= 1) TC_PUNT(LOW_TTL);
 
+    // Size of the L3 & L4 headers repeated in every segment of a gso packet (0 if unknown).
+    uint32_t hdr_len = 0;
+
     // If hardware offload is running and programming flows based on conntrack entries,
     // try not to interfere with it.
     if (ip6->nexthdr == IPPROTO_TCP) {
@@ -118,6 +180,10 @@ static inline __always_inline int do_forward6(struct __sk_buff* skb,
 
         // Do not offload TCP packets with any one of the SYN/FIN/RST flags
         if (tcph->syn || tcph->fin || tcph->rst) TC_PUNT(TCPV6_CONTROL_PACKET);
+
+        hdr_len = sizeof(*ip6) + tcph->doff * 4;
+    } else if (ip6->nexthdr == IPPROTO_UDP) {
+        hdr_len = sizeof(*ip6) + sizeof(struct udphdr);
     }
 
     // Protect against forwarding packets sourced from ::1 or fe80::/64 or other weirdness.
@@ -169,22 +235,11 @@ static inline __always_inline int do_forward6(struct __sk_buff* skb,
     // Required IPv6 minimum mtu is 1280, below that not clear what we should do, abort...
     if (v->pmtu < IPV6_MIN_MTU) TC_PUNT(BELOW_IPV6_MTU);
 
-    // Approximate handling of TCP/IPv6 overhead for incoming LRO/GRO packets: default
-    // outbound path mtu of 1500 is not necessarily correct, but worst case we simply
-    // undercount, which is still better then not accounting for this overhead at all.
-    // Note: this really shouldn't be device/path mtu at all, but rather should be
-    // derived from this particular connection's mss (ie. from gro segment size).
-    // This would require a much newer kernel with newer ebpf accessors.
-    // (This is also blindly assuming 12 bytes of tcp timestamp option in tcp header)
-    uint64_t packets = 1;
+    // Account for the overhead of resegmenting incoming LRO/GRO packets.
+    const int tcp6_overhead = sizeof(struct ipv6hdr) + sizeof(struct tcphdr) + 12;
     uint64_t L3_bytes = skb->len - l2_header_size;
-    if (L3_bytes > v->pmtu) {
-        const int tcp6_overhead = sizeof(struct ipv6hdr) + sizeof(struct tcphdr) + 12;
-        const int mss = v->pmtu - tcp6_overhead;
-        const uint64_t payload = L3_bytes - tcp6_overhead;
-        packets = (payload + mss - 1) / mss;
-        L3_bytes = tcp6_overhead * packets + payload;
-    }
+    const uint64_t packets = count_tx_packets(skb, &L3_bytes, hdr_len, tcp6_overhead, v->pmtu,
+                                              kver);
 
     // Are we past the limit?  If so, then abort...
     // Note: will not overflow since u64 is 936 years even at 5Gbps.
@@ -194,6 +249,32 @@ static inline __always_inline int do_forward6(struct __sk_buff* skb,
     // since we don't offload all traffic in both directions)
     if (stat_v->rxBytes + stat_v->txBytes + L3_bytes > *limit_v) TC_PUNT(LIMIT_REACHED);
 
+    // With FIB_NEIGH the map entry's macHeader is ignored, and the next hop is instead resolved
+    // by the kernel for every packet, so neighbour (mac address) changes require no map updates.
+    // The lookup is done as if locally generated and sent out of v->oif, so that policy routing
+    // picks the same table as for the non-offloaded traffic.
+    struct bpf_fib_lookup fib = {
+            .family = AF_INET6,
+            .ifindex = v->oif,
+    };
+    long fib_rc = BPF_FIB_LKUP_RET_SUCCESS;
+    if (neigh.neigh) {
+        fib.flowinfo = *(__be32*)ip6 & htonl(0x0FFFFFFF);  // traffic class & flow label
+        __builtin_memcpy(fib.ipv6_src, &ip6->saddr, sizeof(fib.ipv6_src));
+        __builtin_memcpy(fib.ipv6_dst, &ip6->daddr, sizeof(fib.ipv6_dst));
+
+        // Note: this only reads from (and writes to) 'fib', so 'ip6' and friends remain valid.
+        fib_rc = bpf_fib_lookup(skb, &fib, sizeof(fib), BPF_FIB_LOOKUP_OUTPUT);
+
+        // NO_NEIGH means the route is fine, but the neighbour is not (yet) resolved,
+        // bpf_redirect_neigh() will take care of that by going through the neighbour subsystem.
+        // Anything else (no route, blackhole, mtu exceeded, etc.) is for the core stack to handle,
+        // as is the route pointing out of some other interface than the one userspace expects.
+        if (fib_rc != BPF_FIB_LKUP_RET_SUCCESS && fib_rc != BPF_FIB_LKUP_RET_NO_NEIGH)
+            TC_PUNT(FIB_LOOKUP_FAILED);
+        if (fib.ifindex != v->oif) TC_PUNT(FIB_LOOKUP_FAILED);
+    }
+
     if (!is_ethernet) {
         // Try to inject an ethernet header, and simply return if we fail.
         // We do this even if TX interface is RAWIP and thus does not need an ethernet header,
@@ -236,7 +317,25 @@ static inline __always_inline int do_forward6(struct __sk_buff* skb,
 
     // Overwrite any mac header with the new one
     // For a rawip tx interface it will simply be a bunch of zeroes and later stripped.
-    *eth = v->macHeader;
+    if (neigh.neigh) {
+        __builtin_memcpy(eth->h_dest, fib.dmac, ETH_ALEN);
+        __builtin_memcpy(eth->h_source, fib.smac, ETH_ALEN);
+        eth->h_proto = htons(ETH_P_IPV6);
+    } else {
+        *eth = v->macHeader;
+    }
+
+    // bpf_redirect_neigh() drops packets without a mac header, but otherwise strips it and
+    // builds the real L2 header itself once the neighbour resolves.  The (all zero, since
+    // the lookup did not fill in the mac addresses) ethernet header above is thus fine.
+    if (fib_rc == BPF_FIB_LKUP_RET_NO_NEIGH) {
+        struct bpf_redir_neigh nh = {
+                .nh_family = AF_INET6,
+        };
+        // Even with NO_NEIGH the lookup leaves the gateway (or on-link destination) in ipv6_dst.
+        __builtin_memcpy(nh.ipv6_nh, fib.ipv6_dst, sizeof(nh.ipv6_nh));
+        return bpf_redirect_neigh(v->oif, &nh, sizeof(nh), 0);
+    }
 
     // Redirect to forwarded interface.
     //
@@ -247,22 +346,48 @@ static inline __always_inline int do_forward6(struct __sk_buff* skb,
     return bpf_redirect(v->oif, 0 /* this is effectively BPF_F_EGRESS */);
 }
 
-DEFINE_BPF_PROG("schedcls/tether_downstream6_ether", AID_ROOT, AID_NETWORK_STACK,
-                sched_cls_tether_downstream6_ether)
+// Note: section names must be unique to prevent programs from appending to each other,
+// so instead the bpf loader will strip everything past the final $ symbol when actually
+// pinning the program into the filesystem.
+
+// 5.8+ kernels: gso aware stats and limit accounting
+DEFINE_BPF_PROG_KVER("schedcls/tether_downstream6_ether$5_8", AID_ROOT, AID_NETWORK_STACK,
+                     sched_cls_tether_downstream6_ether_5_8, KVER_5_8)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, ETHER, DOWNSTREAM, STATIC_MAC, KVER_5_8);
+}
+
+DEFINE_BPF_PROG_KVER("schedcls/tether_upstream6_ether$5_8", AID_ROOT, AID_NETWORK_STACK,
+                     sched_cls_tether_upstream6_ether_5_8, KVER_5_8)
 (struct __sk_buff* skb) {
-    return do_forward6(skb, ETHER, DOWNSTREAM, KVER_NONE);
+    return do_forward6(skb, ETHER, UPSTREAM, STATIC_MAC, KVER_5_8);
 }
 
-DEFINE_BPF_PROG("schedcls/tether_upstream6_ether", AID_ROOT, AID_NETWORK_STACK,
-                sched_cls_tether_upstream6_ether)
+DEFINE_BPF_PROG_KVER("schedcls/tether_downstream6_rawip$5_8", AID_ROOT, AID_NETWORK_STACK,
+                     sched_cls_tether_downstream6_rawip_5_8, KVER_5_8)
 (struct __sk_buff* skb) {
-    return do_forward6(skb, ETHER, UPSTREAM, KVER_NONE);
+    return do_forward6(skb, RAWIP, DOWNSTREAM, STATIC_MAC, KVER_5_8);
+}
+
+DEFINE_BPF_PROG_KVER("schedcls/tether_upstream6_rawip$5_8", AID_ROOT, AID_NETWORK_STACK,
+                     sched_cls_tether_upstream6_rawip_5_8, KVER_5_8)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, RAWIP, UPSTREAM, STATIC_MAC, KVER_5_8);
+}
+
+// Older kernels estimate the gso segmentation from the path mtu instead.
+DEFINE_BPF_PROG_KVER_RANGE("schedcls/tether_downstream6_ether$4_9", AID_ROOT, AID_NETWORK_STACK,
+                           sched_cls_tether_downstream6_ether_4_9, KVER_NONE, KVER_5_8)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, ETHER, DOWNSTREAM, STATIC_MAC, KVER_NONE);
+}
+
+DEFINE_BPF_PROG_KVER_RANGE("schedcls/tether_upstream6_ether$4_9", AID_ROOT, AID_NETWORK_STACK,
+                           sched_cls_tether_upstream6_ether_4_9, KVER_NONE, KVER_5_8)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, ETHER, UPSTREAM, STATIC_MAC, KVER_NONE);
 }
 
-// Note: section names must be unique to prevent programs from appending to each other,
-// so instead the bpf loader will strip everything past the final $ symbol when actually
-// pinning the program into the filesystem.
-//
 // bpf_skb_change_head() is only present on 4.14+ and 2 trivial kernel patches are needed:
 //   ANDROID: net: bpf: Allow TC programs to call BPF_FUNC_skb_change_head
 //   ANDROID: net: bpf: permit redirect from ingress L3 to egress L2 devices at near max mtu
@@ -272,17 +397,18 @@ DEFINE_BPF_PROG("schedcls/tether_upstream6_ether", AID_ROOT, AID_NETWORK_STACK,
 // and there is a test in kernel/tests/net/test/bpf_test.py testSkbChangeHead()
 // and in system/netd/tests/binder_test.cpp NetdBinderTest TetherOffloadForwarding.
 //
-// Hence, these mandatory (must load successfully) implementations for 4.14+ kernels:
-DEFINE_BPF_PROG_KVER("schedcls/tether_downstream6_rawip$4_14", AID_ROOT, AID_NETWORK_STACK,
-                     sched_cls_tether_downstream6_rawip_4_14, KVER_4_14)
+// Hence, these mandatory (must load successfully) implementations for 4.14+ kernels
+// (in addition to the 5.8+ ones above):
+DEFINE_BPF_PROG_KVER_RANGE("schedcls/tether_downstream6_rawip$4_14", AID_ROOT, AID_NETWORK_STACK,
+                           sched_cls_tether_downstream6_rawip_4_14, KVER_4_14, KVER_5_8)
 (struct __sk_buff* skb) {
-    return do_forward6(skb, RAWIP, DOWNSTREAM, KVER_4_14);
+    return do_forward6(skb, RAWIP, DOWNSTREAM, STATIC_MAC, KVER_4_14);
 }
 
-DEFINE_BPF_PROG_KVER("schedcls/tether_upstream6_rawip$4_14", AID_ROOT, AID_NETWORK_STACK,
-                     sched_cls_tether_upstream6_rawip_4_14, KVER_4_14)
+DEFINE_BPF_PROG_KVER_RANGE("schedcls/tether_upstream6_rawip$4_14", AID_ROOT, AID_NETWORK_STACK,
+                           sched_cls_tether_upstream6_rawip_4_14, KVER_4_14, KVER_5_8)
 (struct __sk_buff* skb) {
-    return do_forward6(skb, RAWIP, UPSTREAM, KVER_4_14);
+    return do_forward6(skb, RAWIP, UPSTREAM, STATIC_MAC, KVER_4_14);
 }
 
 // and define no-op stubs for pre-4.14 kernels.
@@ -298,17 +424,58 @@ DEFINE_BPF_PROG_KVER_RANGE("schedcls/tether_upstream6_rawip$stub", AID_ROOT, AID
     return TC_ACT_PIPE;
 }
 
+// Variants resolving the next hop via bpf_fib_lookup() & bpf_redirect_neigh(), for which the
+// mac addresses in the tether6 map entries are ignored.  These are optional, and userspace
+// falls back to the above static mac programs when they are not available.
+//
+// bpf_redirect_neigh() with nexthop parameters requires 5.10+
+DEFINE_OPTIONAL_BPF_PROG_KVER("schedcls/tether_downstream6_ether_neigh$5_10", AID_ROOT,
+                              AID_NETWORK_STACK, sched_cls_tether_downstream6_ether_neigh_5_10,
+                              KVER_5_10)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, ETHER, DOWNSTREAM, FIB_NEIGH, KVER_5_10);
+}
+
+DEFINE_OPTIONAL_BPF_PROG_KVER("schedcls/tether_upstream6_ether_neigh$5_10", AID_ROOT,
+                              AID_NETWORK_STACK, sched_cls_tether_upstream6_ether_neigh_5_10,
+                              KVER_5_10)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, ETHER, UPSTREAM, FIB_NEIGH, KVER_5_10);
+}
+
+DEFINE_OPTIONAL_BPF_PROG_KVER("schedcls/tether_downstream6_rawip_neigh$5_10", AID_ROOT,
+                              AID_NETWORK_STACK, sched_cls_tether_downstream6_rawip_neigh_5_10,
+                              KVER_5_10)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, RAWIP, DOWNSTREAM, FIB_NEIGH, KVER_5_10);
+}
+
+DEFINE_OPTIONAL_BPF_PROG_KVER("schedcls/tether_upstream6_rawip_neigh$5_10", AID_ROOT,
+                              AID_NETWORK_STACK, sched_cls_tether_upstream6_rawip_neigh_5_10,
+                              KVER_5_10)
+(struct __sk_buff* skb) {
+    return do_forward6(skb, RAWIP, UPSTREAM, FIB_NEIGH, KVER_5_10);
+}
+
 // ----- IPv4 Support -----
 
-DEFINE_BPF_MAP_GRW(tether_downstream4_map, HASH, Tether4Key, Tether4Value, 1024, AID_NETWORK_STACK)
+// These may be resized to anywhere within [256, 16384] entries at load time.
+DEFINE_BPF_RESIZABLE_MAP_GRW(tether_downstream4_map, HASH, Tether4Key, Tether4Value, 1024, 2, 4,
+                             AID_NETWORK_STACK)
 
-DEFINE_BPF_MAP_GRW(tether_upstream4_map, HASH, Tether4Key, Tether4Value, 1024, AID_NETWORK_STACK)
+DEFINE_BPF_RESIZABLE_MAP_GRW(tether_upstream4_map, HASH, Tether4Key, Tether4Value, 1024, 2, 4,
+                             AID_NETWORK_STACK)
+
+// Only used for rules with TETHER4_FLAG_FLOW_STATS set, both directions share the map.
+// LRU so that the counters of finished flows linger until the space is actually needed.
+DEFINE_BPF_MAP_GRW(tether_flow4_stats_map, LRU_PERCPU_HASH, Tether4Key, Tether4FlowStatsValue,
+                   2048, AID_NETWORK_STACK)
 
 static inline __always_inline int do_forward4_bottom(struct __sk_buff* skb,
         const int l2_header_size, void* data, const void* data_end,
         struct ethhdr* eth, struct iphdr* ip, const struct rawip_bool rawip,
         const struct stream_bool stream, const struct updatetime_bool updatetime,
-        const bool is_tcp, __unused const struct kver_uint kver) {
+        const bool is_tcp, const struct kver_uint kver) {
     const bool is_ethernet = !rawip.rawip;
     struct tcphdr* tcph = is_tcp ? (void*)(ip + 1) : NULL;
     struct udphdr* udph = is_tcp ? NULL : (void*)(ip + 1);
@@ -388,22 +555,13 @@ static inline __always_inline int do_forward4_bottom(struct __sk_buff* skb,
     // Required IPv4 minimum mtu is 68, below that not clear what we should do, abort...
     if (v->pmtu < 68) TC_PUNT(BELOW_IPV4_MTU);
 
-    // Approximate handling of TCP/IPv4 overhead for incoming LRO/GRO packets: default
-    // outbound path mtu of 1500 is not necessarily correct, but worst case we simply
-    // undercount, which is still better then not accounting for this overhead at all.
-    // Note: this really shouldn't be device/path mtu at all, but rather should be
-    // derived from this particular connection's mss (ie. from gro segment size).
-    // This would require a much newer kernel with newer ebpf accessors.
-    // (This is also blindly assuming 12 bytes of tcp timestamp option in tcp header)
-    uint64_t packets = 1;
+    // Account for the overhead of resegmenting incoming LRO/GRO packets.
+    // (IP options have already been ruled out, so the IPv4 header is always 20 bytes)
+    const int tcp4_overhead = sizeof(struct iphdr) + sizeof(struct tcphdr) + 12;
+    const uint32_t hdr_len = sizeof(*ip) + (is_tcp ? tcph->doff * 4 : sizeof(*udph));
     uint64_t L3_bytes = skb->len - l2_header_size;
-    if (L3_bytes > v->pmtu) {
-        const int tcp4_overhead = sizeof(struct iphdr) + sizeof(struct tcphdr) + 12;
-        const int mss = v->pmtu - tcp4_overhead;
-        const uint64_t payload = L3_bytes - tcp4_overhead;
-        packets = (payload + mss - 1) / mss;
-        L3_bytes = tcp4_overhead * packets + payload;
-    }
+    const uint64_t packets = count_tx_packets(skb, &L3_bytes, hdr_len, tcp4_overhead, v->pmtu,
+                                              kver);
 
     // Are we past the limit?  If so, then abort...
     // Note: will not overflow since u64 is 936 years even at 5Gbps.
@@ -445,50 +603,57 @@ static inline __always_inline int do_forward4_bottom(struct __sk_buff* skb,
     // For a rawip tx interface it will simply be a bunch of zeroes and later stripped.
     *eth = v->macHeader;
 
-    // Decrement the IPv4 TTL, we already know it's greater than 1.
-    // u8 TTL field is followed by u8 protocol to make a u16 for ipv4 header checksum update.
-    // Since we're keeping the ipv4 checksum valid (which means the checksum of the entire
-    // ipv4 header remains 0), the overall checksum of the entire packet does not change.
-    const int sz2 = sizeof(__be16);
-    const __be16 old_ttl_proto = *(__be16 *)&ip->ttl;
-    const __be16 new_ttl_proto = old_ttl_proto - htons(0x0100);
-    bpf_l3_csum_replace(skb, ETH_IP4_OFFSET(check), old_ttl_proto, new_ttl_proto, sz2);
-    bpf_skb_store_bytes(skb, ETH_IP4_OFFSET(ttl), &new_ttl_proto, sz2, 0);
+    // Rewrite the packet in place: decrement the IPv4 TTL (we already know it's greater
+    // than 1), then translate the addresses and ports.  The checksums are fixed up afterwards.
+    --ip->ttl;
+    ip->saddr = v->src46.s6_addr32[3];
+    ip->daddr = v->dst46.s6_addr32[3];
+    if (is_tcp) {
+        tcph->source = v->srcPort;
+        tcph->dest = v->dstPort;
+    } else {
+        udph->source = v->srcPort;
+        udph->dest = v->dstPort;
+    }
 
+    // The translation of a flow is fixed, so userspace precomputed its checksum deltas when it
+    // installed the rule, and applying them is a single helper call per checksum.
+    //
+    // The L4 pseudo header and port deltas are kept apart, because for CHECKSUM_PARTIAL
+    // packets the L4 checksum field only covers the pseudo header, and the port delta must
+    // then not be applied (nor may it be folded into skb->csum for CHECKSUM_COMPLETE).
+    // Note that these helpers invalidate all packet pointers, hence they go last.
     const int l4_offs_csum = is_tcp ? ETH_IP4_TCP_OFFSET(check) : ETH_IP4_UDP_OFFSET(check);
-    const int sz4 = sizeof(__be32);
     // UDP 0 is special and stored as FFFF (this flag also causes a csum of 0 to be unmodified)
     const int l4_flags = is_tcp ? 0 : BPF_F_MARK_MANGLED_0;
-    const __be32 old_daddr = k.dst4.s_addr;
-    const __be32 old_saddr = k.src4.s_addr;
-    const __be32 new_daddr = v->dst46.s6_addr32[3];
-    const __be32 new_saddr = v->src46.s6_addr32[3];
-
-    bpf_l4_csum_replace(skb, l4_offs_csum, old_daddr, new_daddr, sz4 | BPF_F_PSEUDO_HDR | l4_flags);
-    bpf_l3_csum_replace(skb, ETH_IP4_OFFSET(check), old_daddr, new_daddr, sz4);
-    bpf_skb_store_bytes(skb, ETH_IP4_OFFSET(daddr), &new_daddr, sz4, 0);
-
-    bpf_l4_csum_replace(skb, l4_offs_csum, old_saddr, new_saddr, sz4 | BPF_F_PSEUDO_HDR | l4_flags);
-    bpf_l3_csum_replace(skb, ETH_IP4_OFFSET(check), old_saddr, new_saddr, sz4);
-    bpf_skb_store_bytes(skb, ETH_IP4_OFFSET(saddr), &new_saddr, sz4, 0);
-
-    // The offsets for TCP and UDP ports: source (u16 @ L4 offset 0) & dest (u16 @ L4 offset 2) are
-    // actually the same, so the compiler should just optimize them both down to a constant.
-    bpf_l4_csum_replace(skb, l4_offs_csum, k.srcPort, v->srcPort, sz2 | l4_flags);
-    bpf_skb_store_bytes(skb, is_tcp ? ETH_IP4_TCP_OFFSET(source) : ETH_IP4_UDP_OFFSET(source),
-                        &v->srcPort, sz2, 0);
-
-    bpf_l4_csum_replace(skb, l4_offs_csum, k.dstPort, v->dstPort, sz2 | l4_flags);
-    bpf_skb_store_bytes(skb, is_tcp ? ETH_IP4_TCP_OFFSET(dest) : ETH_IP4_UDP_OFFSET(dest),
-                        &v->dstPort, sz2, 0);
+    bpf_l3_csum_replace(skb, ETH_IP4_OFFSET(check), 0, v->l3CsumDelta, 0);
+    bpf_l4_csum_replace(skb, l4_offs_csum, 0, v->l4PseudoCsumDelta, BPF_F_PSEUDO_HDR | l4_flags);
+    bpf_l4_csum_replace(skb, l4_offs_csum, 0, v->l4PortsCsumDelta, l4_flags);
 
     // This requires the bpf_ktime_get_boot_ns() helper which was added in 5.8,
     // and backported to all Android Common Kernel 4.14+ trees.
-    if (updatetime.updatetime) v->last_used = bpf_ktime_get_boot_ns();
+    if (updatetime.updatetime) {
+        const uint64_t now = bpf_ktime_get_boot_ns();
+        // Reading is free (the rest of the cache line was needed above), writing is not.
+        if (now - v->last_used >= TETHER4_LAST_USED_GRANULARITY_NS) v->last_used = now;
+    }
 
     __sync_fetch_and_add(stream.down ? &stat_v->rxPackets : &stat_v->txPackets, packets);
     __sync_fetch_and_add(stream.down ? &stat_v->rxBytes : &stat_v->txBytes, L3_bytes);
 
+    if (v->flags & TETHER4_FLAG_FLOW_STATS) {
+        // The value is this cpu's own copy, so plain (non-atomic) adds are safe.
+        Tether4FlowStatsValue* flow_v = bpf_tether_flow4_stats_map_lookup_elem(&k);
+        if (flow_v) {
+            flow_v->packets += packets;
+            flow_v->bytes += L3_bytes;
+        } else {
+            // Initializes this cpu's copy, the other cpus' copies start out zeroed.
+            const Tether4FlowStatsValue new_v = { .packets = packets, .bytes = L3_bytes };
+            bpf_tether_flow4_stats_map_update_elem(&k, &new_v, BPF_NOEXIST);
+        }
+    }
+
     // Redirect to forwarded interface.
     //
     // Note that bpf_redirect() cannot fail unless you pass invalid flags.
@@ -511,6 +676,9 @@ static inline __always_inline int do_forward4(struct __sk_buff* skb,
     // Must be meta-ethernet IPv4 frame
     if (skb->protocol != htons(ETH_P_IP)) return TC_ACT_PIPE;
 
+    if (!has_iif_rules(skb, stream.down ? TETHER_IIF_RULES_DOWNSTREAM4
+                                        : TETHER_IIF_RULES_UPSTREAM4)) return TC_ACT_PIPE;
+
     const int l2_header_size = is_ethernet ? sizeof(struct ethhdr) : 0;
 
     // Since the program never writes via DPA (direct packet access) auto-pull/unclone logic does
@@ -53,6 +53,7 @@
     ERR(SHORT_UDP_HEADER)     \
     ERR(UDP_CSUM_ZERO)        \
     ERR(TRUNCATED_IPV4)       \
+    ERR(FIB_LOOKUP_FAILED)    \
     ERR(_MAX)
 
 #define ERR(x) BPF_TETHER_ERR_ ##x,
@@ -90,6 +91,16 @@ STRUCT_SIZE(TetherStatsValue, 6 * 8);  // 48
 typedef uint32_t TetherLimitKey;    // upstream ifindex
 typedef uint64_t TetherLimitValue;  // in bytes
 
+// Bitmask of which forwarding maps currently hold rules for packets coming in on an interface,
+// indexed by (input) ifindex.  Interfaces without an entry have no rules in any of them.
+typedef uint32_t TetherIifRulesKey;    // input ifindex
+typedef uint32_t TetherIifRulesValue;  // TETHER_IIF_RULES_* bits
+
+#define TETHER_IIF_RULES_DOWNSTREAM6 (1 << 0)  // tether_downstream6_map, iif is upstream
+#define TETHER_IIF_RULES_UPSTREAM6   (1 << 1)  // tether_upstream6_map, iif is downstream
+#define TETHER_IIF_RULES_DOWNSTREAM4 (1 << 2)  // tether_downstream4_map, iif is upstream
+#define TETHER_IIF_RULES_UPSTREAM4   (1 << 3)  // tether_upstream4_map, iif is downstream
+
 // For now tethering offload only needs to support downstreams that use 6-byte MAC addresses,
 // because all downstream types that are currently supported (WiFi, USB, Bluetooth and
 // Ethernet) have 6-byte MAC addresses.
@@ -159,8 +170,30 @@ typedef struct {
     struct in6_addr dst46;    // destination IP addresses (may be IPv4 mapped or IPv6 for upstream)
     __be16 srcPort;           // source &
     __be16 dstPort;           // destination tcp/udp/... ports
-    uint64_t last_used;       // Kernel updates on each use with bpf_ktime_get_boot_ns()
+    uint64_t last_used;       // Kernel updates on use with bpf_ktime_get_boot_ns(), see below
+    __be16 l3CsumDelta;       // Ones' complement checksum deltas of the translation, computed
+    __be16 l4PseudoCsumDelta; // by userspace: IPv4 header (addresses & TTL decrement), L4
+    __be16 l4PortsCsumDelta;  // pseudo header (addresses) and L4 header (ports)
+    uint16_t flags;           // TETHER4_FLAG_*
 } Tether4Value;
-STRUCT_SIZE(Tether4Value, 4 + 14 + 2 + 16 + 16 + 2 + 2 + 8);  // 64
+STRUCT_SIZE(Tether4Value, 4 + 14 + 2 + 16 + 16 + 2 + 2 + 8 + 2 + 2 + 2 + 2);  // 72
+
+// Count the flow's packets and bytes in tether_flow4_stats_map.
+#define TETHER4_FLAG_FLOW_STATS 1
+
+// Per flow counters, keyed by the Tether4Key of the rule the packets matched.
+// The map is per-cpu, so that the counters can be updated without atomics or
+// cache line bouncing: userspace needs to sum the values across all cpus.
+typedef struct {
+    uint64_t packets;
+    uint64_t bytes;
+} Tether4FlowStatsValue;
+STRUCT_SIZE(Tether4FlowStatsValue, 8 + 8);  // 16
+
+// Tether4Value.last_used is only rewritten once it is at least this much older than the
+// current time, since the write dirties the value's cache line for every other cpu forwarding
+// packets of the same flow.  Userspace only cares whether a rule was used within the last
+// minute (see BpfCoordinator's CONNTRACK_TIMEOUT_UPDATE_INTERVAL_MS), so this is plenty.
+#define TETHER4_LAST_USED_GRANULARITY_NS (1000 * 1000 * 1000ULL)  // 1 second
 
 #undef STRUCT_SIZE
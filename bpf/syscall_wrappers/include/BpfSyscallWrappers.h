@@ -117,6 +117,26 @@ inline int getFirstMapKey(const BPF_FD_TYPE map_fd, void* firstKey) {
     return getNextMapKey(map_fd, NULL, firstKey);
 }
 
+// Reads up to *count entries from the start of the map with a single syscall (5.6+ kernels).
+// 'out_batch' receives an opaque position cookie and must be key_size bytes large.
+// On return *count holds the number of entries actually copied into keys[] and values[],
+// this is also the case on failure with ENOENT, which just means the map ran out of entries.
+inline int lookupMapBatch(const BPF_FD_TYPE map_fd, void* out_batch, void* keys, void* values,
+                          uint32_t* count) {
+    bpf_attr attr = {
+            .batch = {
+                    .out_batch = ptr_to_u64(out_batch),
+                    .keys = ptr_to_u64(keys),
+                    .values = ptr_to_u64(values),
+                    .count = *count,
+                    .map_fd = BPF_FD_TO_U32(map_fd),
+            },
+    };
+    int ret = bpf(BPF_MAP_LOOKUP_BATCH, &attr);
+    *count = attr.batch.count;
+    return ret;
+}
+
 inline int bpfFdPin(const BPF_FD_TYPE map_fd, const char* pathname) {
     return bpf(BPF_OBJ_PIN, {
                                     .pathname = ptr_to_u64(pathname),
@@ -246,6 +266,22 @@ inline int detachSingleProgram(bpf_attach_type type, const BPF_FD_TYPE prog_fd,
                                 });
 }
 
+// Available in 5.7 and later kernels, but which attach types support links varies
+// (for example BPF_TCX_INGRESS/EGRESS requires 6.6+).  Returns the link fd, the program is
+// detached once the last reference to it is closed.  'target' is an fd or an ifindex,
+// depending on the attach type.
+inline int createLink(bpf_attach_type type, const BPF_FD_TYPE prog_fd, const uint32_t target,
+                      uint32_t flags = 0) {
+    return bpf(BPF_LINK_CREATE, {
+                                        .link_create = {
+                                                .prog_fd = BPF_FD_TO_U32(prog_fd),
+                                                .target_fd = target,
+                                                .attach_type = type,
+                                                .flags = flags,
+                                        },
+                                });
+}
+
 // Available in 4.12 and later kernels.
 inline int runProgram(const BPF_FD_TYPE prog_fd, const void* data,
                       const uint32_t data_size) {
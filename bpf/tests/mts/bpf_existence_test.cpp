@@ -62,6 +62,8 @@ static const set<string> MAINLINE_FOR_S_PLUS = {
     TETHERING "map_offload_tether_downstream64_map",
     TETHERING "map_offload_tether_downstream6_map",
     TETHERING "map_offload_tether_error_map",
+    TETHERING "map_offload_tether_flow4_stats_map",
+    TETHERING "map_offload_tether_iif_rules_map",
     TETHERING "map_offload_tether_limit_map",
     TETHERING "map_offload_tether_stats_map",
     TETHERING "map_offload_tether_upstream4_map",
@@ -86,6 +88,7 @@ static const set<string> MAINLINE_FOR_T_PLUS = {
     SHARED "map_clatd_clat_ingress6_map",
     SHARED "map_dscpPolicy_ipv4_dscp_policies_map",
     SHARED "map_dscpPolicy_ipv6_dscp_policies_map",
+    SHARED "map_dscpPolicy_policy_generation_map",
     SHARED "map_dscpPolicy_socket_policy_cache_map",
     NETD "map_netd_app_uid_stats_map",
     NETD "map_netd_blocked_ports_map",
@@ -95,10 +98,13 @@ static const set<string> MAINLINE_FOR_T_PLUS = {
     NETD "map_netd_iface_index_name_map",
     NETD "map_netd_iface_stats_map",
     NETD "map_netd_ingress_discard_map",
+    NETD "map_netd_ingress_ratelimit_map",
     NETD "map_netd_stats_map_A",
     NETD "map_netd_stats_map_B",
+    NETD "map_netd_stats_update_error_map",
     NETD "map_netd_uid_counterset_map",
     NETD "map_netd_uid_owner_map",
+    NETD "map_netd_uid_owner_map_B",
     NETD "map_netd_uid_permission_map",
     SHARED "prog_clatd_schedcls_egress4_clat_rawip",
     SHARED "prog_clatd_schedcls_ingress6_clat_ether",
@@ -106,6 +112,8 @@ static const set<string> MAINLINE_FOR_T_PLUS = {
     NETD "prog_netd_cgroupskb_egress_stats",
     NETD "prog_netd_cgroupskb_ingress_stats",
     NETD "prog_netd_schedact_ingress_account",
+    NETD "prog_netd_schedcls_ingress_ratelimit_ether",
+    NETD "prog_netd_schedcls_ingress_ratelimit_rawip",
     NETD "prog_netd_skfilter_allowlist_xtbpf",
     NETD "prog_netd_skfilter_denylist_xtbpf",
     NETD "prog_netd_skfilter_egress_xtbpf",
@@ -131,6 +139,7 @@ static const set<string> MAINLINE_FOR_T_5_10_PLUS = {
 // Provided by *current* mainline module for T+ devices with 5.15+ kernels
 static const set<string> MAINLINE_FOR_T_5_15_PLUS = {
     SHARED "prog_dscpPolicy_schedcls_set_dscp_ether",
+    SHARED "prog_dscpPolicy_schedcls_set_dscp_rawip",
 };
 
 // Provided by *current* mainline module for U+ devices
@@ -0,0 +1,994 @@
+/*
+ * Copyright 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * bpf_prog_run_test.cpp - runs the mainline BPF programs over crafted packets with
+ * BPF_PROG_TEST_RUN, and checks the packets they produce and their map side effects
+ *
+ * The kernel builds the test skb of a sched_cls program from an ethernet frame received on
+ * the loopback interface, so only the ethernet variants of the programs can be run, and the
+ * map entries they need are keyed by the loopback ifindex (which real rules never use).
+ *
+ * The next hop lookups of the tether6 _neigh programs are done out of a tap interface, since
+ * routes out of the loopback interface are turned into reject routes by the kernel.
+ *
+ * Not covered, since a test run cannot reach them:
+ *  - clatd's computation of missing UDP checksums: it is done by the egress4 program, which
+ *    only exists as a rawip variant (the v4- tun interface has no ethernet header).
+ */
+
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/ip.h>
+#include <linux/if_tun.h>
+#include <linux/ipv6.h>
+#include <linux/neighbour.h>
+#include <linux/netlink.h>
+#include <linux/pkt_cls.h>
+#include <linux/rtnetlink.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <fcntl.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/result-gmock.h>
+#include <android-base/unique_fd.h>
+#include <bpf/BpfMap.h>
+#include <bpf/BpfUtils.h>
+#include <gtest/gtest.h>
+
+#include "clat_mark.h"
+#include "clatd.h"
+#include "netd.h"
+#include "offload.h"
+
+using android::base::unique_fd;
+using android::base::WriteStringToFile;
+using android::bpf::BpfMap;
+using android::bpf::isAtLeastKernelVersion;
+
+#define SHARED "/sys/fs/bpf/net_shared/"
+#define TETHERING "/sys/fs/bpf/tethering/"
+
+namespace {
+
+// From <netinet/ip.h>, which clashes with <linux/ip.h>.
+constexpr uint16_t kIpDf = 0x4000;  // Don't Fragment
+constexpr uint16_t kIpMf = 0x2000;  // More Fragments
+
+// The values of the 2-bit ECN field, see RFC 3168.
+constexpr uint8_t kEcnNotEct = 0;
+constexpr uint8_t kEcnEct1 = 1;
+constexpr uint8_t kEcnEct0 = 2;
+constexpr uint8_t kEcnCe = 3;
+
+using Packet = std::vector<uint8_t>;
+
+template <typename T>
+void append(Packet* packet, const T& hdr) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&hdr);
+    packet->insert(packet->end(), bytes, bytes + sizeof(hdr));
+}
+
+template <typename T>
+T readAt(const Packet& packet, size_t offset) {
+    T hdr = {};
+    if (offset + sizeof(hdr) <= packet.size()) memcpy(&hdr, packet.data() + offset, sizeof(hdr));
+    return hdr;
+}
+
+// Returns the 32-bit ones' complement sum of the 16-bit words (in memory byte order) of |data|.
+uint32_t csumPartial(const void* data, size_t len, uint32_t sum = 0) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        uint16_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        sum += word;
+    }
+    if (len & 1) {
+        uint16_t word = 0;
+        memcpy(&word, bytes + len - 1, 1);
+        sum += word;
+    }
+    return sum;
+}
+
+// Folds a ones' complement sum into 16 bits.
+uint16_t csumFold(uint32_t sum) {
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+// Returns the ones' complement checksum delta of rewriting |len| bytes from |from| to |to|.
+uint16_t csumDiff(const void* from, const void* to, size_t len) {
+    Packet inverted(static_cast<const uint8_t*>(from), static_cast<const uint8_t*>(from) + len);
+    for (uint8_t& b : inverted) b = ~b;
+    return csumFold(csumPartial(to, len, csumPartial(inverted.data(), len)));
+}
+
+// Returns CLOCK_MONOTONIC, the clock of bpf_ktime_get_ns(), in nanoseconds.
+uint64_t monotonicNs() {
+    timespec ts;
+    EXPECT_EQ(0, clock_gettime(CLOCK_MONOTONIC, &ts));
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Returns CLOCK_BOOTTIME, the clock of bpf_ktime_get_boot_ns(), in nanoseconds.
+uint64_t bootTimeNs() {
+    timespec ts;
+    EXPECT_EQ(0, clock_gettime(CLOCK_BOOTTIME, &ts));
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+in6_addr ipv6(const char* addr) {
+    in6_addr a;
+    EXPECT_EQ(1, inet_pton(AF_INET6, addr, &a)) << addr;
+    return a;
+}
+
+in_addr ipv4(const char* addr) {
+    in_addr a;
+    EXPECT_EQ(1, inet_pton(AF_INET, addr, &a)) << addr;
+    return a;
+}
+
+in6_addr ipv4Mapped(const char* addr) {
+    in6_addr a = {};
+    a.s6_addr32[2] = htonl(0xFFFF);
+    a.s6_addr32[3] = ipv4(addr).s_addr;
+    return a;
+}
+
+// The result of running a program once.
+struct ProgRun {
+    uint32_t retval;
+    Packet packet;
+    __sk_buff ctx;
+};
+
+class BpfProgRunTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        mLoopbackIfindex = if_nametoindex("lo");
+        ASSERT_NE(0U, mLoopbackIfindex);
+    }
+
+    // Retrieves the program pinned at |path|, skipping the test if the device doesn't have it.
+    void retrieve(const char* path) {
+        mProg.reset(android::bpf::retrieveProgram(path));
+        if (mProg < 0) GTEST_SKIP() << path << " is not loaded on this device";
+    }
+
+    // Runs the program over |packet|, which must start with an ethernet header.  The __sk_buff
+    // fields the kernel allows to be set for a test run (eg. gso_size) are taken from |ctxIn|.
+    ProgRun run(const Packet& packet, const __sk_buff& ctxIn = {}) {
+        ProgRun result = {.packet = Packet(packet.size() + 256), .ctx = ctxIn};
+        bpf_attr attr = {};
+        attr.test.prog_fd = mProg.get();
+        attr.test.data_in = reinterpret_cast<uint64_t>(packet.data());
+        attr.test.data_size_in = packet.size();
+        attr.test.data_out = reinterpret_cast<uint64_t>(result.packet.data());
+        attr.test.data_size_out = result.packet.size();
+        attr.test.ctx_in = reinterpret_cast<uint64_t>(&ctxIn);
+        attr.test.ctx_size_in = sizeof(ctxIn);
+        attr.test.ctx_out = reinterpret_cast<uint64_t>(&result.ctx);
+        attr.test.ctx_size_out = sizeof(result.ctx);
+        EXPECT_EQ(0, android::bpf::bpf(BPF_PROG_TEST_RUN, &attr)) << strerror(errno);
+        result.retval = attr.test.retval;
+        result.packet.resize(attr.test.data_size_out);
+        return result;
+    }
+
+    uint32_t mLoopbackIfindex;
+    unique_fd mProg;
+};
+
+// ----- clatd: schedcls/ingress6/clat_ether -----
+
+class ClatIngress6Test : public BpfProgRunTest {
+  protected:
+    void SetUp() override {
+        BpfProgRunTest::SetUp();
+        // Extension headers are only stripped by the 4.14+ program.
+        if (!isAtLeastKernelVersion(4, 14, 0)) GTEST_SKIP() << "Requires a 4.14+ kernel";
+        retrieve(SHARED "prog_clatd_schedcls_ingress6_clat_ether");
+        if (IsSkipped()) return;
+        ASSERT_RESULT_OK(mMap.init(SHARED "map_clatd_clat_ingress6_map"));
+
+        mKey = {.iif = mLoopbackIfindex, .pfx96 = ipv6("64:ff9b::"), .local6 = ipv6(kLocal6)};
+        const ClatIngress6Value value = {.oif = 0, .local4 = ipv4(kLocal4)};
+        ASSERT_RESULT_OK(mMap.writeValue(mKey, value, BPF_ANY));
+    }
+
+    void TearDown() override {
+        if (mMap.isValid()) {
+            EXPECT_RESULT_OK(mMap.deleteValue(mKey));
+        }
+    }
+
+    static constexpr const char* kRemote6 = "64:ff9b::c000:201";  // 192.0.2.1
+    static constexpr const char* kLocal6 = "2001:db8::a";
+    static constexpr const char* kLocal4 = "192.0.0.4";
+
+    // An 8 byte hop-by-hop or destination options header holding a single PadN option.
+    static Packet optionsHdr(uint8_t next) { return {next, 0, 1, 4, 0, 0, 0, 0}; }
+
+    static Packet routingHdr(uint8_t next, uint8_t segmentsLeft) {
+        return {next, 0, 253 /* experimental routing type */, segmentsLeft, 0, 0, 0, 0};
+    }
+
+    static Packet fragmentHdr(uint8_t next, uint16_t fragOff, uint32_t id) {
+        Packet hdr = {next, 0};
+        append(&hdr, htons(fragOff));
+        append(&hdr, htonl(id));
+        return hdr;
+    }
+
+    // The UDP datagram carried by the test packets.
+    static Packet udp() {
+        Packet datagram;
+        const udphdr uh = {
+                .source = htons(53), .dest = htons(40000), .len = htons(16), .check = 0x1234};
+        append(&datagram, uh);
+        for (uint8_t b : {'c', 'l', 'a', 't', 't', 'e', 's', 't'}) datagram.push_back(b);
+        return datagram;
+    }
+
+    // Builds an IPv6/UDP packet, whose |extHdrs| must be chained to each other and end with
+    // an IPPROTO_UDP next header, with |firstHdr| the next header of the IPv6 header.
+    static Packet ipv6Packet(uint8_t firstHdr, const std::vector<Packet>& extHdrs) {
+        Packet payload;
+        for (const Packet& hdr : extHdrs) payload.insert(payload.end(), hdr.begin(), hdr.end());
+        const Packet datagram = udp();
+        payload.insert(payload.end(), datagram.begin(), datagram.end());
+
+        Packet packet;
+        const ethhdr eth = {.h_source = {2, 0, 0, 0, 0, 1}, .h_proto = htons(ETH_P_IPV6)};
+        append(&packet, eth);
+        ipv6hdr ip6 = {
+                .version = 6,
+                .payload_len = htons(payload.size()),
+                .nexthdr = firstHdr,
+                .hop_limit = 64,
+        };
+        // Not designated initializers, since they're in an anonymous union.
+        ip6.saddr = ipv6(kRemote6);
+        ip6.daddr = ipv6(kLocal6);
+        append(&packet, ip6);
+        packet.insert(packet.end(), payload.begin(), payload.end());
+        return packet;
+    }
+
+    // Checks that |out| is |datagram| translated to IPv4, returning its IPv4 header.
+    iphdr expectTranslated(const ProgRun& out) {
+        EXPECT_EQ(static_cast<uint32_t>(TC_ACT_PIPE), out.retval);
+        EXPECT_EQ(htons(ETH_P_IP), readAt<ethhdr>(out.packet, 0).h_proto);
+        const iphdr ip = readAt<iphdr>(out.packet, ETH_HLEN);
+        const Packet datagram = udp();
+        EXPECT_EQ(4, ip.version);
+        EXPECT_EQ(5, ip.ihl);
+        EXPECT_EQ(IPPROTO_UDP, ip.protocol);
+        EXPECT_EQ(sizeof(iphdr) + datagram.size(), ntohs(ip.tot_len));
+        EXPECT_EQ(ipv4("192.0.2.1").s_addr, ip.saddr);
+        EXPECT_EQ(ipv4(kLocal4).s_addr, ip.daddr);
+        EXPECT_EQ(0xFFFF, csumFold(csumPartial(&ip, sizeof(ip))));
+        EXPECT_EQ(datagram, Packet(out.packet.begin() + ETH_HLEN + sizeof(iphdr), out.packet.end()));
+        return ip;
+    }
+
+    // Checks that the packet was left to clatd.
+    void expectNotTranslated(const Packet& in, const ProgRun& out) {
+        EXPECT_EQ(static_cast<uint32_t>(TC_ACT_PIPE), out.retval);
+        EXPECT_EQ(CLAT_MARK, out.ctx.mark);
+        EXPECT_EQ(in, out.packet);
+    }
+
+    BpfMap<ClatIngress6Key, ClatIngress6Value> mMap;
+    ClatIngress6Key mKey;
+};
+
+TEST_F(ClatIngress6Test, NoExtensionHeaders) {
+    const iphdr ip = expectTranslated(run(ipv6Packet(IPPROTO_UDP, {})));
+    EXPECT_EQ(htons(kIpDf), ip.frag_off);
+}
+
+TEST_F(ClatIngress6Test, OneExtensionHeader) {
+    expectTranslated(run(ipv6Packet(IPPROTO_HOPOPTS, {optionsHdr(IPPROTO_UDP)})));
+}
+
+TEST_F(ClatIngress6Test, MaxExtensionHeaders) {
+    // Four headers is the most the program strips, see CLAT_MAX_EXT_HDRS.
+    expectTranslated(run(ipv6Packet(IPPROTO_HOPOPTS, {
+            optionsHdr(IPPROTO_DSTOPTS),
+            optionsHdr(IPPROTO_ROUTING),
+            routingHdr(IPPROTO_DSTOPTS, 0),
+            optionsHdr(IPPROTO_UDP),
+    })));
+
+    const auto value = mMap.readValue(mKey);
+    ASSERT_RESULT_OK(value);
+    EXPECT_EQ(1U, value.value().packets);
+}
+
+TEST_F(ClatIngress6Test, TooManyExtensionHeaders) {
+    const Packet in = ipv6Packet(IPPROTO_HOPOPTS, {
+            optionsHdr(IPPROTO_DSTOPTS),
+            optionsHdr(IPPROTO_DSTOPTS),
+            optionsHdr(IPPROTO_DSTOPTS),
+            optionsHdr(IPPROTO_DSTOPTS),
+            optionsHdr(IPPROTO_UDP),
+    });
+    expectNotTranslated(in, run(in));
+}
+
+TEST_F(ClatIngress6Test, RoutingHeaderWithSegmentsLeft) {
+    const Packet in = ipv6Packet(IPPROTO_ROUTING, {routingHdr(IPPROTO_UDP, 1)});
+    expectNotTranslated(in, run(in));
+}
+
+TEST_F(ClatIngress6Test, FragmentHeader) {
+    // The first fragment (offset 0, more fragments), after a hop-by-hop options header.
+    const iphdr ip = expectTranslated(run(ipv6Packet(IPPROTO_HOPOPTS, {
+            optionsHdr(IPPROTO_FRAGMENT),
+            fragmentHdr(IPPROTO_UDP, 0x0001, 0x12345678),
+    })));
+    EXPECT_EQ(htons(kIpMf), ip.frag_off);
+    EXPECT_EQ(htons(0x5678), ip.id);
+}
+
+TEST_F(ClatIngress6Test, ExtensionHeadersAfterFragmentHeaderAreKept) {
+    // Headers after the fragment header are part of the fragmentable part, which IPv4
+    // has no way to carry, so the packet is left to clatd.
+    const Packet in = ipv6Packet(IPPROTO_FRAGMENT, {
+            fragmentHdr(IPPROTO_DSTOPTS, 0x0001, 0x12345678),
+            optionsHdr(IPPROTO_UDP),
+    });
+    expectNotTranslated(in, run(in));
+}
+
+// ----- offload: schedcls/tether_downstream4_ether -----
+
+class Tether4DownstreamTest : public BpfProgRunTest {
+  protected:
+    void SetUp() override {
+        BpfProgRunTest::SetUp();
+        retrieve(TETHERING "prog_offload_schedcls_tether_downstream4_ether");
+        if (IsSkipped()) return;
+        ASSERT_RESULT_OK(mRules.init(TETHERING "map_offload_tether_downstream4_map"));
+        ASSERT_RESULT_OK(mStats.init(TETHERING "map_offload_tether_stats_map"));
+        ASSERT_RESULT_OK(mLimits.init(TETHERING "map_offload_tether_limit_map"));
+        ASSERT_RESULT_OK(mIifRules.init(TETHERING "map_offload_tether_iif_rules_map"));
+
+        // The stats and limit of downstream traffic are keyed by the upstream, ie. input,
+        // interface.
+        const uint32_t iif = mLoopbackIfindex;
+        ASSERT_RESULT_OK(mIifRules.writeValue(iif, TETHER_IIF_RULES_DOWNSTREAM4, BPF_ANY));
+        ASSERT_RESULT_OK(mStats.writeValue(iif, {}, BPF_ANY));
+        ASSERT_RESULT_OK(mLimits.writeValue(iif, UINT64_MAX, BPF_ANY));
+
+        // The packets are received with an all zeroes destination mac, which is the address
+        // of the loopback interface.
+        mKey = {
+                .iif = iif,
+                .l4Proto = IPPROTO_TCP,
+                .src4 = ipv4(kRemote4),
+                .dst4 = ipv4(kUpstream4),
+                .srcPort = htons(kRemotePort),
+                .dstPort = htons(kUpstreamPort),
+        };
+        mValue = {
+                .oif = iif,
+                .macHeader = {.h_dest = {2, 0, 0, 0, 0, 2},
+                              .h_source = {2, 0, 0, 0, 0, 3},
+                              .h_proto = htons(ETH_P_IP)},
+                .pmtu = 1500,
+                .src46 = ipv4Mapped(kRemote4),
+                .dst46 = ipv4Mapped(kClient4),
+                .srcPort = htons(kRemotePort),
+                .dstPort = htons(kClientPort),
+        };
+        // Computed the same way as BpfCoordinator does when it installs the rule.
+        const iphdr in = ipHeader(0);
+        const iphdr out = translated(in);
+        mValue.l3CsumDelta = csumDiff(&in, &out, sizeof(in));
+        mValue.l4PseudoCsumDelta = csumDiff(&in.saddr, &out.saddr, 2 * sizeof(in.saddr));
+        const __be16 inPorts[] = {mKey.srcPort, mKey.dstPort};
+        const __be16 outPorts[] = {mValue.srcPort, mValue.dstPort};
+        mValue.l4PortsCsumDelta = csumDiff(inPorts, outPorts, sizeof(inPorts));
+        ASSERT_RESULT_OK(mRules.writeValue(mKey, mValue, BPF_ANY));
+    }
+
+    void TearDown() override {
+        if (mRules.isValid()) {
+            EXPECT_RESULT_OK(mRules.deleteValue(mKey));
+            EXPECT_RESULT_OK(mIifRules.deleteValue(mLoopbackIfindex));
+            EXPECT_RESULT_OK(mStats.deleteValue(mLoopbackIfindex));
+            EXPECT_RESULT_OK(mLimits.deleteValue(mLoopbackIfindex));
+        }
+    }
+
+    static constexpr const char* kRemote4 = "203.0.113.1";
+    static constexpr const char* kUpstream4 = "198.51.100.2";
+    static constexpr const char* kClient4 = "192.168.42.2";
+    static constexpr uint16_t kRemotePort = 443;
+    static constexpr uint16_t kUpstreamPort = 40000;
+    static constexpr uint16_t kClientPort = 50000;
+    static constexpr size_t kTcpOffset = ETH_HLEN + sizeof(iphdr);
+
+    // The header of a downstream packet with |payloadLen| bytes of TCP payload, with a zero
+    // checksum.
+    static iphdr ipHeader(size_t payloadLen) {
+        iphdr ip = {
+                .ihl = 5,
+                .version = 4,
+                .tot_len = htons(sizeof(iphdr) + sizeof(tcphdr) + payloadLen),
+                .id = htons(0x4321),
+                .frag_off = htons(kIpDf),
+                .ttl = 64,
+                .protocol = IPPROTO_TCP,
+        };
+        ip.saddr = ipv4(kRemote4).s_addr;
+        ip.daddr = ipv4(kUpstream4).s_addr;
+        return ip;
+    }
+
+    // Returns |ip| as forwarded to the client, with a zero checksum.
+    static iphdr translated(iphdr ip) {
+        --ip.ttl;
+        ip.daddr = ipv4(kClient4).s_addr;
+        ip.check = 0;
+        return ip;
+    }
+
+    // Returns the ones' complement sum of the TCP segment at |offset| of |packet| and of its
+    // pseudo header, which is 0xFFFF if the TCP checksum is correct.
+    static uint16_t tcpSum(const Packet& packet, size_t offset, const iphdr& ip) {
+        const size_t len = packet.size() - offset;
+        uint32_t sum = csumPartial(&ip.saddr, 2 * sizeof(ip.saddr));
+        sum += htons(IPPROTO_TCP) + htons(len);
+        return csumFold(csumPartial(packet.data() + offset, len, sum));
+    }
+
+    // Builds a downstream TCP packet of the offloaded flow, with valid checksums.
+    static Packet tcpPacket(size_t payloadLen = 100) {
+        Packet packet;
+        const ethhdr eth = {.h_source = {2, 0, 0, 0, 0, 1}, .h_proto = htons(ETH_P_IP)};
+        append(&packet, eth);
+        iphdr ip = ipHeader(payloadLen);
+        ip.check = ~csumFold(csumPartial(&ip, sizeof(ip)));
+        append(&packet, ip);
+        tcphdr tcp = {};
+        tcp.source = htons(kRemotePort);
+        tcp.dest = htons(kUpstreamPort);
+        tcp.seq = htonl(1000);
+        tcp.ack_seq = htonl(2000);
+        tcp.doff = sizeof(tcp) / 4;
+        tcp.ack = 1;
+        tcp.psh = 1;
+        tcp.window = htons(65535);
+        append(&packet, tcp);
+        for (size_t i = 0; i < payloadLen; ++i) packet.push_back(i);
+        const uint16_t check = ~tcpSum(packet, kTcpOffset, ip);
+        memcpy(packet.data() + kTcpOffset + offsetof(tcphdr, check), &check, sizeof(check));
+        return packet;
+    }
+
+    // Returns the flow's tether_flow4_stats_map counters summed across all cpus, or zeroes if
+    // the flow has none.
+    Tether4FlowStatsValue flowStats() {
+        Tether4FlowStatsValue total = {};
+        const int cpus = android::bpf::getNumPossibleCpus();
+        EXPECT_LT(0, cpus);
+        if (cpus <= 0) return total;
+        std::vector<Tether4FlowStatsValue> perCpu(cpus);
+        if (android::bpf::findMapEntry(mFlowStats, &mKey, perCpu.data())) {
+            EXPECT_EQ(ENOENT, errno) << strerror(errno);
+            return total;
+        }
+        for (const auto& v : perCpu) {
+            total.packets += v.packets;
+            total.bytes += v.bytes;
+        }
+        return total;
+    }
+
+    uint64_t lastUsed() {
+        const auto value = mRules.readValue(mKey);
+        EXPECT_RESULT_OK(value);
+        return value.ok() ? value.value().last_used : 0;
+    }
+
+    BpfMap<Tether4Key, Tether4Value> mRules;
+    BpfMap<TetherStatsKey, TetherStatsValue> mStats;
+    BpfMap<TetherLimitKey, TetherLimitValue> mLimits;
+    BpfMap<TetherIifRulesKey, TetherIifRulesValue> mIifRules;
+    unique_fd mFlowStats;
+    Tether4Key mKey;
+    Tether4Value mValue;
+};
+
+TEST_F(Tether4DownstreamTest, TranslatesPacketAndChecksums) {
+    const Packet in = tcpPacket();
+    const ProgRun out = run(in);
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), out.retval);
+    ASSERT_EQ(in.size(), out.packet.size());
+
+    const ethhdr eth = readAt<ethhdr>(out.packet, 0);
+    EXPECT_EQ(0, memcmp(&mValue.macHeader, &eth, sizeof(eth)));
+
+    const iphdr ip = readAt<iphdr>(out.packet, ETH_HLEN);
+    iphdr expected = translated(readAt<iphdr>(in, ETH_HLEN));
+    expected.check = ip.check;
+    EXPECT_EQ(0, memcmp(&expected, &ip, sizeof(ip)));
+    EXPECT_EQ(0xFFFF, csumFold(csumPartial(&ip, sizeof(ip))));
+
+    const tcphdr tcp = readAt<tcphdr>(out.packet, kTcpOffset);
+    EXPECT_EQ(htons(kRemotePort), tcp.source);
+    EXPECT_EQ(htons(kClientPort), tcp.dest);
+    EXPECT_EQ(0xFFFF, tcpSum(out.packet, kTcpOffset, ip));
+    EXPECT_TRUE(std::equal(in.begin() + kTcpOffset + sizeof(tcp), in.end(),
+                           out.packet.begin() + kTcpOffset + sizeof(tcp)));
+
+    const auto stats = mStats.readValue(mLoopbackIfindex);
+    ASSERT_RESULT_OK(stats);
+    EXPECT_EQ(1U, stats.value().rxPackets);
+    EXPECT_EQ(in.size() - ETH_HLEN, stats.value().rxBytes);
+}
+
+TEST_F(Tether4DownstreamTest, LastUsedRefreshedOncePerSecond) {
+    // Older kernels may run the TCP only fallback program, which doesn't update last_used.
+    if (!isAtLeastKernelVersion(5, 8, 0)) GTEST_SKIP() << "Requires a 5.8+ kernel";
+    const Packet in = tcpPacket();
+
+    const uint64_t before = bootTimeNs();
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in).retval);
+    const uint64_t used = lastUsed();
+    EXPECT_LE(before, used);
+    EXPECT_GE(bootTimeNs(), used);
+
+    // Less than TETHER4_LAST_USED_GRANULARITY_NS later: not rewritten.
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in).retval);
+    EXPECT_EQ(used, lastUsed());
+
+    // More than TETHER4_LAST_USED_GRANULARITY_NS later: rewritten.
+    mValue.last_used = bootTimeNs() - 2 * TETHER4_LAST_USED_GRANULARITY_NS;
+    ASSERT_RESULT_OK(mRules.writeValue(mKey, mValue, BPF_EXIST));
+    const uint64_t beforeStale = bootTimeNs();
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in).retval);
+    EXPECT_LE(beforeStale, lastUsed());
+}
+
+TEST_F(Tether4DownstreamTest, FlowStats) {
+    mFlowStats.reset(android::bpf::mapRetrieveRW(TETHERING "map_offload_tether_flow4_stats_map"));
+    ASSERT_LE(0, mFlowStats.get()) << strerror(errno);
+    // Whatever a previous run left behind.
+    android::bpf::deleteMapEntry(mFlowStats, &mKey);
+
+    const Packet in = tcpPacket();
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in).retval);
+    // Rules without TETHER4_FLAG_FLOW_STATS are not counted.
+    EXPECT_EQ(0U, flowStats().packets);
+
+    mValue.flags = TETHER4_FLAG_FLOW_STATS;
+    ASSERT_RESULT_OK(mRules.writeValue(mKey, mValue, BPF_EXIST));
+    // The first packet creates this cpu's copy, the second one adds to it.
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in).retval);
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in).retval);
+    const Tether4FlowStatsValue stats = flowStats();
+    EXPECT_EQ(2U, stats.packets);
+    EXPECT_EQ(2 * (in.size() - ETH_HLEN), stats.bytes);
+
+    EXPECT_EQ(0, android::bpf::deleteMapEntry(mFlowStats, &mKey)) << strerror(errno);
+}
+
+TEST_F(Tether4DownstreamTest, GsoPacketCountedPerSegment) {
+    // The gso fields of __sk_buff can be set for a test run from 5.10 on.
+    if (!isAtLeastKernelVersion(5, 10, 0)) GTEST_SKIP() << "Requires a 5.10+ kernel";
+    constexpr size_t kPayload = 2800;
+    constexpr size_t kHeaders = sizeof(iphdr) + sizeof(tcphdr);
+    const Packet in = tcpPacket(kPayload);
+
+    // Each segment repeats the IPv4 and TCP headers.
+    const __sk_buff gso = {.gso_segs = 3, .gso_size = 1000};
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in, gso).retval);
+    auto stats = mStats.readValue(mLoopbackIfindex);
+    ASSERT_RESULT_OK(stats);
+    EXPECT_EQ(3U, stats.value().rxPackets);
+    EXPECT_EQ(3 * kHeaders + kPayload, stats.value().rxBytes);
+
+    // Without gso_segs the segments are counted from gso_size, ie. 1200 + 1200 + 400.
+    const __sk_buff gsoSizeOnly = {.gso_size = 1200};
+    ASSERT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), run(in, gsoSizeOnly).retval);
+    stats = mStats.readValue(mLoopbackIfindex);
+    ASSERT_RESULT_OK(stats);
+    EXPECT_EQ(3U + 3U, stats.value().rxPackets);
+    EXPECT_EQ(2 * (3 * kHeaders + kPayload), stats.value().rxBytes);
+}
+
+// ----- offload: schedcls/tether_downstream6_ether_neigh -----
+
+// Sends a NETLINK_ROUTE request and returns the kernel's acknowledgement, ie. 0 or -errno.
+int netlinkRequest(nlmsghdr* msg) {
+    unique_fd s(socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_ROUTE));
+    if (s < 0) return -errno;
+    msg->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+    if (send(s, msg, msg->nlmsg_len, 0) < 0) return -errno;
+    // Errors echo the request after the nlmsgerr, which is fine to truncate.
+    struct {
+        nlmsghdr hdr;
+        nlmsgerr err;
+    } ack = {};
+    if (recv(s, &ack, sizeof(ack), 0) < 0) return -errno;
+    return ack.hdr.nlmsg_type == NLMSG_ERROR ? ack.err.error : -EBADMSG;
+}
+
+class Tether6DownstreamNeighTest : public BpfProgRunTest {
+  protected:
+    void SetUp() override {
+        BpfProgRunTest::SetUp();
+        retrieve(TETHERING "prog_offload_schedcls_tether_downstream6_ether_neigh");
+        if (IsSkipped()) return;
+        ASSERT_NO_FATAL_FAILURE(createTap());
+        ASSERT_RESULT_OK(mRules.init(TETHERING "map_offload_tether_downstream6_map"));
+        ASSERT_RESULT_OK(mStats.init(TETHERING "map_offload_tether_stats_map"));
+        ASSERT_RESULT_OK(mLimits.init(TETHERING "map_offload_tether_limit_map"));
+        ASSERT_RESULT_OK(mIifRules.init(TETHERING "map_offload_tether_iif_rules_map"));
+
+        const uint32_t iif = mLoopbackIfindex;
+        ASSERT_RESULT_OK(mIifRules.writeValue(iif, TETHER_IIF_RULES_DOWNSTREAM6, BPF_ANY));
+        ASSERT_RESULT_OK(mStats.writeValue(iif, {}, BPF_ANY));
+        ASSERT_RESULT_OK(mLimits.writeValue(iif, UINT64_MAX, BPF_ANY));
+
+        // The static mac header must be ignored in favour of the looked up neighbour.
+        mKey = {.iif = iif, .neigh6 = ipv6(kClient6)};
+        const Tether6Value value = {
+                .oif = mTapIfindex,
+                .macHeader = {.h_dest = {2, 0, 0, 0, 0, 2},
+                              .h_source = {2, 0, 0, 0, 0, 3},
+                              .h_proto = htons(ETH_P_IPV6)},
+                .pmtu = 1500,
+        };
+        ASSERT_RESULT_OK(mRules.writeValue(mKey, value, BPF_ANY));
+    }
+
+    void TearDown() override {
+        if (mRules.isValid()) {
+            EXPECT_RESULT_OK(mRules.deleteValue(mKey));
+            EXPECT_RESULT_OK(mIifRules.deleteValue(mLoopbackIfindex));
+            EXPECT_RESULT_OK(mStats.deleteValue(mLoopbackIfindex));
+            EXPECT_RESULT_OK(mLimits.deleteValue(mLoopbackIfindex));
+        }
+        // Closing the tap deletes the interface, and with it its routes and neighbours.
+        mTap.reset();
+    }
+
+    static constexpr const char* kTapName = "bpfruntap0";
+    static constexpr const char* kRemote6 = "2001:db8:2::1";
+    static constexpr const char* kClientPrefix6 = "2001:db8:1::";
+    static constexpr const char* kClient6 = "2001:db8:1::2";
+    static constexpr uint8_t kClientMac[ETH_ALEN] = {2, 0, 0, 0, 0, 4};
+    static constexpr size_t kPayloadLen = 100;
+
+    // Creates an up tap interface with IPv6 forwarding enabled, since bpf_fib_lookup() does
+    // not forward out of interfaces which don't.
+    void createTap() {
+        mTap.reset(open("/dev/net/tun", O_RDWR | O_CLOEXEC));
+        ASSERT_LE(0, mTap.get()) << strerror(errno);
+        ifreq ifr = {};
+        ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+        strlcpy(ifr.ifr_name, kTapName, sizeof(ifr.ifr_name));
+        ASSERT_EQ(0, ioctl(mTap, TUNSETIFF, &ifr)) << strerror(errno);
+
+        unique_fd s(socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+        ASSERT_LE(0, s.get()) << strerror(errno);
+        ASSERT_EQ(0, ioctl(s, SIOCGIFHWADDR, &ifr)) << strerror(errno);
+        memcpy(mTapMac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+        ASSERT_EQ(0, ioctl(s, SIOCGIFFLAGS, &ifr)) << strerror(errno);
+        ifr.ifr_flags |= IFF_UP;
+        ASSERT_EQ(0, ioctl(s, SIOCSIFFLAGS, &ifr)) << strerror(errno);
+
+        mTapIfindex = if_nametoindex(kTapName);
+        ASSERT_NE(0U, mTapIfindex);
+        ASSERT_TRUE(WriteStringToFile(
+                "1", std::string("/proc/sys/net/ipv6/conf/") + kTapName + "/forwarding"));
+    }
+
+    // Routes the client's /64 out of the tap.  The route goes in the local table, which the
+    // first ip rule always looks up, so that the device's policy routing doesn't matter.
+    void addRoute() {
+        struct {
+            nlmsghdr hdr;
+            rtmsg rtm;
+            rtattr dstAttr;
+            in6_addr dst;
+            rtattr oifAttr;
+            uint32_t oif;
+        } req = {
+                .hdr = {.nlmsg_len = sizeof(req),
+                        .nlmsg_type = RTM_NEWROUTE,
+                        .nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL},
+                .rtm = {.rtm_family = AF_INET6,
+                        .rtm_dst_len = 64,
+                        .rtm_table = RT_TABLE_LOCAL,
+                        .rtm_protocol = RTPROT_STATIC,
+                        .rtm_scope = RT_SCOPE_UNIVERSE,
+                        .rtm_type = RTN_UNICAST},
+                .dstAttr = {.rta_len = RTA_LENGTH(sizeof(in6_addr)), .rta_type = RTA_DST},
+                .dst = ipv6(kClientPrefix6),
+                .oifAttr = {.rta_len = RTA_LENGTH(sizeof(uint32_t)), .rta_type = RTA_OIF},
+                .oif = mTapIfindex,
+        };
+        ASSERT_EQ(0, netlinkRequest(&req.hdr));
+    }
+
+    // Adds a permanent neighbour entry for the client on the tap.
+    void addNeighbour() {
+        struct {
+            nlmsghdr hdr;
+            ndmsg ndm;
+            rtattr dstAttr;
+            in6_addr dst;
+            rtattr lladdrAttr;
+            uint8_t lladdr[ETH_ALEN];
+            uint8_t pad[2];
+        } req = {
+                .hdr = {.nlmsg_len = sizeof(req),
+                        .nlmsg_type = RTM_NEWNEIGH,
+                        .nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE},
+                .ndm = {.ndm_family = AF_INET6,
+                        .ndm_ifindex = static_cast<int>(mTapIfindex),
+                        .ndm_state = NUD_PERMANENT},
+                .dstAttr = {.rta_len = RTA_LENGTH(sizeof(in6_addr)), .rta_type = NDA_DST},
+                .dst = ipv6(kClient6),
+                .lladdrAttr = {.rta_len = RTA_LENGTH(ETH_ALEN), .rta_type = NDA_LLADDR},
+        };
+        memcpy(req.lladdr, kClientMac, ETH_ALEN);
+        ASSERT_EQ(0, netlinkRequest(&req.hdr));
+    }
+
+    // Builds a downstream UDP packet to the client, received with the loopback (ie. all
+    // zeroes) destination mac.
+    static Packet udpPacket() {
+        Packet packet;
+        const ethhdr eth = {.h_source = {2, 0, 0, 0, 0, 1}, .h_proto = htons(ETH_P_IPV6)};
+        append(&packet, eth);
+        ipv6hdr ip6 = {
+                .version = 6,
+                .payload_len = htons(sizeof(udphdr) + kPayloadLen),
+                .nexthdr = IPPROTO_UDP,
+                .hop_limit = 64,
+        };
+        ip6.saddr = ipv6(kRemote6);
+        ip6.daddr = ipv6(kClient6);
+        append(&packet, ip6);
+        const udphdr udp = {.source = htons(443),
+                            .dest = htons(50000),
+                            .len = htons(sizeof(udphdr) + kPayloadLen)};
+        append(&packet, udp);
+        for (size_t i = 0; i < kPayloadLen; ++i) packet.push_back(i);
+        return packet;
+    }
+
+    // Checks that |out| is |in| forwarded with the given mac addresses, and that it was counted.
+    void expectForwarded(const Packet& in, const ProgRun& out, const uint8_t* dstMac,
+                         const uint8_t* srcMac) {
+        EXPECT_EQ(static_cast<uint32_t>(TC_ACT_REDIRECT), out.retval);
+        ASSERT_EQ(in.size(), out.packet.size());
+
+        const ethhdr eth = readAt<ethhdr>(out.packet, 0);
+        EXPECT_EQ(0, memcmp(dstMac, eth.h_dest, ETH_ALEN));
+        EXPECT_EQ(0, memcmp(srcMac, eth.h_source, ETH_ALEN));
+        EXPECT_EQ(htons(ETH_P_IPV6), eth.h_proto);
+
+        // Nothing but the hop limit changed past the ethernet header.
+        Packet expected = in;
+        --expected[ETH_HLEN + offsetof(ipv6hdr, hop_limit)];
+        EXPECT_TRUE(std::equal(expected.begin() + ETH_HLEN, expected.end(),
+                               out.packet.begin() + ETH_HLEN));
+
+        const auto stats = mStats.readValue(mLoopbackIfindex);
+        ASSERT_RESULT_OK(stats);
+        EXPECT_EQ(1U, stats.value().rxPackets);
+        EXPECT_EQ(in.size() - ETH_HLEN, stats.value().rxBytes);
+    }
+
+    BpfMap<TetherDownstream6Key, Tether6Value> mRules;
+    BpfMap<TetherStatsKey, TetherStatsValue> mStats;
+    BpfMap<TetherLimitKey, TetherLimitValue> mLimits;
+    BpfMap<TetherIifRulesKey, TetherIifRulesValue> mIifRules;
+    unique_fd mTap;
+    uint32_t mTapIfindex = 0;
+    uint8_t mTapMac[ETH_ALEN] = {};
+    TetherDownstream6Key mKey;
+};
+
+TEST_F(Tether6DownstreamNeighTest, ForwardsToResolvedNeighbour) {
+    ASSERT_NO_FATAL_FAILURE(addRoute());
+    ASSERT_NO_FATAL_FAILURE(addNeighbour());
+    const Packet in = udpPacket();
+    expectForwarded(in, run(in), kClientMac, mTapMac);
+}
+
+TEST_F(Tether6DownstreamNeighTest, UnresolvedNeighbourLeftToRedirectNeigh) {
+    // bpf_redirect_neigh() resolves the neighbour and builds the mac header itself, so the
+    // one in the packet is left zeroed.
+    ASSERT_NO_FATAL_FAILURE(addRoute());
+    const uint8_t zeroMac[ETH_ALEN] = {};
+    const Packet in = udpPacket();
+    expectForwarded(in, run(in), zeroMac, zeroMac);
+}
+
+TEST_F(Tether6DownstreamNeighTest, NoRouteOutOfOifPunts) {
+    const Packet in = udpPacket();
+    const ProgRun out = run(in);
+    EXPECT_EQ(static_cast<uint32_t>(TC_ACT_PIPE), out.retval);
+    EXPECT_EQ(in, out.packet);
+
+    const auto stats = mStats.readValue(mLoopbackIfindex);
+    ASSERT_RESULT_OK(stats);
+    EXPECT_EQ(0U, stats.value().rxPackets);
+}
+
+// ----- netd: schedcls/ingress/ratelimit_ether -----
+
+class IngressRateLimitTest : public BpfProgRunTest {
+  protected:
+    void SetUp() override {
+        BpfProgRunTest::SetUp();
+        retrieve(TC_BPF_INGRESS_RATELIMIT_ETHER_PROG_PATH);
+        if (IsSkipped()) return;
+        ASSERT_RESULT_OK(mMap.init(INGRESS_RATELIMIT_MAP_PATH));
+        ASSERT_RESULT_OK(mMap.writeValue(mLoopbackIfindex, {}, BPF_ANY));
+    }
+
+    void TearDown() override {
+        if (mMap.isValid()) {
+            EXPECT_RESULT_OK(mMap.deleteValue(mLoopbackIfindex));
+        }
+    }
+
+    static constexpr uint64_t kMarkNs = 100 * 1000 * 1000ULL;    // 100ms
+    static constexpr uint64_t kBurstNs = 1000 * 1000 * 1000ULL;  // 1s
+
+    // Sets the bucket's theoretical arrival time to |backlogNs| from now, so that |backlogNs|
+    // worth of the bucket is in use, with margins far larger than the time a test run takes.
+    void setBacklog(uint64_t backlogNs) {
+        const IngressRateLimitValue value = {
+                .rateInBytesPerSec = 1000 * 1000,
+                .markNs = kMarkNs,
+                .burstNs = kBurstNs,
+                .tatNs = backlogNs ? monotonicNs() + backlogNs : 0,
+        };
+        ASSERT_RESULT_OK(mMap.writeValue(mLoopbackIfindex, value, BPF_EXIST));
+    }
+
+    // Builds an IPv4 UDP packet with the ECN field set to |ecn|.
+    static Packet ipv4Packet(uint8_t ecn) {
+        Packet packet;
+        const ethhdr eth = {.h_source = {2, 0, 0, 0, 0, 1}, .h_proto = htons(ETH_P_IP)};
+        append(&packet, eth);
+        iphdr ip = {
+                .ihl = 5,
+                .version = 4,
+                .tos = static_cast<uint8_t>(0x28 | ecn),  // AF11
+                .tot_len = htons(sizeof(iphdr) + sizeof(udphdr)),
+                .ttl = 64,
+                .protocol = IPPROTO_UDP,
+        };
+        ip.saddr = ipv4("192.0.2.1").s_addr;
+        ip.daddr = ipv4("198.51.100.2").s_addr;
+        ip.check = ~csumFold(csumPartial(&ip, sizeof(ip)));
+        append(&packet, ip);
+        const udphdr udp = {.source = htons(443), .dest = htons(40000), .len = htons(8)};
+        append(&packet, udp);
+        return packet;
+    }
+
+    // Builds an IPv6 UDP packet with the ECN field set to |ecn|.
+    static Packet ipv6Packet(uint8_t ecn) {
+        Packet packet;
+        const ethhdr eth = {.h_source = {2, 0, 0, 0, 0, 1}, .h_proto = htons(ETH_P_IPV6)};
+        append(&packet, eth);
+        ipv6hdr ip6 = {
+                .version = 6,
+                .payload_len = htons(sizeof(udphdr)),
+                .nexthdr = IPPROTO_UDP,
+                .hop_limit = 64,
+        };
+        ip6.flow_lbl[0] = ecn << 4;  // the bottom 2 bits of the traffic class
+        ip6.saddr = ipv6("2001:db8::1");
+        ip6.daddr = ipv6("2001:db8::2");
+        append(&packet, ip6);
+        const udphdr udp = {.source = htons(443), .dest = htons(40000), .len = htons(8)};
+        append(&packet, udp);
+        return packet;
+    }
+
+    BpfMap<uint32_t, IngressRateLimitValue> mMap;
+};
+
+TEST_F(IngressRateLimitTest, NotMarkedBelowMarkThreshold) {
+    const Packet in = ipv4Packet(kEcnEct0);
+    setBacklog(0);
+    const uint64_t before = monotonicNs();
+    const ProgRun out = run(in);
+    EXPECT_EQ(static_cast<uint32_t>(TC_ACT_PIPE), out.retval);
+    EXPECT_EQ(in, out.packet);
+
+    // The bucket was full, so the packet's cost now starts from the current time:
+    // 42 bytes at 1MB/s is 42us.
+    const auto value = mMap.readValue(mLoopbackIfindex);
+    ASSERT_RESULT_OK(value);
+    EXPECT_LE(before + 42 * 1000, value.value().tatNs);
+    EXPECT_GE(monotonicNs() + 42 * 1000, value.value().tatNs);
+}
+
+TEST_F(IngressRateLimitTest, MarksIpv4AboveMarkThreshold) {
+    const Packet in = ipv4Packet(kEcnEct0);
+    setBacklog(kMarkNs * 5);
+    const ProgRun out = run(in);
+    EXPECT_EQ(static_cast<uint32_t>(TC_ACT_PIPE), out.retval);
+    ASSERT_EQ(in.size(), out.packet.size());
+
+    const iphdr ip = readAt<iphdr>(out.packet, ETH_HLEN);
+    EXPECT_EQ(0x28 | kEcnCe, ip.tos);
+    EXPECT_EQ(0xFFFF, csumFold(csumPartial(&ip, sizeof(ip))));
+    // Nothing but the ECN field and the checksum changed.
+    iphdr expected = readAt<iphdr>(in, ETH_HLEN);
+    expected.tos = ip.tos;
+    expected.check = ip.check;
+    EXPECT_EQ(0, memcmp(&expected, &ip, sizeof(ip)));
+}
+
+TEST_F(IngressRateLimitTest, MarksIpv6AboveMarkThreshold) {
+    const Packet in = ipv6Packet(kEcnEct1);
+    setBacklog(kMarkNs * 5);
+    const ProgRun out = run(in);
+    EXPECT_EQ(static_cast<uint32_t>(TC_ACT_PIPE), out.retval);
+    ASSERT_EQ(in.size(), out.packet.size());
+
+    Packet expected = in;
+    expected[ETH_HLEN + 1] |= kEcnCe << 4;
+    EXPECT_EQ(expected, out.packet);
+}
+
+TEST_F(IngressRateLimitTest, NotEctNotMarked) {
+    const Packet in = ipv4Packet(kEcnNotEct);
+    setBacklog(kMarkNs * 5);
+    const ProgRun out = run(in);
+    EXPECT_EQ(static_cast<uint32_t>(TC_ACT_PIPE), out.retval);
+    EXPECT_EQ(in, out.packet);
+}
+
+TEST_F(IngressRateLimitTest, DropsAboveBurst) {
+    setBacklog(kBurstNs * 5);
+    EXPECT_EQ(static_cast<uint32_t>(TC_ACT_SHOT), run(ipv4Packet(kEcnEct0)).retval);
+    EXPECT_EQ(static_cast<uint32_t>(TC_ACT_SHOT), run(ipv4Packet(kEcnNotEct)).retval);
+}
+
+}  // namespace
@@ -19,6 +19,7 @@
 #define __CLATD_H__
 
 #include <signal.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <sys/uio.h>
 
@@ -50,10 +51,16 @@ struct tun_data;
 
 #define CLATD_VERSION "1.7"
 
+// Default maximum number of packets event_loop() translates in each direction
+// before going back to poll(), overridable with -b.
+#define DEFAULT_PACKET_BUDGET 64
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 extern volatile sig_atomic_t running;
 
+bool process_packet_6_to_4(struct tun_data *tunnel);
+bool process_packet_4_to_6(struct tun_data *tunnel);
 void event_loop(struct tun_data *tunnel);
 
 /* function: parse_int
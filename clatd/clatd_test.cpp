@@ -758,6 +758,47 @@ TEST_F(ClatdTest, Translate) {
                           "ICMPv6->ICMP translation");
 }
 
+TEST_F(ClatdTest, ProcessPacketDrainsUntilEagain) {
+  inet_pton(AF_INET6, kIPv6LocalAddr, &Global_Clatd_Config.ipv6_local_subnet);
+
+  int tun_fds[2], v6_fds[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, tun_fds));
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, v6_fds));
+  struct tun_data tunnel = {};
+  tunnel.read_fd6  = -1;
+  tunnel.write_fd6 = v6_fds[0];
+  tunnel.fd4       = tun_fds[0];
+
+  uint8_t udp_ipv4[] = { IPV4_UDP_HEADER UDP_HEADER PAYLOAD };
+  fix_udp_checksum(udp_ipv4);
+  struct tun_pi good_pi = { 0, htons(ETH_P_IP) };
+  struct tun_pi bad_pi  = { 0, htons(ETH_P_ARP) };
+  struct iovec good[] = { { &good_pi, sizeof(good_pi) }, { udp_ipv4, sizeof(udp_ipv4) } };
+  struct iovec bad[]  = { { &bad_pi, sizeof(bad_pi) }, { udp_ipv4, sizeof(udp_ipv4) } };
+
+  // A dropped packet still counts as read, so it must not stop the drain.
+  ASSERT_LT(0, writev(tun_fds[1], good, ARRAYSIZE(good)));
+  ASSERT_LT(0, writev(tun_fds[1], bad, ARRAYSIZE(bad)));
+  ASSERT_LT(0, writev(tun_fds[1], good, ARRAYSIZE(good)));
+
+  EXPECT_TRUE(process_packet_4_to_6(&tunnel));
+  EXPECT_TRUE(process_packet_4_to_6(&tunnel));
+  EXPECT_TRUE(process_packet_4_to_6(&tunnel));
+  EXPECT_FALSE(process_packet_4_to_6(&tunnel));
+  EXPECT_EQ(EAGAIN, errno);
+  EXPECT_TRUE(running);
+
+  uint8_t out[MAXMTU];
+  EXPECT_LT(0, read(v6_fds[1], out, sizeof(out)));
+  EXPECT_LT(0, read(v6_fds[1], out, sizeof(out)));
+  EXPECT_EQ(-1, read(v6_fds[1], out, sizeof(out)));
+
+  close(tun_fds[0]);
+  close(tun_fds[1]);
+  close(v6_fds[0]);
+  close(v6_fds[1]);
+}
+
 TEST_F(ClatdTest, Fragmentation) {
   // This test uses hardcoded packets so the clatd address must be fixed.
   inet_pton(AF_INET6, kIPv6LocalAddr, &Global_Clatd_Config.ipv6_local_subnet);
@@ -31,6 +31,7 @@ struct clat_config {
   struct in_addr ipv4_local_subnet;
   struct in6_addr plat_subnet;
   const char *native_ipv6_interface;
+  unsigned packet_budget;  // max packets translated per direction per event loop wakeup
 };
 
 extern struct clat_config Global_Clatd_Config;
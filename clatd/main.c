@@ -51,6 +51,7 @@ void print_help() {
   printf("-t [tun file descriptor number]\n");
   printf("-r [read socket descriptor number]\n");
   printf("-w [write socket descriptor number]\n");
+  printf("-b [max packets per direction per wakeup, default %d]\n", DEFAULT_PACKET_BUDGET);
 }
 
 /* function: main
@@ -61,10 +62,10 @@ int main(int argc, char **argv) {
   int opt;
   char *uplink_interface = NULL, *plat_prefix = NULL;
   char *v4_addr = NULL, *v6_addr = NULL, *tunfd_str = NULL, *read_sock_str = NULL,
-       *write_sock_str = NULL;
+       *write_sock_str = NULL, *budget_str = NULL;
   unsigned len;
 
-  while ((opt = getopt(argc, argv, "i:p:4:6:t:r:w:h")) != -1) {
+  while ((opt = getopt(argc, argv, "i:p:4:6:t:r:w:b:h")) != -1) {
     switch (opt) {
       case 'i':
         uplink_interface = optarg;
@@ -87,6 +88,9 @@ int main(int argc, char **argv) {
       case 'w':
         write_sock_str = optarg;
         break;
+      case 'b':
+        budget_str = optarg;
+        break;
       case 'h':
         print_help();
         exit(0);
@@ -128,6 +132,14 @@ int main(int argc, char **argv) {
     exit(1);
   }
 
+  Global_Clatd_Config.packet_budget = DEFAULT_PACKET_BUDGET;
+  if (budget_str != NULL &&
+      (!parse_unsigned(budget_str, &Global_Clatd_Config.packet_budget) ||
+       !Global_Clatd_Config.packet_budget)) {
+    logmsg(ANDROID_LOG_FATAL, "invalid packet budget %s", budget_str);
+    exit(1);
+  }
+
   len = snprintf(tunnel.device4, sizeof(tunnel.device4), "%s%s", DEVICEPREFIX, uplink_interface);
   if (len >= sizeof(tunnel.device4)) {
     logmsg(ANDROID_LOG_FATAL, "interface name too long '%s'", tunnel.device4);
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.android.net.module.util.bpf;
+
+import com.android.net.module.util.Struct;
+
+/** Value type for ingress rate limit map, keyed by interface index. */
+public class IngressRateLimitValue extends Struct {
+    private static final long NANOS_PER_SECOND = 1_000_000_000L;
+
+    // Rate the token bucket refills at.
+    @Field(order = 0, type = Type.U63)
+    public final long rateInBytesPerSec;
+    // Backlog above which ECN capable packets are CE marked.
+    @Field(order = 1, type = Type.U63)
+    public final long markNs;
+    // Backlog above which packets are dropped, ie. the size of the bucket.
+    @Field(order = 2, type = Type.U63)
+    public final long burstNs;
+    // Theoretical arrival time of the next packet, maintained by the bpf program.
+    @Field(order = 3, type = Type.U63)
+    public final long tatNs;
+
+    public IngressRateLimitValue(final long rateInBytesPerSec, final long markNs,
+            final long burstNs, final long tatNs) {
+        this.rateInBytesPerSec = rateInBytesPerSec;
+        this.markNs = markNs;
+        this.burstNs = burstNs;
+        this.tatNs = tatNs;
+    }
+
+    /**
+     * Creates a value for a bucket of burstInBytes, which starts ECN marking once half of the
+     * burst has been used up.
+     */
+    public static IngressRateLimitValue fromBurst(final long rateInBytesPerSec,
+            final long burstInBytes) {
+        if (rateInBytesPerSec <= 0 || burstInBytes <= 0) {
+            throw new IllegalArgumentException("Invalid rate " + rateInBytesPerSec
+                    + " or burst " + burstInBytes);
+        }
+        final long burstNs = burstInBytes * NANOS_PER_SECOND / rateInBytesPerSec;
+        return new IngressRateLimitValue(rateInBytesPerSec, burstNs / 2, burstNs, 0);
+    }
+}
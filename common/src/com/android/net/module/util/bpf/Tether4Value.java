@@ -30,6 +30,9 @@ import java.util.Objects;
 
 /** Value type for downstream & upstream IPv4 forwarding maps. */
 public class Tether4Value extends Struct {
+    /** Count the flow's packets and bytes in the flow stats map, see offload.h. */
+    public static final int FLAG_FLOW_STATS = 1;
+
     @Field(order = 0, type = Type.S32)
     public final int oif;
 
@@ -60,10 +63,24 @@ public class Tether4Value extends Struct {
     @Field(order = 9, type = Type.U63)
     public final long lastUsed;
 
+    // Ones' complement checksum deltas of the NAT rewrite, see offload.h.
+    @Field(order = 10, type = Type.UBE16)
+    public final int l3CsumDelta;
+
+    @Field(order = 11, type = Type.UBE16)
+    public final int l4PseudoCsumDelta;
+
+    @Field(order = 12, type = Type.UBE16)
+    public final int l4PortsCsumDelta;
+
+    @Field(order = 13, type = Type.U16)
+    public final int flags;
+
     public Tether4Value(final int oif, @NonNull final MacAddress ethDstMac,
             @NonNull final MacAddress ethSrcMac, final int ethProto, final int pmtu,
             final byte[] src46, final byte[] dst46, final int srcPort,
-            final int dstPort, final long lastUsed) {
+            final int dstPort, final long lastUsed, final int l3CsumDelta,
+            final int l4PseudoCsumDelta, final int l4PortsCsumDelta, final int flags) {
         Objects.requireNonNull(ethDstMac);
         Objects.requireNonNull(ethSrcMac);
 
@@ -77,6 +94,58 @@ public class Tether4Value extends Struct {
         this.srcPort = srcPort;
         this.dstPort = dstPort;
         this.lastUsed = lastUsed;
+        this.l3CsumDelta = l3CsumDelta;
+        this.l4PseudoCsumDelta = l4PseudoCsumDelta;
+        this.l4PortsCsumDelta = l4PortsCsumDelta;
+        this.flags = flags;
+    }
+
+    /**
+     * Creates the value for translating packets matching {@code key}, with the checksum deltas
+     * of the translation precomputed so that the bpf program does not have to work them out for
+     * every packet.
+     */
+    public Tether4Value(@NonNull final Tether4Key key, final int oif,
+            @NonNull final MacAddress ethDstMac, @NonNull final MacAddress ethSrcMac,
+            final int ethProto, final int pmtu, final byte[] src46, final byte[] dst46,
+            final int srcPort, final int dstPort, final long lastUsed) {
+        this(key, oif, ethDstMac, ethSrcMac, ethProto, pmtu, src46, dst46, srcPort, dstPort,
+                lastUsed, 0 /* flags */);
+    }
+
+    /** As above, with the given FLAG_* flags. */
+    public Tether4Value(@NonNull final Tether4Key key, final int oif,
+            @NonNull final MacAddress ethDstMac, @NonNull final MacAddress ethSrcMac,
+            final int ethProto, final int pmtu, final byte[] src46, final byte[] dst46,
+            final int srcPort, final int dstPort, final long lastUsed, final int flags) {
+        this(oif, ethDstMac, ethSrcMac, ethProto, pmtu, src46, dst46, srcPort, dstPort, lastUsed,
+                // The IPv4 TTL is decremented as well, and is followed by the protocol in
+                // the same 16-bit word: ~ttl_proto + (ttl_proto - 0x0100) == -0x0100.
+                csumAdd(addressCsumDelta(key, src46, dst46), 0xfeff),
+                addressCsumDelta(key, src46, dst46),
+                csumAdd(csumAdd(~key.srcPort & 0xffff, ~key.dstPort & 0xffff),
+                        csumAdd(srcPort, dstPort)),
+                flags);
+    }
+
+    // Ones' complement addition of two 16-bit values.
+    private static int csumAdd(int a, int b) {
+        final int sum = (a & 0xffff) + (b & 0xffff);
+        return (sum & 0xffff) + (sum >>> 16);
+    }
+
+    // Ones' complement sum of the 16-bit words of bytes [start, start + 4).
+    private static int csum32(final byte[] bytes, final int start) {
+        return csumAdd(((bytes[start] & 0xff) << 8) | (bytes[start + 1] & 0xff),
+                ((bytes[start + 2] & 0xff) << 8) | (bytes[start + 3] & 0xff));
+    }
+
+    // Checksum delta of rewriting the IPv4 addresses of key into the IPv4 mapped src46/dst46.
+    private static int addressCsumDelta(@NonNull final Tether4Key key, final byte[] src46,
+            final byte[] dst46) {
+        final int oldSum = csumAdd(csum32(key.src4, 0), csum32(key.dst4, 0));
+        final int newSum = csumAdd(csum32(src46, 12), csum32(dst46, 12));
+        return csumAdd(~oldSum & 0xffff, newSum);
     }
 
     @Override
@@ -85,11 +154,12 @@ public class Tether4Value extends Struct {
             return String.format(
                     "oif: %d, ethDstMac: %s, ethSrcMac: %s, ethProto: %d, pmtu: %d, "
                             + "src46: %s, dst46: %s, srcPort: %d, dstPort: %d, "
-                            + "lastUsed: %d",
+                            + "lastUsed: %d, l3CsumDelta: 0x%04x, l4PseudoCsumDelta: 0x%04x, "
+                            + "l4PortsCsumDelta: 0x%04x, flags: 0x%x",
                     oif, ethDstMac, ethSrcMac, ethProto, pmtu,
                     InetAddress.getByAddress(src46), InetAddress.getByAddress(dst46),
                     Short.toUnsignedInt((short) srcPort), Short.toUnsignedInt((short) dstPort),
-                    lastUsed);
+                    lastUsed, l3CsumDelta, l4PseudoCsumDelta, l4PortsCsumDelta, flags);
         } catch (UnknownHostException | IllegalArgumentException e) {
             return "Invalid IP address" + e;
         }
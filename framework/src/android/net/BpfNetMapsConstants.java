@@ -52,6 +52,8 @@ public class BpfNetMapsConstants {
             "/sys/fs/bpf/netd_shared/map_netd_configuration_map";
     public static final String UID_OWNER_MAP_PATH =
             "/sys/fs/bpf/netd_shared/map_netd_uid_owner_map";
+    public static final String UID_OWNER_MAP_B_PATH =
+            "/sys/fs/bpf/netd_shared/map_netd_uid_owner_map_B";
     public static final String UID_PERMISSION_MAP_PATH =
             "/sys/fs/bpf/netd_shared/map_netd_uid_permission_map";
     public static final String COOKIE_TAG_MAP_PATH =
@@ -62,6 +64,8 @@ public class BpfNetMapsConstants {
             "/sys/fs/bpf/netd_shared/map_netd_ingress_discard_map";
     public static final Struct.S32 UID_RULES_CONFIGURATION_KEY = new Struct.S32(0);
     public static final Struct.S32 CURRENT_STATS_MAP_CONFIGURATION_KEY = new Struct.S32(1);
+    public static final Struct.S32 UID_PERMISSION_GENERATION_KEY = new Struct.S32(2);
+    public static final Struct.S32 CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY = new Struct.S32(3);
     public static final Struct.S32 DATA_SAVER_ENABLED_KEY = new Struct.S32(0);
 
     public static final short DATA_SAVER_DISABLED = 0;
@@ -34,6 +34,7 @@
 
 using android::bpf::bpfGetUidStats;
 using android::bpf::bpfGetIfaceStats;
+using android::bpf::bpfGetStatsUpdateErrors;
 using android::bpf::bpfRegisterIface;
 using android::bpf::NetworkTraceHandler;
 
@@ -108,6 +109,16 @@ static jobject nativeGetUidStat(JNIEnv* env, jclass clazz, jint uid) {
     }
 }
 
+static jobject nativeGetStatsUpdateErrors(JNIEnv* env, jclass clazz, jint errorKey) {
+    StatsValue stats = {};
+
+    if (bpfGetStatsUpdateErrors(errorKey, &stats) == 0) {
+        return statsValueToEntry(env, &stats);
+    } else {
+        return nullptr;
+    }
+}
+
 static void nativeInitNetworkTracing(JNIEnv* env, jclass clazz) {
     NetworkTraceHandler::InitPerfettoTracing();
 }
@@ -133,6 +144,11 @@ static const JNINativeMethod gMethods[] = {
             "(I)Landroid/net/NetworkStats$Entry;",
             (void*)nativeGetUidStat
         },
+        {
+            "nativeGetStatsUpdateErrors",
+            "(I)Landroid/net/NetworkStats$Entry;",
+            (void*)nativeGetStatsUpdateErrors
+        },
         {
             "nativeInitNetworkTracing",
             "()V",
@@ -131,6 +131,28 @@ int bpfGetIfIndexStats(int ifindex, StatsValue* stats) {
     return bpfGetIfIndexStatsInternal(ifindex, stats, getIfaceStatsMap());
 }
 
+int bpfGetStatsUpdateErrorsInternal(uint32_t errorKey, StatsValue* lost,
+                                    const base::unique_fd& statsUpdateErrorMap) {
+    *lost = {};
+    const int cpus = getNumPossibleCpus();
+    if (cpus < 0) return cpus;
+    // Per-cpu map: the kernel returns one StatsValue per possible cpu.
+    std::vector<StatsValue> perCpu(cpus);
+    if (findMapEntry(statsUpdateErrorMap, &errorKey, perCpu.data())) return -errno;
+    for (const StatsValue& value : perCpu) *lost += value;
+    return 0;
+}
+
+int bpfGetStatsUpdateErrors(uint32_t errorKey, StatsValue* lost) {
+    // Only read for dumps, so no need to keep the map open.
+    base::unique_fd statsUpdateErrorMap(mapRetrieveRO(STATS_UPDATE_ERROR_MAP_PATH));
+    if (!statsUpdateErrorMap.ok()) {
+        *lost = {};
+        return -errno;
+    }
+    return bpfGetStatsUpdateErrorsInternal(errorKey, lost, statsUpdateErrorMap);
+}
+
 stats_line populateStatsEntry(const StatsKey& statsKey, const StatsValue& statsEntry,
                               const IfaceValue& ifname) {
     stats_line newLine;
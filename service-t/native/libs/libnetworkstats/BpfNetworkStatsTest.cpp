@@ -292,6 +292,39 @@ TEST_F(BpfNetworkStatsHelperTest, TestGetIfIndexStatsInternal) {
     expectStatsEqual(value, result);
 }
 
+TEST_F(BpfNetworkStatsHelperTest, TestGetStatsUpdateErrorsInternal) {
+    const int cpus = getNumPossibleCpus();
+    ASSERT_LT(0, cpus);
+    unique_fd errorMap(createMap(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t), sizeof(StatsValue),
+                                 STATS_UPDATE_ERROR_MAP_SIZE, 0));
+    ASSERT_TRUE(errorMap.ok());
+
+    // Lost traffic is recorded on whichever cpu the failed insert happened on.
+    std::vector<StatsValue> perCpu(cpus);
+    perCpu[0] = {.rxPackets = TEST_PACKET0, .rxBytes = TEST_BYTES0};
+    perCpu[cpus - 1].txPackets += TEST_PACKET1;
+    perCpu[cpus - 1].txBytes += TEST_BYTES1;
+    uint32_t key = STATS_UPDATE_ERROR_STATS_MAP_B;
+    ASSERT_EQ(0, writeToMapEntry(errorMap, &key, perCpu.data(), BPF_ANY));
+
+    StatsValue lost = {};
+    ASSERT_EQ(0, bpfGetStatsUpdateErrorsInternal(STATS_UPDATE_ERROR_STATS_MAP_B, &lost, errorMap));
+    StatsValue expected = {
+            .rxPackets = TEST_PACKET0,
+            .rxBytes = TEST_BYTES0,
+            .txPackets = TEST_PACKET1,
+            .txBytes = TEST_BYTES1,
+    };
+    expectStatsEqual(expected, lost);
+
+    // Nothing lost for the other maps.
+    ASSERT_EQ(0, bpfGetStatsUpdateErrorsInternal(STATS_UPDATE_ERROR_STATS_MAP_A, &lost, errorMap));
+    expectStatsEqual({}, lost);
+
+    ASSERT_EQ(-ENOENT, bpfGetStatsUpdateErrorsInternal(STATS_UPDATE_ERROR_MAP_SIZE, &lost,
+                                                       errorMap));
+}
+
 TEST_F(BpfNetworkStatsHelperTest, TestGetStatsDetail) {
     updateIfaceMap(IFACE_NAME1, IFACE_INDEX1);
     updateIfaceMap(IFACE_NAME2, IFACE_INDEX2);
@@ -139,23 +139,7 @@ void NetworkTraceHandler::InitPerfettoTracing() {
 }
 
 // static
-NetworkTracePoller NetworkTraceHandler::sPoller(
-    [](const std::vector<PacketTrace>& packets) {
-      // Trace calls the provided callback for each active session. The context
-      // gets a reference to the NetworkTraceHandler instance associated with
-      // the session and delegates writing. The corresponding handler will write
-      // with the setting specified in the trace config.
-      NetworkTraceHandler::Trace([&](NetworkTraceHandler::TraceContext ctx) {
-        perfetto::LockedHandle<NetworkTraceHandler> handle =
-            ctx.GetDataSourceLocked();
-        // The underlying handle can be invalidated between when Trace starts
-        // and GetDataSourceLocked is called, but not while the LockedHandle
-        // exists and holds the lock. Check validity prior to use.
-        if (handle.valid()) {
-          handle->Write(packets, ctx);
-        }
-      });
-    });
+NetworkTracePoller NetworkTraceHandler::sPoller;
 
 void NetworkTraceHandler::OnSetup(const SetupArgs& args) {
   const std::string& raw = args.config->network_packet_trace_config_raw();
@@ -176,13 +160,30 @@ void NetworkTraceHandler::OnSetup(const SetupArgs& args) {
 
 void NetworkTraceHandler::OnStart(const StartArgs&) {
   if (mIsTest) return;  // Don't touch non-hermetic bpf in test.
-  mStarted = sPoller.Start(mPollMs);
+  // Each session polls at its own rate and receives only its own batches. The
+  // poller stops invoking the sink before StopSession returns, so capturing
+  // this is safe.
+  mSessionId = sPoller.StartSession(
+      mPollMs, [this](const std::vector<PacketTrace>& packets) {
+        // Trace calls the provided callback for each active session. The
+        // context gets a reference to the NetworkTraceHandler instance
+        // associated with the session, only write to the one for this session.
+        NetworkTraceHandler::Trace([&](NetworkTraceHandler::TraceContext ctx) {
+          perfetto::LockedHandle<NetworkTraceHandler> handle =
+              ctx.GetDataSourceLocked();
+          // The underlying handle can be invalidated between when Trace starts
+          // and GetDataSourceLocked is called, but not while the LockedHandle
+          // exists and holds the lock. Check validity prior to use.
+          if (!handle.valid() || &(*handle) != this) return;
+          handle->Write(packets, ctx);
+        });
+      });
 }
 
 void NetworkTraceHandler::OnStop(const StopArgs&) {
   if (mIsTest) return;  // Don't touch non-hermetic bpf in test.
-  if (mStarted) sPoller.Stop();
-  mStarted = false;
+  if (mSessionId.has_value()) sPoller.StopSession(*mSessionId);
+  mSessionId.reset();
 
   // Although this shouldn't be required, there seems to be some cases when we
   // don't fill enough of a Perfetto Chunk for Perfetto to automatically commit
@@ -25,96 +25,200 @@
 #include <perfetto/tracing/platform.h>
 #include <perfetto/tracing/tracing.h>
 
-#include <unordered_map>
-#include <unordered_set>
+#include <string.h>
 
-#include "netdbpf/BpfNetworkStats.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <unordered_map>
 
 namespace android {
 namespace bpf {
 namespace internal {
+using ::android::base::ErrnoErrorf;
+using ::android::base::Result;
 using ::android::base::StringPrintf;
 
+static uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 void NetworkTracePoller::PollAndSchedule(perfetto::base::TaskRunner* runner,
-                                         uint32_t poll_ms) {
+                                         uint32_t poll_ms,
+                                         uint32_t generation) {
+  // A newer chain of polls took over after the poll interval changed.
+  if (generation != mPollGeneration) return;
+
   // Always schedule another run of ourselves to recursively poll periodically.
   // The task runner is sequential so these can't run on top of each other.
-  runner->PostDelayedTask([=, this]() { PollAndSchedule(runner, poll_ms); }, poll_ms);
+  runner->PostDelayedTask(
+      [=, this]() { PollAndSchedule(runner, poll_ms, generation); }, poll_ms);
+
+  const uint64_t now = NowNs();
+  Consume([now](SessionId, const Session& session) {
+    return now >= session.nextDeliveryNs ||
+           session.pending.size() >= kMaxPendingPackets;
+  });
+}
+
+void NetworkTracePoller::UpdatePollInterval() {
+  uint32_t pollMs = std::numeric_limits<uint32_t>::max();
+  {
+    std::scoped_lock<std::mutex> slock(mSessionMutex);
+    for (const auto& [id, session] : mSessions) {
+      pollMs = std::min(pollMs, session.pollMs);
+    }
+  }
+  if (pollMs == mPollMs) return;
 
-  ConsumeAll();
+  // Start a new chain of polls at the new interval. The already scheduled poll
+  // of the previous chain will notice the generation changed and not reschedule.
+  mPollMs = pollMs;
+  const uint32_t generation = ++mPollGeneration;
+  perfetto::base::TaskRunner* runner = mTaskRunner.get();
+  runner->PostTask(
+      [=, this]() { PollAndSchedule(runner, pollMs, generation); });
 }
 
 bool NetworkTracePoller::Start(uint32_t pollMs) {
-  ALOGD("Starting datasource");
+  std::scoped_lock<std::mutex> lock(mMutex);
+  auto id = StartSessionLocked(pollMs, mCallback, nullptr);
+  if (!id.has_value()) return false;
+  mCallbackSessions.push_back(*id);
+  return true;
+}
 
+bool NetworkTracePoller::Stop() {
   std::scoped_lock<std::mutex> lock(mMutex);
-  if (mSessionCount > 0) {
-    if (mPollMs != pollMs) {
-      // Nothing technical prevents mPollMs from changing, it's just unclear
-      // what the right behavior is. Taking the min of active values could poll
-      // too frequently giving some sessions too much data. Taking the max could
-      // be too infrequent. For now, do nothing.
-      ALOGI("poll_ms can't be changed while running, ignoring poll_ms=%d",
-            pollMs);
-    }
-    mSessionCount++;
-    return true;
-  }
+  if (mCallbackSessions.empty()) return false;  // This should never happen
+  SessionId id = mCallbackSessions.back();
+  mCallbackSessions.pop_back();
+  return StopSessionLocked(id);
+}
 
-  auto status = mConfigurationMap.init(PACKET_TRACE_ENABLED_MAP_PATH);
-  if (!status.ok()) {
-    ALOGW("Failed to bind config map: %s", status.error().message().c_str());
-    return false;
-  }
+std::optional<NetworkTracePoller::SessionId> NetworkTracePoller::StartSession(
+    uint32_t pollMs, EventSink sink, EventFilter filter) {
+  std::scoped_lock<std::mutex> lock(mMutex);
+  return StartSessionLocked(pollMs, std::move(sink), std::move(filter));
+}
 
-  auto rb = BpfRingbuf<PacketTrace>::Create(PACKET_TRACE_RINGBUF_PATH);
-  if (!rb.ok()) {
-    ALOGW("Failed to create ringbuf: %s", rb.error().message().c_str());
-    return false;
-  }
+bool NetworkTracePoller::StopSession(SessionId id) {
+  std::scoped_lock<std::mutex> lock(mMutex);
+  return StopSessionLocked(id);
+}
 
-  {
-    std::scoped_lock<std::mutex> block(mBufferMutex);
-    mRingBuffer = std::move(*rb);
-  }
+std::optional<NetworkTracePoller::SessionId>
+NetworkTracePoller::StartSessionLocked(uint32_t pollMs, EventSink sink,
+                                       EventFilter filter) {
+  ALOGD("Starting datasource");
 
-  auto res = mConfigurationMap.writeValue(0, true, BPF_ANY);
-  if (!res.ok()) {
-    ALOGW("Failed to enable tracing: %s", res.error().message().c_str());
-    return false;
+  if (!sink) return std::nullopt;
+
+  if (mSessionCount == 0) {
+    auto status = mConfigurationMap.init(PACKET_TRACE_ENABLED_MAP_PATH);
+    if (!status.ok()) {
+      ALOGW("Failed to bind config map: %s", status.error().message().c_str());
+      return std::nullopt;
+    }
+
+    auto rb = BpfRingbuf<PacketTrace>::Create(PACKET_TRACE_RINGBUF_PATH);
+    if (!rb.ok()) {
+      ALOGW("Failed to create ringbuf: %s", rb.error().message().c_str());
+      return std::nullopt;
+    }
+
+    {
+      std::scoped_lock<std::mutex> ilock(mIfaceMutex);
+      auto ifaceStatus = mIfaceStatsMap.init(IFACE_STATS_MAP_PATH);
+      if (!ifaceStatus.ok()) {
+        // Packet tracing still works without the iface counters.
+        ALOGW("Failed to bind iface stats map: %s",
+              ifaceStatus.error().message().c_str());
+      }
+      mIfaceTracks.clear();
+    }
+
+    {
+      std::scoped_lock<std::mutex> block(mBufferMutex);
+      mRingBuffer = std::move(*rb);
+    }
+
+    auto res = mConfigurationMap.writeValue(0, true, BPF_ANY);
+    if (!res.ok()) {
+      ALOGW("Failed to enable tracing: %s", res.error().message().c_str());
+      return std::nullopt;
+    }
+
+    // Start a task runner to poll the ring buffer, see UpdatePollInterval.
+    mTaskRunner = perfetto::Platform::GetDefaultPlatform()->CreateTaskRunner({});
+    mPollMs = 0;
   }
 
-  // Start a task runner to run ConsumeAll every mPollMs milliseconds.
-  mTaskRunner = perfetto::Platform::GetDefaultPlatform()->CreateTaskRunner({});
-  mPollMs = pollMs;
-  PollAndSchedule(mTaskRunner.get(), mPollMs);
+  const SessionId id = mNextSessionId++;
+  {
+    std::scoped_lock<std::mutex> slock(mSessionMutex);
+    mSessions[id] = Session{
+        .pollMs = pollMs,
+        .sink = std::move(sink),
+        .filter = std::move(filter),
+        .nextDeliveryNs = NowNs() + pollMs * 1000000ULL,
+    };
+  }
 
   mSessionCount++;
-  return true;
+  UpdatePollInterval();
+  return id;
 }
 
-bool NetworkTracePoller::Stop() {
+bool NetworkTracePoller::StopSessionLocked(SessionId id) {
   ALOGD("Stopping datasource");
 
-  std::scoped_lock<std::mutex> lock(mMutex);
-  if (mSessionCount == 0) return false;  // This should never happen
+  {
+    // Once stopping, the session is only delivered to below. Wait out a
+    // concurrent poll which is still invoking its sink.
+    std::unique_lock<std::mutex> slock(mSessionMutex);
+    base::ScopedLockAssertion assume_locked(mSessionMutex);
+    auto it = mSessions.find(id);
+    if (it == mSessions.end()) return false;
+    it->second.stopping = true;
+    while (it->second.delivering) mSessionCv.wait(slock);
+  }
 
-  // If this isn't the last session, don't clean up yet.
-  if (--mSessionCount > 0) return true;
+  base::Result<void> res;
+  if (mSessionCount == 1) {
+    res = mConfigurationMap.writeValue(0, false, BPF_ANY);
+    if (!res.ok()) {
+      ALOGW("Failed to disable tracing: %s", res.error().message().c_str());
+    }
 
-  auto res = mConfigurationMap.writeValue(0, false, BPF_ANY);
-  if (!res.ok()) {
-    ALOGW("Failed to disable tracing: %s", res.error().message().c_str());
+    // Make sure everything in the system has actually seen the 'false' we just
+    // wrote, things should now be well and truly disabled.
+    synchronizeKernelRCU();
   }
 
-  // Make sure everything in the system has actually seen the 'false' we just
-  // wrote, things should now be well and truly disabled.
-  synchronizeKernelRCU();
+  // Drain remaining events from the ring buffer without delivering them, and
+  // hand this session all it is owed. When this is the last session, this also
+  // prevents the next trace from seeing stale events.
+  Consume([](SessionId, const Session&) { return false; });
+
+  EventSink sink;
+  std::vector<PacketTrace> batch;
+  {
+    std::scoped_lock<std::mutex> slock(mSessionMutex);
+    Session& session = mSessions.at(id);
+    sink = std::move(session.sink);
+    batch.swap(session.pending);
+    mSessions.erase(id);
+  }
+  if (!batch.empty()) sink(batch);
 
-  // Drain remaining events from the ring buffer now that tracing is disabled.
-  // This prevents the next trace from seeing stale events and allows writing
-  // the last batch of events to Perfetto.
-  ConsumeAll();
+  // If this isn't the last session, don't clean up yet.
+  if (--mSessionCount > 0) {
+    UpdatePollInterval();
+    return true;
+  }
 
   mTaskRunner.reset();
 
@@ -126,29 +230,88 @@ bool NetworkTracePoller::Stop() {
   return res.ok();
 }
 
-void NetworkTracePoller::TraceIfaces(const std::vector<PacketTrace>& packets) {
-  if (packets.empty()) return;
+void NetworkTracePoller::TraceIfaces() {
+  std::scoped_lock<std::mutex> lock(mIfaceMutex);
+  if (!mIfaceStatsMap.isValid()) return;
 
-  std::unordered_set<uint32_t> uniqueIfindex;
-  for (const PacketTrace& pkt : packets) {
-    uniqueIfindex.insert(pkt.ifindex);
+  auto res = mIfaceStatsMap.readAllEntries(&mIfaceStatsKeys, &mIfaceStatsValues);
+  if (!res.ok()) {
+    ALOGW("Failed to read iface stats: %s", res.error().message().c_str());
+    return;
   }
 
-  for (uint32_t ifindex : uniqueIfindex) {
-    char ifname[IF_NAMESIZE] = {};
-    if (if_indextoname(ifindex, ifname) != ifname) continue;
+  // Names come from the kernel rather than the iface index name map, since the
+  // latter is only written on registration and so goes stale on renames.
+  TraceIfaceStatsLocked(mIfaceStatsKeys, mIfaceStatsValues,
+                        [](const uint32_t ifindex) -> Result<IfaceValue> {
+                          IfaceValue iv = {};
+                          if (if_indextoname(ifindex, iv.name) != iv.name) {
+                            return ErrnoErrorf("if_indextoname({}) failed", ifindex);
+                          }
+                          return iv;
+                        });
+}
+
+int NetworkTracePoller::TraceIfaceStats(const std::vector<uint32_t>& ifindexes,
+                                        const std::vector<StatsValue>& stats,
+                                        const IfIndexToNameFunc& ifindex2name) {
+  std::scoped_lock<std::mutex> lock(mIfaceMutex);
+  return TraceIfaceStatsLocked(ifindexes, stats, ifindex2name);
+}
 
-    StatsValue stats = {};
-    if (bpfGetIfIndexStats(ifindex, &stats) != 0) continue;
+int NetworkTracePoller::TraceIfaceStatsLocked(
+    const std::vector<uint32_t>& ifindexes, const std::vector<StatsValue>& stats,
+    const IfIndexToNameFunc& ifindex2name) {
+  int emitted = 0;
+  for (size_t i = 0; i < ifindexes.size() && i < stats.size(); i++) {
+    const uint32_t ifindex = ifindexes[i];
+    const StatsValue& value = stats[i];
+
+    auto [it, inserted] = mIfaceTracks.try_emplace(ifindex);
+    IfaceTrack& track = it->second;
+    if (!inserted && track.rxBytes == value.rxBytes &&
+        track.txBytes == value.txBytes) {
+      continue;
+    }
+
+    // Only look up the name once there is something to emit. Stats of ifaces
+    // which no longer exist are kept around in the map, so remember their
+    // values to avoid retrying the lookup on every poll.
+    auto name = ifindex2name(ifindex);
+    if (!name.ok()) {
+      track.rxTrack.clear();
+      track.txTrack.clear();
+      track.rxBytes = value.rxBytes;
+      track.txBytes = value.txBytes;
+      continue;
+    }
 
-    std::string rxTrack = StringPrintf("%s [%d] Rx Bytes", ifname, ifindex);
-    std::string txTrack = StringPrintf("%s [%d] Tx Bytes", ifname, ifindex);
-    ATRACE_INT64(rxTrack.c_str(), stats.rxBytes);
-    ATRACE_INT64(txTrack.c_str(), stats.txBytes);
+    const bool fresh = track.rxTrack.empty() ||
+        strncmp(track.name.name, name->name, sizeof(track.name.name));
+    if (fresh) {
+      track.name = *name;
+      track.rxTrack = StringPrintf("%s [%d] Rx Bytes", track.name.name, ifindex);
+      track.txTrack = StringPrintf("%s [%d] Tx Bytes", track.name.name, ifindex);
+    }
+    if (fresh || track.rxBytes != value.rxBytes) {
+      track.rxBytes = value.rxBytes;
+      ATRACE_INT64(track.rxTrack.c_str(), track.rxBytes);
+      emitted++;
+    }
+    if (fresh || track.txBytes != value.txBytes) {
+      track.txBytes = value.txBytes;
+      ATRACE_INT64(track.txTrack.c_str(), track.txBytes);
+      emitted++;
+    }
   }
+  return emitted;
 }
 
 bool NetworkTracePoller::ConsumeAll() {
+  return Consume([](SessionId, const Session&) { return true; });
+}
+
+bool NetworkTracePoller::Consume(const DeliveryPolicy& due) {
   std::vector<PacketTrace> packets;
   {
     std::scoped_lock<std::mutex> lock(mBufferMutex);
@@ -167,8 +330,51 @@ bool NetworkTracePoller::ConsumeAll() {
 
   ATRACE_INT("NetworkTracePackets", packets.size());
 
-  TraceIfaces(packets);
-  mCallback(packets);
+  TraceIfaces();
+
+  std::vector<SessionId> dueIds;
+  {
+    std::scoped_lock<std::mutex> slock(mSessionMutex);
+    const uint64_t now = NowNs();
+    for (auto& [id, session] : mSessions) {
+      if (session.filter) {
+        for (const PacketTrace& pkt : packets) {
+          if (session.filter(pkt)) session.pending.push_back(pkt);
+        }
+      } else {
+        session.pending.insert(session.pending.end(), packets.begin(),
+                               packets.end());
+      }
+
+      if (session.stopping || !due(id, session)) continue;
+      session.nextDeliveryNs = now + session.pollMs * 1000000ULL;
+      if (!session.pending.empty()) dueIds.push_back(id);
+    }
+  }
+
+  // The sinks are invoked one at a time without holding mSessionMutex. Sessions
+  // which started stopping in the meantime are skipped, StopSessionLocked hands
+  // them their pending packets instead.
+  for (SessionId id : dueIds) {
+    EventSink sink;
+    std::vector<PacketTrace> batch;
+    {
+      std::scoped_lock<std::mutex> slock(mSessionMutex);
+      auto it = mSessions.find(id);
+      if (it == mSessions.end() || it->second.stopping) continue;
+      it->second.delivering = true;
+      sink = it->second.sink;
+      batch.swap(it->second.pending);
+    }
+
+    sink(batch);
+
+    {
+      std::scoped_lock<std::mutex> slock(mSessionMutex);
+      mSessions.at(id).delivering = false;
+    }
+    mSessionCv.notify_all();
+  }
 
   return true;
 }
@@ -27,6 +27,8 @@
 #include <unistd.h>
 
 #include <chrono>
+#include <future>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -38,6 +40,8 @@ using ::testing::Each;
 using ::testing::Eq;
 using ::testing::Field;
 using ::testing::Test;
+using ::android::base::Error;
+using ::android::base::Result;
 
 namespace android {
 namespace bpf {
@@ -236,6 +240,212 @@ TEST_F(NetworkTracePollerTest, TraceTcpSession) {
       << PacketPrinter{packets};
 }
 
+// Collects the batches delivered to one session, which arrive on the poller's
+// task runner thread.
+struct SessionRecorder {
+  std::mutex mutex;
+  std::vector<PacketTrace> packets;
+  std::vector<std::chrono::steady_clock::time_point> deliveries;
+  std::chrono::steady_clock::time_point firstDelivery;
+
+  NetworkTracePoller::EventSink Sink() {
+    return [this](const std::vector<PacketTrace>& batch) {
+      std::scoped_lock<std::mutex> lock(mutex);
+      if (packets.empty()) firstDelivery = std::chrono::steady_clock::now();
+      packets.insert(packets.end(), batch.begin(), batch.end());
+      deliveries.push_back(std::chrono::steady_clock::now());
+    };
+  }
+
+  size_t Count() {
+    std::scoped_lock<std::mutex> lock(mutex);
+    return packets.size();
+  }
+};
+
+TEST_F(NetworkTracePollerTest, SessionsWithDifferentPollRates) {
+  using std::chrono::milliseconds;
+  constexpr uint32_t kFastPollMs = 20;
+  constexpr uint32_t kSlowPollMs = 1000;
+  constexpr int kDatagrams = 10;
+
+  android::base::unique_fd server(socket(AF_INET, SOCK_DGRAM, 0));
+  ASSERT_NE(-1, server) << "Failed to open server socket";
+  sockaddr_in addr = {.sin_family = AF_INET};
+  socklen_t len = sizeof(addr);
+  ASSERT_EQ(0, bind(server, (sockaddr*)&addr, sizeof(addr)));
+  ASSERT_EQ(0, getsockname(server, (sockaddr*)&addr, &len));
+  const __be16 port = addr.sin_port;
+
+  NetworkTracePoller::EventFilter filter = [port](const PacketTrace& pkt) {
+    return pkt.ipProto == IPPROTO_UDP && pkt.uid == getuid() &&
+           (pkt.sport == port || pkt.dport == port);
+  };
+
+  // Both sessions share the poller, which isn't otherwise used.
+  NetworkTracePoller poller;
+  SessionRecorder fast, slow;
+  auto fastId = poller.StartSession(kFastPollMs, fast.Sink(), filter);
+  ASSERT_TRUE(fastId.has_value());
+  auto slowId = poller.StartSession(kSlowPollMs, slow.Sink(), filter);
+  ASSERT_TRUE(slowId.has_value());
+
+  // Each datagram is seen twice on loopback, on egress and on ingress.
+  android::base::unique_fd client(socket(AF_INET, SOCK_DGRAM, 0));
+  ASSERT_NE(-1, client) << "Failed to open client socket";
+  const auto sent = std::chrono::steady_clock::now();
+  for (int i = 0; i < kDatagrams; i++) {
+    ASSERT_EQ(1, sendto(client, "x", 1, 0, (sockaddr*)&addr, sizeof(addr)))
+        << "failed to send message: " << strerror(errno);
+  }
+  const size_t kExpected = 2 * kDatagrams;
+
+  // Wait for the slow session, by which time the fast one has everything.
+  for (int attempt = 0; attempt < 300 && slow.Count() < kExpected; attempt++) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+
+  ASSERT_TRUE(poller.StopSession(*fastId));
+  ASSERT_TRUE(poller.StopSession(*slowId));
+
+  // Neither session loses or duplicates packets.
+  EXPECT_EQ(fast.packets.size(), kExpected) << PacketPrinter{fast.packets};
+  EXPECT_EQ(slow.packets.size(), kExpected) << PacketPrinter{slow.packets};
+
+  // The fast session isn't held back by the slow one, which coalesces the
+  // traffic into fewer batches.
+  ASSERT_FALSE(fast.deliveries.empty());
+  EXPECT_LT(fast.firstDelivery - sent, milliseconds(kSlowPollMs / 2));
+  EXPECT_LE(slow.deliveries.size(), fast.deliveries.size());
+  EXPECT_LE(slow.deliveries.size(), 2);
+}
+
+// Stopping a session may hold a lock which another session's sink is blocked
+// on, as perfetto does for its instance lock in OnStop.
+TEST_F(NetworkTracePollerTest, StopSessionWhileOtherSinkBlocked) {
+  using std::chrono::seconds;
+
+  android::base::unique_fd server(socket(AF_INET, SOCK_DGRAM, 0));
+  ASSERT_NE(-1, server) << "Failed to open server socket";
+  sockaddr_in addr = {.sin_family = AF_INET};
+  socklen_t len = sizeof(addr);
+  ASSERT_EQ(0, bind(server, (sockaddr*)&addr, sizeof(addr)));
+  ASSERT_EQ(0, getsockname(server, (sockaddr*)&addr, &len));
+  const __be16 port = addr.sin_port;
+
+  NetworkTracePoller::EventFilter filter = [port](const PacketTrace& pkt) {
+    return pkt.ipProto == IPPROTO_UDP && pkt.uid == getuid() &&
+           (pkt.sport == port || pkt.dport == port);
+  };
+
+  std::mutex instanceLock;
+  std::promise<void> entered;
+  std::once_flag enteredOnce;
+  NetworkTracePoller poller;
+  SessionRecorder stopped;
+  auto stoppedId = poller.StartSession(kNeverPoll, stopped.Sink(), filter);
+  ASSERT_TRUE(stoppedId.has_value());
+  auto blockedId = poller.StartSession(
+      kNeverPoll,
+      [&](const std::vector<PacketTrace>&) {
+        std::call_once(enteredOnce, [&] { entered.set_value(); });
+        std::scoped_lock<std::mutex> lock(instanceLock);
+      },
+      filter);
+  ASSERT_TRUE(blockedId.has_value());
+
+  android::base::unique_fd client(socket(AF_INET, SOCK_DGRAM, 0));
+  ASSERT_NE(-1, client) << "Failed to open client socket";
+  ASSERT_EQ(1, sendto(client, "x", 1, 0, (sockaddr*)&addr, sizeof(addr)))
+      << "failed to send message: " << strerror(errno);
+
+  std::unique_lock<std::mutex> held(instanceLock);
+  std::thread poll([&] { poller.ConsumeAll(); });
+  if (entered.get_future().wait_for(seconds(5)) != std::future_status::ready) {
+    held.unlock();
+    poll.join();
+    FAIL() << "Blocking sink was never invoked";
+  }
+
+  auto stop = std::async(std::launch::async,
+                         [&] { return poller.StopSession(*stoppedId); });
+  const bool stopReturned =
+      stop.wait_for(seconds(5)) == std::future_status::ready;
+  held.unlock();
+  poll.join();
+
+  ASSERT_TRUE(stopReturned) << "StopSession blocked on another session's sink";
+  EXPECT_TRUE(stop.get());
+  EXPECT_EQ(stopped.Count(), 2u) << PacketPrinter{stopped.packets};
+  ASSERT_TRUE(poller.StopSession(*blockedId));
+}
+
+// Resolves ifindex N to "ifaceN", failing for ifindexes listed in |missing|.
+IfIndexToNameFunc FakeIfaceNames(const std::vector<uint32_t>& missing = {}) {
+  return [missing](const uint32_t ifindex) -> Result<IfaceValue> {
+    for (uint32_t m : missing) {
+      if (m == ifindex) return Error(ENODEV) << "no such iface";
+    }
+    IfaceValue iv = {};
+    snprintf(iv.name, sizeof(iv.name), "iface%u", ifindex);
+    return iv;
+  };
+}
+
+TEST_F(NetworkTracePollerTest, IfaceStatsEmittedOnlyOnChange) {
+  NetworkTracePoller handler([&](const std::vector<PacketTrace>& pkt) {});
+  std::vector<uint32_t> ifindexes = {1, 2};
+  std::vector<StatsValue> stats = {{.rxBytes = 10, .txBytes = 20},
+                                   {.rxBytes = 30, .txBytes = 40}};
+
+  // Every counter is emitted the first time an iface is seen.
+  EXPECT_EQ(4, handler.TraceIfaceStats(ifindexes, stats, FakeIfaceNames()));
+  EXPECT_EQ(0, handler.TraceIfaceStats(ifindexes, stats, FakeIfaceNames()));
+
+  // Only the counter which changed is emitted again.
+  stats[1].txBytes = 50;
+  EXPECT_EQ(1, handler.TraceIfaceStats(ifindexes, stats, FakeIfaceNames()));
+
+  // Ifaces which can't be resolved are skipped until their stats change.
+  ifindexes.push_back(3);
+  stats.push_back({.rxBytes = 60, .txBytes = 70});
+  EXPECT_EQ(0, handler.TraceIfaceStats(ifindexes, stats, FakeIfaceNames({3})));
+  EXPECT_EQ(0, handler.TraceIfaceStats(ifindexes, stats, FakeIfaceNames()));
+  stats[2].rxBytes = 80;
+  EXPECT_EQ(2, handler.TraceIfaceStats(ifindexes, stats, FakeIfaceNames()));
+}
+
+TEST_F(NetworkTracePollerTest, IfaceStatsPollCost) {
+  constexpr int kIfaces = 50;
+  constexpr int kPolls = 10000;
+  NetworkTracePoller handler([&](const std::vector<PacketTrace>& pkt) {});
+  std::vector<uint32_t> ifindexes;
+  std::vector<StatsValue> stats;
+  for (int i = 1; i <= kIfaces; i++) {
+    ifindexes.push_back(i);
+    stats.push_back({.rxBytes = 0, .txBytes = 0});
+  }
+  int lookups = 0;
+  const IfIndexToNameFunc fakeNames = FakeIfaceNames();
+  const IfIndexToNameFunc names = [&](const uint32_t ifindex) {
+    lookups++;
+    return fakeNames(ifindex);
+  };
+
+  // A typical poll where a couple of ifaces saw traffic: after the first poll
+  // has emitted every counter, only the two changed ones are resolved and
+  // emitted, however many ifaces are in the map.
+  int emitted = 0;
+  for (int poll = 0; poll < kPolls; poll++) {
+    stats[poll % kIfaces].rxBytes += 1500;
+    stats[(poll + 1) % kIfaces].txBytes += 1500;
+    emitted += handler.TraceIfaceStats(ifindexes, stats, names);
+  }
+
+  EXPECT_EQ(2 * kIfaces + 2 * (kPolls - 1), emitted);
+  EXPECT_EQ(kIfaces + 2 * (kPolls - 1), lookups);
+}
+
 }  // namespace internal
 }  // namespace bpf
 }  // namespace android
@@ -100,6 +100,10 @@ void maybeLogUnknownIface(int ifaceIndex, const BpfMapRO<Key, StatsValue>& stats
     }
 }
 
+// For test only
+int bpfGetStatsUpdateErrorsInternal(uint32_t errorKey, StatsValue* lost,
+                                    const base::unique_fd& statsUpdateErrorMap);
+
 // For test only
 int parseBpfNetworkStatsDevInternal(std::vector<stats_line>& lines,
                                     const BpfMapRO<uint32_t, StatsValue>& statsMap,
@@ -109,6 +113,9 @@ void bpfRegisterIface(const char* iface);
 int bpfGetUidStats(uid_t uid, StatsValue* stats);
 int bpfGetIfaceStats(const char* iface, StatsValue* stats);
 int bpfGetIfIndexStats(int ifindex, StatsValue* stats);
+// Traffic which went unaccounted because the stats map identified by errorKey
+// (a StatsUpdateErrorKey) was full, summed across all cpus.
+int bpfGetStatsUpdateErrors(uint32_t errorKey, StatsValue* lost);
 int parseBpfNetworkStatsDetail(std::vector<stats_line>* lines);
 
 int parseBpfNetworkStatsDev(std::vector<stats_line>* lines);
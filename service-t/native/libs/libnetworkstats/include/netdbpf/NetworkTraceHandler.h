@@ -112,7 +112,7 @@ class NetworkTraceHandler
       ::perfetto::protos::pbzero::TracePacket* dst);
 
   static internal::NetworkTracePoller sPoller;
-  bool mStarted;
+  std::optional<internal::NetworkTracePoller::SessionId> mSessionId;
   bool mIsTest;
 
   // Values from config, see proto for details.
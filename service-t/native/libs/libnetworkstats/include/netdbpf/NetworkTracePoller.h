@@ -19,12 +19,17 @@
 #include <perfetto/base/task_runner.h>
 #include <perfetto/tracing.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "android-base/thread_annotations.h"
 #include "bpf/BpfMap.h"
 #include "bpf/BpfRingbuf.h"
+#include "netdbpf/BpfNetworkStats.h"
 
 // For PacketTrace struct definition
 #include "netd.h"
@@ -39,31 +44,108 @@ namespace internal {
 class NetworkTracePoller {
  public:
   using EventSink = std::function<void(const std::vector<PacketTrace>&)>;
+  // Decides whether a session wants a packet. A null filter accepts all.
+  using EventFilter = std::function<bool(const PacketTrace&)>;
+  using SessionId = uint32_t;
+
+  NetworkTracePoller() = default;
 
   // Testonly: initialize with a callback capable of intercepting data.
   NetworkTracePoller(EventSink callback) : mCallback(std::move(callback)) {}
 
-  // Starts tracing with the given poll interval.
+  // Starts a session delivering all packets to the constructor callback with
+  // the given poll interval.
   bool Start(uint32_t pollMs) EXCLUDES(mMutex);
 
-  // Stops tracing and release any held state.
+  // Stops the most recent session started with Start().
   bool Stop() EXCLUDES(mMutex);
 
-  // Consumes all available events from the ringbuffer.
-  bool ConsumeAll() EXCLUDES(mBufferMutex);
+  // Starts a session which receives the packets accepted by filter in batches,
+  // once every pollMs. The ring buffer is drained at the smallest poll interval
+  // of all active sessions, and slower sessions accumulate packets until their
+  // next delivery is due.
+  std::optional<SessionId> StartSession(uint32_t pollMs, EventSink sink,
+                                        EventFilter filter = nullptr)
+      EXCLUDES(mMutex);
+
+  // Stops a session, after delivering any packets still pending for it. The
+  // sink is never invoked again once this returns, so this waits for an
+  // in-progress delivery and must not be called from the session's own sink.
+  bool StopSession(SessionId id) EXCLUDES(mMutex);
+
+  // Consumes all available events from the ringbuffer, and delivers them along
+  // with any pending packets to every session.
+  bool ConsumeAll() EXCLUDES(mBufferMutex, mSessionMutex);
+
+  // Testonly: updates the per-iface counter tracks from a snapshot of the iface
+  // stats map, resolving names with the given function. Returns the number of
+  // counter values emitted.
+  int TraceIfaceStats(const std::vector<uint32_t>& ifindexes,
+                      const std::vector<StatsValue>& stats,
+                      const IfIndexToNameFunc& ifindex2name)
+      EXCLUDES(mIfaceMutex);
 
  private:
+  // A slow session delivers early once it has this many packets pending, which
+  // bounds the memory used by sessions with very long poll intervals.
+  static constexpr size_t kMaxPendingPackets = 16384;
+
+  struct Session {
+    uint32_t pollMs;
+    EventSink sink;
+    EventFilter filter;
+    std::vector<PacketTrace> pending;
+    uint64_t nextDeliveryNs;
+    // Set once StopSession starts, after which only it delivers to the sink.
+    bool stopping = false;
+    // Whether the sink is being invoked, outside of mSessionMutex.
+    bool delivering = false;
+  };
+
+  // Returns whether a session's pending packets should be delivered now.
+  using DeliveryPolicy = std::function<bool(SessionId, const Session&)>;
+
+  // The atrace counter tracks of a single iface. Track names are built once and
+  // only rebuilt if the iface is renamed.
+  struct IfaceTrack {
+    IfaceValue name;
+    std::string rxTrack;
+    std::string txTrack;
+    uint64_t rxBytes;
+    uint64_t txBytes;
+  };
+
+  std::optional<SessionId> StartSessionLocked(uint32_t pollMs, EventSink sink,
+                                              EventFilter filter)
+      REQUIRES(mMutex);
+  bool StopSessionLocked(SessionId id) REQUIRES(mMutex);
+
+  // Restarts polling at the smallest poll interval of the active sessions, if
+  // that changed.
+  void UpdatePollInterval() REQUIRES(mMutex);
+
   // Poll the ring buffer for new data and schedule another run of ourselves
   // after poll_ms (essentially polling periodically until stopped). This takes
   // in the runner and poll duration to prevent a hard requirement on the lock
   // and thus a deadlock while resetting the TaskRunner. The runner pointer is
-  // always valid within tasks run by that runner.
-  void PollAndSchedule(perfetto::base::TaskRunner* runner, uint32_t poll_ms);
-
-  // Record sparse iface stats via atrace. This queries the per-iface stats maps
-  // for any iface present in the vector of packets. This is inexact, but should
-  // have sufficient coverage given these are cumulative counters.
-  static void TraceIfaces(const std::vector<PacketTrace>& packets);
+  // always valid within tasks run by that runner. Each chain of polls stops as
+  // soon as the poll interval changes, at which point a new chain is started.
+  void PollAndSchedule(perfetto::base::TaskRunner* runner, uint32_t poll_ms,
+                       uint32_t generation);
+
+  // Drains the ring buffer into the pending packets of each session, then
+  // delivers the pending packets of the sessions the policy selects.
+  bool Consume(const DeliveryPolicy& due)
+      EXCLUDES(mBufferMutex, mSessionMutex);
+
+  // Record iface stats via atrace. This reads the whole iface stats map in one
+  // go and emits counter values for the ifaces whose stats changed since the
+  // previous poll.
+  void TraceIfaces() EXCLUDES(mIfaceMutex);
+  int TraceIfaceStatsLocked(const std::vector<uint32_t>& ifindexes,
+                            const std::vector<StatsValue>& stats,
+                            const IfIndexToNameFunc& ifindex2name)
+      REQUIRES(mIfaceMutex);
 
   std::mutex mMutex;
 
@@ -72,16 +154,35 @@ class NetworkTracePoller {
   // Without this separation, Stop() can deadlock.
   std::mutex mBufferMutex;
 
+  // The mSessionMutex protects the sessions. It is not held while invoking the
+  // sinks, which may take locks (e.g. the perfetto instance lock) that are also
+  // held while stopping a session. Instead, stopping a session waits on
+  // mSessionCv until its sink isn't being invoked.
+  std::mutex mSessionMutex;
+  std::condition_variable mSessionCv;
+
   // Records the number of successfully started active sessions so that only the
   // first active session attempts setup and only the last cleans up. Note that
   // the session count will remain zero if Start fails. It is expected that Stop
   // will not be called for any trace session where Start fails.
-  int mSessionCount GUARDED_BY(mMutex);
+  int mSessionCount GUARDED_BY(mMutex) = 0;
+
+  // The id to give to the next session.
+  SessionId mNextSessionId GUARDED_BY(mMutex) = 0;
+
+  // The sessions started with Start(), in order.
+  std::vector<SessionId> mCallbackSessions GUARDED_BY(mMutex);
 
-  // How often to poll the ring buffer, defined by the trace config.
-  uint32_t mPollMs GUARDED_BY(mMutex);
+  // How often to poll the ring buffer, the smallest interval of all sessions.
+  uint32_t mPollMs GUARDED_BY(mMutex) = 0;
 
-  // The function to process PacketTrace, typically a Perfetto sink.
+  // Identifies the current chain of polls, see PollAndSchedule.
+  std::atomic<uint32_t> mPollGeneration = 0;
+
+  // The active sessions.
+  std::unordered_map<SessionId, Session> mSessions GUARDED_BY(mSessionMutex);
+
+  // The function to process PacketTrace for sessions started with Start().
   const EventSink mCallback;
 
   // The BPF ring buffer handle.
@@ -90,6 +191,21 @@ class NetworkTracePoller {
   // The packet tracing config map (really a 1-element array).
   BpfMap<uint32_t, bool> mConfigurationMap GUARDED_BY(mMutex);
 
+  // The mIfaceMutex protects the iface counter tracks, which are updated from
+  // ConsumeAll and therefore cannot rely on mMutex being held.
+  std::mutex mIfaceMutex;
+
+  // The per-iface stats map, read on each poll.
+  BpfMapRO<uint32_t, StatsValue> mIfaceStatsMap GUARDED_BY(mIfaceMutex);
+
+  // Scratch space for reading mIfaceStatsMap, kept to avoid reallocating.
+  std::vector<uint32_t> mIfaceStatsKeys GUARDED_BY(mIfaceMutex);
+  std::vector<StatsValue> mIfaceStatsValues GUARDED_BY(mIfaceMutex);
+
+  // The counter tracks keyed by ifindex. This is cleared whenever tracing
+  // starts so that every trace begins with the current value of each counter.
+  std::unordered_map<uint32_t, IfaceTrack> mIfaceTracks GUARDED_BY(mIfaceMutex);
+
   // This must be the last member, causing it to be the first deleted. If it is
   // not, members required for callbacks can be deleted before it's stopped.
   std::unique_ptr<perfetto::base::TaskRunner> mTaskRunner GUARDED_BY(mMutex);
@@ -1039,6 +1039,18 @@ public class NetworkStatsService extends INetworkStatsService.Stub {
         public NetworkStats.Entry nativeGetUidStat(int uid) {
             return NetworkStatsService.nativeGetUidStat(uid);
         }
+
+        /**
+         * Retrieves the traffic which could not be accounted because a stats map was full.
+         *
+         * @param errorKey The StatsUpdateErrorKey (see netd.h) identifying the stats map.
+         * @return A NetworkStats.Entry containing the unaccounted traffic, or
+         *         null if an error occurs.
+         */
+        @Nullable
+        public NetworkStats.Entry nativeGetStatsUpdateErrors(int errorKey) {
+            return NetworkStatsService.nativeGetStatsUpdateErrors(errorKey);
+        }
     }
 
     /**
@@ -3142,6 +3154,7 @@ public class NetworkStatsService extends INetworkStatsService.Stub {
             dumpStatsMapLocked(mStatsMapA, pw, "mStatsMapA");
             dumpStatsMapLocked(mStatsMapB, pw, "mStatsMapB");
             dumpIfaceStatsMapLocked(pw);
+            dumpStatsUpdateErrors(pw);
             pw.decreaseIndent();
 
             pw.println();
@@ -3296,6 +3309,28 @@ public class NetworkStatsService extends INetworkStatsService.Stub {
                 });
     }
 
+    // Must match enum StatsUpdateErrorKey in netd.h.
+    private static final String[] STATS_UPDATE_ERROR_MAP_NAMES = {
+            "mAppUidStatsMap", "mIfaceStatsMap", "mStatsMapA", "mStatsMapB"};
+
+    private void dumpStatsUpdateErrors(final IndentingPrintWriter pw) {
+        pw.println("Traffic lost due to full stats maps: map rxBytes rxPackets txBytes txPackets");
+        pw.increaseIndent();
+        for (int i = 0; i < STATS_UPDATE_ERROR_MAP_NAMES.length; i++) {
+            final NetworkStats.Entry lost = mDeps.nativeGetStatsUpdateErrors(i);
+            if (lost == null) {
+                pw.println(STATS_UPDATE_ERROR_MAP_NAMES[i] + " unavailable");
+                continue;
+            }
+            pw.println(STATS_UPDATE_ERROR_MAP_NAMES[i] + " "
+                    + lost.rxBytes + " "
+                    + lost.rxPackets + " "
+                    + lost.txBytes + " "
+                    + lost.txPackets);
+        }
+        pw.decreaseIndent();
+    }
+
     private NetworkStats readNetworkStatsSummaryXt() {
         try {
             return mStatsFactory.readNetworkStatsSummaryXt();
@@ -3659,6 +3694,8 @@ public class NetworkStatsService extends INetworkStatsService.Stub {
     private static native NetworkStats.Entry nativeGetIfaceStat(String iface);
     @Nullable
     private static native NetworkStats.Entry nativeGetUidStat(int uid);
+    @Nullable
+    private static native NetworkStats.Entry nativeGetStatsUpdateErrors(int errorKey);
 
     /** Initializes and registers the Perfetto Network Trace data source */
     public static native void nativeInitNetworkTracing();
@@ -19,6 +19,7 @@ package com.android.server;
 import static android.net.BpfNetMapsConstants.CONFIGURATION_MAP_PATH;
 import static android.net.BpfNetMapsConstants.COOKIE_TAG_MAP_PATH;
 import static android.net.BpfNetMapsConstants.CURRENT_STATS_MAP_CONFIGURATION_KEY;
+import static android.net.BpfNetMapsConstants.CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY;
 import static android.net.BpfNetMapsConstants.DATA_SAVER_DISABLED;
 import static android.net.BpfNetMapsConstants.DATA_SAVER_ENABLED;
 import static android.net.BpfNetMapsConstants.DATA_SAVER_ENABLED_KEY;
@@ -26,7 +27,9 @@ import static android.net.BpfNetMapsConstants.DATA_SAVER_ENABLED_MAP_PATH;
 import static android.net.BpfNetMapsConstants.IIF_MATCH;
 import static android.net.BpfNetMapsConstants.INGRESS_DISCARD_MAP_PATH;
 import static android.net.BpfNetMapsConstants.LOCKDOWN_VPN_MATCH;
+import static android.net.BpfNetMapsConstants.UID_OWNER_MAP_B_PATH;
 import static android.net.BpfNetMapsConstants.UID_OWNER_MAP_PATH;
+import static android.net.BpfNetMapsConstants.UID_PERMISSION_GENERATION_KEY;
 import static android.net.BpfNetMapsConstants.UID_PERMISSION_MAP_PATH;
 import static android.net.BpfNetMapsConstants.UID_RULES_CONFIGURATION_KEY;
 import static android.net.BpfNetMapsUtils.getMatchByFirewallChain;
@@ -58,12 +61,14 @@ import android.os.ServiceSpecificException;
 import android.os.UserHandle;
 import android.system.ErrnoException;
 import android.system.Os;
+import android.util.ArrayMap;
 import android.util.ArraySet;
 import android.util.IndentingPrintWriter;
 import android.util.Log;
 import android.util.Pair;
 import android.util.StatsEvent;
 
+import androidx.annotation.Nullable;
 import androidx.annotation.RequiresApi;
 
 import com.android.internal.annotations.VisibleForTesting;
@@ -87,6 +92,7 @@ import java.io.IOException;
 import java.net.InetAddress;
 import java.util.Arrays;
 import java.util.List;
+import java.util.Map;
 import java.util.Set;
 import java.util.StringJoiner;
 
@@ -118,13 +124,24 @@ public class BpfNetMaps {
     // BpfNetMaps is an only writer of this entry.
     private static final Object sCurrentStatsMapConfigLock = new Object();
 
+    // Lock for sConfigurationMap entry for UID_PERMISSION_GENERATION_KEY.
+    // BpfNetMaps acquires this lock while sequence of read, modify, and write.
+    // BpfNetMaps is an only writer of this entry.
+    private static final Object sUidPermissionGenerationLock = new Object();
+
     private static final long UID_RULES_DEFAULT_CONFIGURATION = 0;
     private static final long STATS_SELECT_MAP_A = 0;
     private static final long STATS_SELECT_MAP_B = 1;
+    private static final long UID_OWNER_SELECT_MAP_A = 0;
+    private static final long UID_OWNER_SELECT_MAP_B = 1;
 
     private static IBpfMap<S32, U32> sConfigurationMap = null;
     // BpfMap for UID_OWNER_MAP_PATH. This map is not accessed by others.
     private static IBpfMap<S32, UidOwnerValue> sUidOwnerMap = null;
+    // BpfMap for UID_OWNER_MAP_B_PATH. Holds the same rules as sUidOwnerMap, except while
+    // replaceUidChain is running. Guarded by the sUidOwnerMap lock, as is the
+    // CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY entry of sConfigurationMap.
+    private static IBpfMap<S32, UidOwnerValue> sUidOwnerMapB = null;
     private static IBpfMap<S32, U8> sUidPermissionMap = null;
     private static IBpfMap<CookieTagMapKey, CookieTagMapValue> sCookieTagMap = null;
     // TODO: Add BOOL class and replace U8?
@@ -152,6 +169,14 @@ public class BpfNetMaps {
         sUidOwnerMap = uidOwnerMap;
     }
 
+    /**
+     * Set uidOwnerMapB for test.
+     */
+    @VisibleForTesting
+    public static void setUidOwnerMapBForTest(IBpfMap<S32, UidOwnerValue> uidOwnerMapB) {
+        sUidOwnerMapB = uidOwnerMapB;
+    }
+
     /**
      * Set uidPermissionMap for test.
      */
@@ -206,6 +231,16 @@ public class BpfNetMaps {
         }
     }
 
+    @RequiresApi(Build.VERSION_CODES.TIRAMISU)
+    private static IBpfMap<S32, UidOwnerValue> getUidOwnerMapB() {
+        try {
+            return SingleWriterBpfMap.getSingleton(
+                    UID_OWNER_MAP_B_PATH, S32.class, UidOwnerValue.class);
+        } catch (ErrnoException e) {
+            throw new IllegalStateException("Cannot open uid owner map B", e);
+        }
+    }
+
     @RequiresApi(Build.VERSION_CODES.TIRAMISU)
     private static IBpfMap<S32, U8> getUidPermissionMap() {
         try {
@@ -264,6 +299,13 @@ public class BpfNetMaps {
         } catch (ErrnoException e) {
             throw new IllegalStateException("Failed to initialize current stats configuration", e);
         }
+        try {
+            sConfigurationMap.updateEntry(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY,
+                    new U32(UID_OWNER_SELECT_MAP_A));
+        } catch (ErrnoException e) {
+            throw new IllegalStateException(
+                    "Failed to initialize current uid owner map configuration", e);
+        }
 
         if (sUidOwnerMap == null) {
             sUidOwnerMap = getUidOwnerMap();
@@ -274,6 +316,15 @@ public class BpfNetMaps {
             throw new IllegalStateException("Failed to initialize uid owner map", e);
         }
 
+        if (sUidOwnerMapB == null) {
+            sUidOwnerMapB = getUidOwnerMapB();
+        }
+        try {
+            sUidOwnerMapB.clear();
+        } catch (ErrnoException e) {
+            throw new IllegalStateException("Failed to initialize uid owner map B", e);
+        }
+
         if (sUidPermissionMap == null) {
             sUidPermissionMap = getUidPermissionMap();
         }
@@ -402,11 +453,7 @@ public class BpfNetMaps {
                         oldMatch.rule & ~match
                 );
 
-                if (newMatch.rule == 0) {
-                    sUidOwnerMap.deleteEntry(new S32(uid));
-                } else {
-                    sUidOwnerMap.updateEntry(new S32(uid), newMatch);
-                }
+                writeUidOwnerValue(uid, (newMatch.rule == 0) ? null : newMatch);
             }
         } catch (ErrnoException e) {
             throw new ServiceSpecificException(e.errno,
@@ -436,7 +483,7 @@ public class BpfNetMaps {
                             match
                     );
                 }
-                sUidOwnerMap.updateEntry(new S32(uid), newMatch);
+                writeUidOwnerValue(uid, newMatch);
             }
         } catch (ErrnoException e) {
             throw new ServiceSpecificException(e.errno,
@@ -448,6 +495,83 @@ public class BpfNetMaps {
         addRule(uid, match, 0 /* iif */, caller);
     }
 
+    // Writes the rules of the uid, or deletes them if null, to the given uid owner map.
+    private static void writeUidOwnerValue(final IBpfMap<S32, UidOwnerValue> map, final int uid,
+            @Nullable final UidOwnerValue value) throws ErrnoException {
+        if (value == null) {
+            map.deleteEntry(new S32(uid));
+        } else {
+            map.updateEntry(new S32(uid), value);
+        }
+    }
+
+    private static void writeUidOwnerValues(final IBpfMap<S32, UidOwnerValue> map,
+            final Map<Integer, UidOwnerValue> values) throws ErrnoException {
+        for (final Map.Entry<Integer, UidOwnerValue> e : values.entrySet()) {
+            writeUidOwnerValue(map, e.getKey(), e.getValue());
+        }
+    }
+
+    // Updates the rules of a single uid in both uid owner maps.
+    // Must be called while holding the sUidOwnerMap lock.
+    private static void writeUidOwnerValue(final int uid, @Nullable final UidOwnerValue value)
+            throws ErrnoException {
+        writeUidOwnerValue(sUidOwnerMap, uid, value);
+        writeUidOwnerValue(sUidOwnerMapB, uid, value);
+    }
+
+    // Updates the rules of many uids, such that the bpf programs see either all or none of the
+    // changes: they are written to the uid owner map not in use, which is then switched to, after
+    // which the other map is brought up to date. On failure before the switch nothing changes.
+    // Must be called while holding the sUidOwnerMap lock.
+    private static void replaceUidOwnerValues(final Map<Integer, UidOwnerValue> newValues,
+            final Map<Integer, UidOwnerValue> oldValues) throws ErrnoException {
+        if (newValues.isEmpty()) return;
+
+        final boolean mapAInUse = sConfigurationMap.getValue(
+                CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val == UID_OWNER_SELECT_MAP_A;
+        final IBpfMap<S32, UidOwnerValue> inUse = mapAInUse ? sUidOwnerMap : sUidOwnerMapB;
+        final IBpfMap<S32, UidOwnerValue> notInUse = mapAInUse ? sUidOwnerMapB : sUidOwnerMap;
+        try {
+            writeUidOwnerValues(notInUse, newValues);
+            sConfigurationMap.updateEntry(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY,
+                    new U32(mapAInUse ? UID_OWNER_SELECT_MAP_B : UID_OWNER_SELECT_MAP_A));
+        } catch (ErrnoException e) {
+            try {
+                writeUidOwnerValues(notInUse, oldValues);
+            } catch (ErrnoException rollbackException) {
+                resyncUidOwnerMap(notInUse, inUse);
+            }
+            throw e;
+        }
+        try {
+            writeUidOwnerValues(inUse, newValues);
+        } catch (ErrnoException e) {
+            // The new rules are already in effect, only the stale copy needs fixing.
+            resyncUidOwnerMap(inUse, notInUse);
+        }
+    }
+
+    // Rebuilds a uid owner map from the other one, after a failed write left them diverged.
+    // Otherwise the rules in the stale map would come back into effect at the next switch.
+    // Must be called while holding the sUidOwnerMap lock.
+    private static void resyncUidOwnerMap(final IBpfMap<S32, UidOwnerValue> stale,
+            final IBpfMap<S32, UidOwnerValue> active) {
+        try {
+            final Set<S32> staleUids = new ArraySet<>();
+            stale.forEach((uid, value) -> staleUids.add(uid));
+            active.forEach((uid, value) -> {
+                stale.updateEntry(uid, value);
+                staleUids.remove(uid);
+            });
+            for (final S32 uid : staleUids) {
+                stale.deleteEntry(uid);
+            }
+        } catch (ErrnoException e) {
+            Log.wtf(TAG, "Failed to resync the uid owner maps: " + e);
+        }
+    }
+
     /**
      * Set target firewall child chain
      *
@@ -519,7 +643,9 @@ public class BpfNetMaps {
             throw new IllegalArgumentException("Invalid firewall chain: " + chain);
         }
         final Set<Integer> uidSet = asSet(uids);
-        final Set<Integer> uidSetToRemoveRule = new ArraySet<>();
+        // The previous and new rules of every uid whose rules change, null meaning no rules.
+        final Map<Integer, UidOwnerValue> oldValues = new ArrayMap<>();
+        final Map<Integer, UidOwnerValue> newValues = new ArrayMap<>();
         try {
             synchronized (sUidOwnerMap) {
                 sUidOwnerMap.forEach((uid, config) -> {
@@ -529,18 +655,24 @@ public class BpfNetMaps {
                     if (config == null) {
                         Log.wtf(TAG, "sUidOwnerMap entry was deleted while holding a lock");
                     } else if (!uidSet.contains((int) uid.val) && (config.rule & match) != 0) {
-                        uidSetToRemoveRule.add((int) uid.val);
+                        final long rule = config.rule & ~match;
+                        oldValues.put((int) uid.val, config);
+                        newValues.put((int) uid.val,
+                                (rule == 0) ? null : new UidOwnerValue(config.iif, rule));
                     }
                 });
 
-                for (final int uid : uidSetToRemoveRule) {
-                    removeRule(uid, match, "replaceUidChain");
-                }
-                for (final int uid : uids) {
-                    addRule(uid, match, "replaceUidChain");
+                for (final int uid : uidSet) {
+                    final UidOwnerValue config = sUidOwnerMap.getValue(new S32(uid));
+                    if (config != null && (config.rule & match) != 0) continue;
+                    oldValues.put(uid, config);
+                    newValues.put(uid, (config == null) ? new UidOwnerValue(0, match)
+                            : new UidOwnerValue(config.iif, config.rule | match));
                 }
+
+                replaceUidOwnerValues(newValues, oldValues);
             }
-        } catch (ErrnoException | ServiceSpecificException e) {
+        } catch (ErrnoException e) {
             Log.e(TAG, "replaceUidChain failed: " + e);
         }
     }
@@ -787,24 +919,45 @@ public class BpfNetMaps {
             return;
         }
 
-        // Remove the entry if package is uninstalled or uid has only INTERNET permission.
-        if (permissions == PERMISSION_UNINSTALLED || permissions == PERMISSION_INTERNET) {
+        try {
+            // Remove the entry if package is uninstalled or uid has only INTERNET permission.
+            if (permissions == PERMISSION_UNINSTALLED || permissions == PERMISSION_INTERNET) {
+                for (final int uid : uids) {
+                    try {
+                        sUidPermissionMap.deleteEntry(new S32(uid));
+                    } catch (ErrnoException e) {
+                        Log.e(TAG, "Failed to remove uid " + uid + " from permission map: " + e);
+                    }
+                }
+                return;
+            }
+
             for (final int uid : uids) {
                 try {
-                    sUidPermissionMap.deleteEntry(new S32(uid));
+                    sUidPermissionMap.updateEntry(new S32(uid), new U8((short) permissions));
                 } catch (ErrnoException e) {
-                    Log.e(TAG, "Failed to remove uid " + uid + " from permission map: " + e);
+                    Log.e(TAG, "Failed to set permission "
+                            + permissions + " to uid " + uid + ": " + e);
                 }
             }
-            return;
+        } finally {
+            bumpUidPermissionGeneration();
         }
+    }
 
-        for (final int uid : uids) {
+    /**
+     * Invalidates the permission caches of uid_permission_map readers (netd's BpfHandler).
+     * Must be called after, never before, the uid_permission_map update.
+     */
+    @RequiresApi(Build.VERSION_CODES.TIRAMISU)
+    private void bumpUidPermissionGeneration() {
+        synchronized (sUidPermissionGenerationLock) {
             try {
-                sUidPermissionMap.updateEntry(new S32(uid), new U8((short) permissions));
+                final U32 generation = sConfigurationMap.getValue(UID_PERMISSION_GENERATION_KEY);
+                final long next = generation == null ? 1 : (generation.val + 1) & 0xffffffffL;
+                sConfigurationMap.updateEntry(UID_PERMISSION_GENERATION_KEY, new U32(next));
             } catch (ErrnoException e) {
-                Log.e(TAG, "Failed to set permission "
-                        + permissions + " to uid " + uid + ": " + e);
+                Log.wtf(TAG, "Failed to bump uid permission generation: " + e);
             }
         }
     }
@@ -1017,6 +1170,18 @@ public class BpfNetMaps {
         }
     }
 
+    private void dumpCurrentUidOwnerMapConfig(final IndentingPrintWriter pw) {
+        try {
+            final long config =
+                    sConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val;
+            final String currentUidOwnerMap = (config == UID_OWNER_SELECT_MAP_A)
+                    ? "SELECT_UID_OWNER_MAP_A" : "SELECT_UID_OWNER_MAP_B";
+            pw.println("current uidOwnerMap configuration: " + config + " " + currentUidOwnerMap);
+        } catch (ErrnoException e) {
+            pw.println("Failed to read current uidOwnerMap configuration: " + e);
+        }
+    }
+
     private void dumpDataSaverConfig(final IndentingPrintWriter pw) {
         try {
             final short config = sDataSaverEnabledMap.getValue(DATA_SAVER_ENABLED_KEY).val;
@@ -1054,6 +1219,7 @@ public class BpfNetMaps {
 
             dumpOwnerMatchConfig(pw);
             dumpCurrentStatsMapConfig(pw);
+            dumpCurrentUidOwnerMapConfig(pw);
             pw.println();
 
             // TODO: Remove CookieTagMap content dump
@@ -323,6 +323,7 @@ import com.android.modules.utils.build.SdkLevel;
 import com.android.net.module.util.BaseNetdUnsolicitedEventListener;
 import com.android.net.module.util.BinderUtils;
 import com.android.net.module.util.BitUtils;
+import com.android.net.module.util.BpfMap;
 import com.android.net.module.util.BpfUtils;
 import com.android.net.module.util.CollectionUtils;
 import com.android.net.module.util.DeviceConfigUtils;
@@ -334,7 +335,9 @@ import com.android.net.module.util.LocationPermissionChecker;
 import com.android.net.module.util.PerUidCounter;
 import com.android.net.module.util.PermissionUtils;
 import com.android.net.module.util.RoutingCoordinatorService;
+import com.android.net.module.util.Struct.S32;
 import com.android.net.module.util.TcUtils;
+import com.android.net.module.util.bpf.IngressRateLimitValue;
 import com.android.net.module.util.netlink.InetDiagMessage;
 import com.android.networkstack.apishim.BroadcastOptionsShimImpl;
 import com.android.networkstack.apishim.ConstantsShim;
@@ -380,6 +383,7 @@ import libcore.io.IoUtils;
 
 import org.xmlpull.v1.XmlPullParserException;
 
+import java.io.File;
 import java.io.FileDescriptor;
 import java.io.IOException;
 import java.io.InterruptedIOException;
@@ -954,6 +958,24 @@ public class ConnectivityService extends IConnectivityManager.Stub
     private static final String TC_POLICE_BPF_PROG_PATH =
             "/sys/fs/bpf/netd_shared/prog_netd_schedact_ingress_account";
 
+    /**
+     * The BPF programs implementing the ECN marking rate limiter, attached at TC_PRIO_POLICE
+     * instead of tc-police when available.
+     */
+    private static final String TC_RATELIMIT_ETHER_BPF_PROG_PATH =
+            "/sys/fs/bpf/netd_shared/prog_netd_schedcls_ingress_ratelimit_ether";
+    private static final String TC_RATELIMIT_RAWIP_BPF_PROG_PATH =
+            "/sys/fs/bpf/netd_shared/prog_netd_schedcls_ingress_ratelimit_rawip";
+    private static final String INGRESS_RATELIMIT_MAP_PATH =
+            "/sys/fs/bpf/netd_shared/map_netd_ingress_ratelimit_map";
+
+    /**
+     * The burst size of the BPF rate limiter, ECN marking starts once half of it is used up.
+     * TCP IW10 means servers send 10 mtus worth of data on initial connect, and LRO capable
+     * nics may aggregate up to 64KiB, so stay well above both.
+     */
+    private static final long INGRESS_RATE_LIMIT_BURST_BYTES = 128 * 1024;
+
     private static String eventName(int what) {
         return sMagicDecoderRing.get(what, Integer.toString(what));
     }
@@ -1648,7 +1670,8 @@ public class ConnectivityService extends IConnectivityManager.Stub
         }
 
         /**
-         * Wraps {@link TcUtils#tcFilterAddDevIngressPolice}
+         * Enables the BPF ECN marking rate limiter if available, otherwise wraps
+         * {@link TcUtils#tcFilterAddDevIngressPolice}
          */
         public void enableIngressRateLimit(String iface, long rateInBytesPerSecond) {
             final InterfaceParams params = InterfaceParams.getByName(iface);
@@ -1657,6 +1680,10 @@ public class ConnectivityService extends IConnectivityManager.Stub
                 logw("Failed to get interface params for interface " + iface);
                 return;
             }
+            if (new File(TC_RATELIMIT_RAWIP_BPF_PROG_PATH).exists()
+                    && enableBpfIngressRateLimit(iface, params.index, rateInBytesPerSecond)) {
+                return;
+            }
             try {
                 // converting rateInBytesPerSecond from long to int is safe here because the
                 // setting's range is limited to INT_MAX.
@@ -1673,8 +1700,51 @@ public class ConnectivityService extends IConnectivityManager.Stub
             }
         }
 
+        private boolean enableBpfIngressRateLimit(String iface, int ifIndex,
+                long rateInBytesPerSecond) {
+            final String progPath;
+            try {
+                progPath = TcUtils.isEthernet(iface)
+                        ? TC_RATELIMIT_ETHER_BPF_PROG_PATH : TC_RATELIMIT_RAWIP_BPF_PROG_PATH;
+                getIngressRateLimitMap().updateEntry(new S32(ifIndex),
+                        IngressRateLimitValue.fromBurst(rateInBytesPerSecond,
+                                INGRESS_RATE_LIMIT_BURST_BYTES));
+            } catch (IOException | ErrnoException | IllegalArgumentException e) {
+                loge("Failed to configure bpf rate limit on " + iface + ", using tc-police: ", e);
+                return false;
+            }
+            try {
+                Log.i(TAG, "enableIngressRateLimit (bpf) on " + iface + ": "
+                        + rateInBytesPerSecond + "B/s");
+                TcUtils.tcFilterAddDevBpf(ifIndex, true /* ingress */, TC_PRIO_POLICE,
+                        (short) ETH_P_ALL, progPath);
+                return true;
+            } catch (IOException e) {
+                loge("TcUtils.tcFilterAddDevBpf(ifaceIndex=" + ifIndex
+                        + ", ingress=true, PRIO_POLICE, ETH_P_ALL, bpfProgPath=" + progPath
+                        + ") failure, using tc-police: ", e);
+                deleteIngressRateLimitMapEntry(ifIndex);
+                return false;
+            }
+        }
+
+        private static BpfMap<S32, IngressRateLimitValue> getIngressRateLimitMap()
+                throws ErrnoException {
+            return new BpfMap<>(INGRESS_RATELIMIT_MAP_PATH, S32.class,
+                    IngressRateLimitValue.class);
+        }
+
+        private void deleteIngressRateLimitMapEntry(int ifIndex) {
+            if (!new File(INGRESS_RATELIMIT_MAP_PATH).exists()) return;
+            try {
+                getIngressRateLimitMap().deleteEntry(new S32(ifIndex));
+            } catch (ErrnoException e) {
+                loge("Failed to delete ingress rate limit map entry for " + ifIndex + ": ", e);
+            }
+        }
+
         /**
-         * Wraps {@link TcUtils#tcFilterDelDev}
+         * Wraps {@link TcUtils#tcFilterDelDev}, this removes either rate limiter.
          */
         public void disableIngressRateLimit(String iface) {
             final InterfaceParams params = InterfaceParams.getByName(iface);
@@ -1691,6 +1761,7 @@ public class ConnectivityService extends IConnectivityManager.Stub
                 loge("TcUtils.tcFilterDelDev(ifaceIndex=" + params.index
                         + ", ingress=true, PRIO_POLICE, ETH_P_ALL) failure: ", e);
             }
+            deleteIngressRateLimitMapEntry(params.index);
         }
 
         /**
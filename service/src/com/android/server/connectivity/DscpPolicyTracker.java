@@ -24,6 +24,7 @@ import static android.net.NetworkAgent.DSCP_POLICY_STATUS_SUCCESS;
 import static android.system.OsConstants.ETH_P_ALL;
 
 import android.annotation.NonNull;
+import android.annotation.Nullable;
 import android.net.DscpPolicy;
 import android.os.RemoteException;
 import android.system.ErrnoException;
@@ -51,25 +52,34 @@ public class DscpPolicyTracker {
     static final short PRIO_DSCP = 5;
 
     private static final String TAG = DscpPolicyTracker.class.getSimpleName();
-    private static final String PROG_PATH =
+    private static final String ETHER_PROG_PATH =
             "/sys/fs/bpf/net_shared/prog_dscpPolicy_schedcls_set_dscp_ether";
+    private static final String RAWIP_PROG_PATH =
+            "/sys/fs/bpf/net_shared/prog_dscpPolicy_schedcls_set_dscp_rawip";
     // Name is "map + *.o + map_name + map". Can probably shorten this
     private static final String IPV4_POLICY_MAP_PATH = makeMapPath(
             "dscpPolicy_ipv4_dscp_policies");
     private static final String IPV6_POLICY_MAP_PATH = makeMapPath(
             "dscpPolicy_ipv6_dscp_policies");
+    private static final String POLICY_GENERATION_MAP_PATH = makeMapPath(
+            "dscpPolicy_policy_generation");
     private static final int MAX_POLICIES = 16;
 
     private static String makeMapPath(String which) {
         return "/sys/fs/bpf/net_shared/map_" + which + "_map";
     }
 
-    private final boolean mHaveProgram = TcUtils.isBpfProgramUsable(PROG_PATH);
+    private final boolean mHaveEtherProgram = TcUtils.isBpfProgramUsable(ETHER_PROG_PATH);
+    private final boolean mHaveRawIpProgram = TcUtils.isBpfProgramUsable(RAWIP_PROG_PATH);
 
     private Set<String> mAttachedIfaces;
 
     private final BpfMap<Struct.S32, DscpPolicyValue> mBpfDscpIpv4Policies;
     private final BpfMap<Struct.S32, DscpPolicyValue> mBpfDscpIpv6Policies;
+    // Single element map, bumped after every policy map change to invalidate the decisions
+    // cached by the BPF program.
+    private final BpfMap<Struct.S32, Struct.U32> mBpfDscpPolicyGeneration;
+    private long mPolicyGeneration;
 
     // The actual policy rules used by the BPF code to process packets
     // are in mBpfDscpIpv4Policies and mBpfDscpIpv4Policies. Both of
@@ -91,6 +101,22 @@ public class DscpPolicyTracker {
                 Struct.S32.class, DscpPolicyValue.class);
         mBpfDscpIpv6Policies = new BpfMap<>(IPV6_POLICY_MAP_PATH,
                 Struct.S32.class, DscpPolicyValue.class);
+        mBpfDscpPolicyGeneration = new BpfMap<>(POLICY_GENERATION_MAP_PATH,
+                Struct.S32.class, Struct.U32.class);
+        // Continue from the current value, entries cached before a system server restart
+        // must not match a generation reused by this instance.
+        final Struct.U32 generation = mBpfDscpPolicyGeneration.getValue(new Struct.S32(0));
+        mPolicyGeneration = (generation != null) ? generation.val : 0;
+    }
+
+    private void bumpPolicyGeneration() {
+        mPolicyGeneration = (mPolicyGeneration + 1) & 0xFFFFFFFFL;
+        try {
+            mBpfDscpPolicyGeneration.updateEntry(new Struct.S32(0),
+                    new Struct.U32(mPolicyGeneration));
+        } catch (ErrnoException e) {
+            Log.e(TAG, "Failed to update policy generation: ", e);
+        }
     }
 
     private boolean isUnusedIndex(int index) {
@@ -209,18 +235,25 @@ public class DscpPolicyTracker {
         } catch (ErrnoException e) {
             Log.e(TAG, "Failed to insert policy into map: ", e);
             return DSCP_POLICY_STATUS_INSUFFICIENT_PROCESSING_RESOURCES;
+        } finally {
+            // Even a failed insertion may have modified one of the maps.
+            bumpPolicyGeneration();
         }
 
         return DSCP_POLICY_STATUS_SUCCESS;
     }
 
-    private boolean isEthernet(String iface) {
+    /**
+     * Returns the path of the program matching the link layer of iface, or null on failure.
+     */
+    @Nullable
+    private String getProgramPath(String iface) {
         try {
-            return TcUtils.isEthernet(iface);
+            return TcUtils.isEthernet(iface) ? ETHER_PROG_PATH : RAWIP_PROG_PATH;
         } catch (IOException e) {
             Log.e(TAG, "Failed to check ether type", e);
         }
-        return false;
+        return null;
     }
 
     /**
@@ -233,12 +266,13 @@ public class DscpPolicyTracker {
      */
     public void addDscpPolicy(NetworkAgentInfo nai, DscpPolicy policy) {
         String iface = nai.linkProperties.getInterfaceName();
-        if (!isEthernet(iface)) {
-            Log.e(TAG, "DSCP policies are not supported on raw IP interfaces.");
+        final String progPath = getProgramPath(iface);
+        if (progPath == null) {
+            Log.e(TAG, "Unable to determine the link layer type of " + iface);
             sendStatus(nai, policy.getPolicyId(), DSCP_POLICY_STATUS_REQUEST_DECLINED);
             return;
         }
-        if (!mAttachedIfaces.contains(iface) && !attachProgram(iface)) {
+        if (!mAttachedIfaces.contains(iface) && !attachProgram(iface, progPath)) {
             Log.e(TAG, "Unable to attach program");
             sendStatus(nai, policy.getPolicyId(),
                     DSCP_POLICY_STATUS_INSUFFICIENT_PROCESSING_RESOURCES);
@@ -266,6 +300,7 @@ public class DscpPolicyTracker {
         } catch (ErrnoException e) {
             Log.e(TAG, "Failed to delete policy from map: ", e);
         }
+        bumpPolicyGeneration();
 
         if (sendCallback) {
             sendStatus(nai, policyId, status);
@@ -326,12 +361,14 @@ public class DscpPolicyTracker {
     /**
      * Attach BPF program
      */
-    private boolean attachProgram(@NonNull String iface) {
-        if (!mHaveProgram) return false;
+    private boolean attachProgram(@NonNull String iface, @NonNull String progPath) {
+        final boolean haveProgram =
+                ETHER_PROG_PATH.equals(progPath) ? mHaveEtherProgram : mHaveRawIpProgram;
+        if (!haveProgram) return false;
         try {
             NetworkInterface netIface = NetworkInterface.getByName(iface);
             TcUtils.tcFilterAddDevBpf(netIface.getIndex(), false, PRIO_DSCP, (short) ETH_P_ALL,
-                    PROG_PATH);
+                    progPath);
         } catch (IOException e) {
             Log.e(TAG, "Unable to attach to TC on " + iface + ": " + e);
             return false;
@@ -44,4 +44,19 @@ int tcAddIngressPoliceFilter(int ifIndex, uint16_t prio, uint16_t proto,
                              const char *bpfProgPath);
 int tcDeleteFilter(int ifIndex, bool ingress, uint16_t prio, uint16_t proto);
 
+// tcx (6.6+ kernels) attaches programs via a bpf_link instead of a clsact
+// qdisc and cls_bpf filter. There is no protocol match (the program has to
+// check skb->protocol itself) and tcx programs run before any cls_bpf filters.
+// The program stays attached as long as the returned link fd (or a dup of it)
+// is open, so it is automatically detached when the owning process dies.
+// On older kernels callers should fall back to tcAddBpfFilter().
+bool isTcxSupported();
+
+// Returns the (O_CLOEXEC) link fd on success, or -errno on failure.
+int tcxAttachBpfProgram(int ifIndex, bool ingress, const char *bpfProgPath);
+
+// Atomically replaces the program attached via linkFd, without any window in
+// which no program, or both programs, would run.
+int tcxReplaceBpfProgram(int linkFd, const char *bpfProgPath);
+
 } // namespace android
@@ -675,10 +675,9 @@ int tcAddBpfFilter(int ifIndex, bool ingress, uint16_t prio, uint16_t proto,
 //     action bpf object-pinned .. \
 //     drop
 //
-// TODO: tc-police does not do ECN marking, so in the future, we should consider
-// adding a second tc-police filter at a lower priority that rate limits traffic
-// at something like 0.8 times the global rate limit and ecn marks exceeding
-// packets inside a bpf program (but does not drop them).
+// Note: tc-police does not do ECN marking, the netd bpf program
+// schedcls/ingress/ratelimit_{ether,rawip} (which is preferred by
+// ConnectivityService where available) implements a token bucket which does.
 int tcAddIngressPoliceFilter(int ifIndex, uint16_t prio, uint16_t proto,
                              unsigned rateInBytesPerSec,
                              const char *bpfProgPath) {
@@ -729,4 +728,55 @@ int tcDeleteFilter(int ifIndex, bool ingress, uint16_t prio, uint16_t proto) {
   return sendAndProcessNetlinkResponse(&req, sizeof(req));
 }
 
+bool isTcxSupported() {
+  static bool supported = bpf::isAtLeastKernelVersion(6, 6, 0);
+  return supported;
+}
+
+int tcxAttachBpfProgram(int ifIndex, bool ingress, const char *bpfProgPath) {
+  unique_fd bpfFd(bpf::retrieveProgram(bpfProgPath));
+  if (!bpfFd.ok()) {
+    int error = errno;
+    ALOGE("retrieveProgram failed: %d", error);
+    return -error;
+  }
+
+  // Without any BPF_F_BEFORE/BPF_F_AFTER flags this appends the program to the
+  // end of the interface's tcx program list.
+  int linkFd = bpf::createLink(ingress ? BPF_TCX_INGRESS : BPF_TCX_EGRESS,
+                               bpfFd, static_cast<uint32_t>(ifIndex));
+  if (linkFd < 0) {
+    int error = errno;
+    ALOGE("createLink(%s, %d, %s) failed: %d",
+          ingress ? "BPF_TCX_INGRESS" : "BPF_TCX_EGRESS", ifIndex,
+          bpfProgPath, error);
+    return -error;
+  }
+  return linkFd;
+}
+
+int tcxReplaceBpfProgram(int linkFd, const char *bpfProgPath) {
+  unique_fd bpfFd(bpf::retrieveProgram(bpfProgPath));
+  if (!bpfFd.ok()) {
+    int error = errno;
+    ALOGE("retrieveProgram failed: %d", error);
+    return -error;
+  }
+
+  // Note: the link fd is owned by the caller.
+  if (bpf::bpf(BPF_LINK_UPDATE,
+               {
+                   .link_update =
+                       {
+                           .link_fd = static_cast<__u32>(linkFd),
+                           .new_prog_fd = static_cast<__u32>(bpfFd.get()),
+                       },
+               })) {
+    int error = errno;
+    ALOGE("updateLink(%d, %s) failed: %d", linkFd, bpfProgPath, error);
+    return -error;
+  }
+  return 0;
+}
+
 } // namespace android
@@ -151,4 +151,34 @@ TEST(LibTcUtilsTest, AddAndDeleteIngressPoliceFilter) {
             tcDeleteFilter(LOOPBACK_IFINDEX, true /*ingress*/, prio, proto));
 }
 
+// TODO: this should likely be in the tethering module, where using netd.h would be ok
+static constexpr char kTetherDownstream6ProgPath[] =
+    "/sys/fs/bpf/tethering/prog_offload_schedcls_tether_downstream6_ether";
+static constexpr char kTetherUpstream6ProgPath[] =
+    "/sys/fs/bpf/tethering/prog_offload_schedcls_tether_upstream6_ether";
+
+TEST(LibTcUtilsTest, TcxAttachReplaceDetach) {
+  if (!isTcxSupported()) GTEST_SKIP() << "tcx requires a 6.6+ kernel";
+
+  // try to attach a missing program
+  EXPECT_EQ(-ENOENT, tcxAttachBpfProgram(LOOPBACK_IFINDEX, true /*ingress*/,
+                                         "/sys/fs/bpf/tethering/missing"));
+  // unlike cls_bpf no clsact qdisc is needed
+  int linkFd = tcxAttachBpfProgram(LOOPBACK_IFINDEX, true /*ingress*/,
+                                   kTetherDownstream6ProgPath);
+  ASSERT_LE(3, linkFd);
+  EXPECT_EQ(0, tcxReplaceBpfProgram(linkFd, kTetherUpstream6ProgPath));
+  EXPECT_EQ(0, tcxReplaceBpfProgram(linkFd, kTetherDownstream6ProgPath));
+  // a failed replace leaves the link intact
+  EXPECT_EQ(-ENOENT,
+            tcxReplaceBpfProgram(linkFd, "/sys/fs/bpf/tethering/missing"));
+  EXPECT_EQ(0, tcxReplaceBpfProgram(linkFd, kTetherUpstream6ProgPath));
+  // closing the link detaches the program, a new one can then be attached
+  close(linkFd);
+  linkFd = tcxAttachBpfProgram(LOOPBACK_IFINDEX, false /*ingress*/,
+                               kTetherDownstream6ProgPath);
+  ASSERT_LE(3, linkFd);
+  close(linkFd);
+}
+
 } // namespace android
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "netdutils/MemBlock.h"
+
+#include <atomic>
+
+#include <sanitizer/asan_interface.h>
+
+namespace android {
+namespace netdutils {
+namespace {
+
+// Size classes are powers of two from kMinClassSize to MemBlock::kMaxPooledSize.
+constexpr size_t kMinClassSize = 512;
+constexpr size_t kNumClasses = 8;  // 512 B, 1 KiB, ..., 64 KiB
+constexpr size_t kMaxPerClass = 4;
+
+static_assert((kMinClassSize << (kNumClasses - 1)) == MemBlock::kMaxPooledSize);
+
+size_t classIndex(size_t len) {
+    size_t index = 0;
+    while ((kMinClassSize << index) < len) index++;
+    return index;
+}
+
+// Deliberately trivially destructible, so that it stays usable while other thread_local
+// objects (which may own pooled MemBlocks) are destroyed at thread exit.
+struct Pool {
+    uint8_t* blocks[kNumClasses][kMaxPerClass];
+    size_t count[kNumClasses];
+    bool drained;  // thread is exiting, stop caching
+};
+
+thread_local Pool sPool;
+
+// Blocks cached across all threads, only maintained so tests can check nothing leaks.
+std::atomic<size_t> sCachedBlocks{0};
+
+// Frees everything still cached once the owning thread exits.
+struct PoolDrainer {
+    ~PoolDrainer() {
+        for (size_t i = 0; i < kNumClasses; i++) {
+            while (sPool.count[i]) {
+                uint8_t* p = sPool.blocks[i][--sPool.count[i]];
+                sCachedBlocks.fetch_sub(1, std::memory_order_relaxed);
+                ASAN_UNPOISON_MEMORY_REGION(p, kMinClassSize << i);
+                delete[] p;
+            }
+        }
+        sPool.drained = true;
+    }
+};
+
+thread_local PoolDrainer sPoolDrainer;
+
+}  // namespace
+
+MemBlock MemBlock::pooled(size_t len) {
+    if (len == 0U || len > kMaxPooledSize) return uninitialized(len);
+
+    const size_t index = classIndex(len);
+    const size_t capacity = kMinClassSize << index;
+    uint8_t* data;
+    if (sPool.count[index]) {
+        data = sPool.blocks[index][--sPool.count[index]];
+        sCachedBlocks.fetch_sub(1, std::memory_order_relaxed);
+        ASAN_UNPOISON_MEMORY_REGION(data, len);
+    } else {
+        data = new uint8_t[capacity];
+        // Catch overflows into the unused tail of the size class.
+        ASAN_POISON_MEMORY_REGION(data + len, capacity - len);
+    }
+    return MemBlock(len, data, Deleter(capacity));
+}
+
+void MemBlock::release(uint8_t* p, size_t capacity) {
+    const size_t index = classIndex(capacity);
+    if (sPool.drained || sPool.count[index] == kMaxPerClass) {
+        ASAN_UNPOISON_MEMORY_REGION(p, capacity);
+        delete[] p;
+        return;
+    }
+    // Odr-use the drainer so that it gets constructed (and thus destroyed) on this thread,
+    // which may well only ever release blocks allocated by other threads.
+    (void)&sPoolDrainer;
+    // Any access before the memory is handed out again is a use-after-free.
+    ASAN_POISON_MEMORY_REGION(p, capacity);
+    sPool.blocks[index][sPool.count[index]++] = p;
+    sCachedBlocks.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t MemBlock::pooledCacheSizeForTest() {
+    return sCachedBlocks.load(std::memory_order_relaxed);
+}
+
+}  // namespace netdutils
+}  // namespace android
@@ -16,8 +16,12 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <thread>
 #include <utility>
 
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <gtest/gtest.h>
 
 #include "netdutils/MemBlock.h"
@@ -142,5 +146,111 @@ TEST(MemBlockTest, ImplicitCastToSlice) {
     ASSERT_NO_FATAL_FAILURE(checkHelloMello(dataCopy, dataSlice));
 }
 
+TEST(MemBlockTest, Uninitialized) {
+    MemBlock empty = MemBlock::uninitialized(0);
+    EXPECT_TRUE(empty.get().empty());
+    EXPECT_EQ(nullptr, empty.get().base());
+
+    MemBlock block = MemBlock::uninitialized(DNS_PACKET_SIZE);
+    EXPECT_EQ(DNS_PACKET_SIZE, block.get().size());
+    EXPECT_NE(nullptr, block.get().base());
+}
+
+TEST(MemBlockTest, PooledReuse) {
+    uint8_t* first;
+    {
+        MemBlock block = MemBlock::pooled(1000);
+        ASSERT_EQ(1000U, block.get().size());
+        first = block.get().base();
+        std::fill_n(first, 1000, ARBITRARY_VALUE);
+    }
+    // Same (1 KiB) size class, so the block just released must be recycled.
+    MemBlock block = MemBlock::pooled(600);
+    EXPECT_EQ(first, block.get().base());
+    EXPECT_EQ(600U, block.get().size());
+    std::fill_n(block.get().base(), 600, 0);
+
+    // A different size class must not get it.
+    MemBlock other = MemBlock::pooled(2000);
+    EXPECT_NE(first, other.get().base());
+}
+
+TEST(MemBlockTest, PooledMove) {
+    MemBlock block;
+    uint8_t* data;
+    {
+        MemBlock pooled = MemBlock::pooled(DNS_PACKET_SIZE);
+        data = pooled.get().base();
+        block = std::move(pooled);
+    }
+    // Moved from block released nothing, the memory is still owned by 'block'.
+    EXPECT_EQ(data, block.get().base());
+    MemBlock fresh = MemBlock::pooled(DNS_PACKET_SIZE);
+    EXPECT_NE(data, fresh.get().base());
+    std::fill_n(block.get().base(), DNS_PACKET_SIZE, ARBITRARY_VALUE);
+}
+
+TEST(MemBlockTest, PooledBoundedCache) {
+    constexpr size_t kBlocks = 16;
+    {
+        MemBlock blocks[kBlocks];
+        for (auto& block : blocks) block = MemBlock::pooled(4096);
+    }
+    // Only a handful of blocks are cached, the rest were freed, which ASan would
+    // complain about if they were also still referenced by the pool.
+    for (size_t i = 0; i < kBlocks; i++) {
+        MemBlock block = MemBlock::pooled(4096);
+        std::fill_n(block.get().base(), 4096, ARBITRARY_VALUE);
+    }
+}
+
+TEST(MemBlockTest, PooledTooLarge) {
+    MemBlock block = MemBlock::pooled(MemBlock::kMaxPooledSize + 1);
+    EXPECT_EQ(MemBlock::kMaxPooledSize + 1, block.get().size());
+    std::fill_n(block.get().base(), block.get().size(), ARBITRARY_VALUE);
+}
+
+TEST(MemBlockTest, PooledAcrossThreads) {
+    // Released on a different thread than it was allocated on (which never allocates from
+    // the pool itself), and that thread's cache is then freed when the thread exits.
+    MemBlock block = MemBlock::pooled(DNS_PACKET_SIZE);
+    const size_t cached = MemBlock::pooledCacheSizeForTest();
+    std::thread([b = std::move(block)]() {}).join();
+    EXPECT_EQ(cached, MemBlock::pooledCacheSizeForTest());
+
+    std::thread([]() { MemBlock cached = MemBlock::pooled(8192); }).join();
+    EXPECT_EQ(cached, MemBlock::pooledCacheSizeForTest());
+}
+
+// A receive loop which allocates a fresh 64 KiB buffer per packet, as netlink and
+// packet sockets are commonly read: after the first packet, every buffer comes
+// from the pool.
+TEST(MemBlockTest, ReceiveLoop64KiB) {
+    constexpr size_t kBufSize = 64 * 1024;
+    constexpr int kIterations = 100;
+    int sv[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sv));
+    const uint8_t packet[1500] = {ARBITRARY_VALUE};
+
+    uint8_t* first = nullptr;
+    size_t cached = 0;
+    for (int i = 0; i < kIterations; i++) {
+        ASSERT_EQ((ssize_t)sizeof(packet), send(sv[0], packet, sizeof(packet), 0));
+        MemBlock buf = MemBlock::pooled(kBufSize);
+        ASSERT_EQ((ssize_t)sizeof(packet), recv(sv[1], buf.get().base(), kBufSize, 0));
+        EXPECT_EQ(ARBITRARY_VALUE, buf.get().base()[0]);
+        if (i == 0) {
+            first = buf.get().base();
+            cached = MemBlock::pooledCacheSizeForTest();
+        } else {
+            EXPECT_EQ(first, buf.get().base()) << "iteration " << i;
+            EXPECT_EQ(cached, MemBlock::pooledCacheSizeForTest()) << "iteration " << i;
+        }
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
 }  // namespace netdutils
 }  // namespace android
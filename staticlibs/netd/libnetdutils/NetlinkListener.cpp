@@ -16,6 +16,7 @@
 
 #define LOG_TAG "NetlinkListener"
 
+#include <chrono>
 #include <sstream>
 #include <vector>
 
@@ -124,7 +125,7 @@ Status NetlinkListener::run() {
     const auto& sys = sSyscalls.get();
     const std::array<Fd, 2> fds{{{mEvent}, {mSock}}};
     const int events = POLLIN;
-    const double timeout = 3600;
+    const auto timeout = std::chrono::hours(1);
     while (true) {
         ASSIGN_OR_RETURN(auto revents, sys.ppoll(fds, events, timeout));
         // After mEvent becomes readable, we should stop servicing mSock and return
@@ -126,12 +126,34 @@ class RealSyscalls final : public Syscalls {
         return rv;
     }
 
-    StatusOr<size_t> writev(Fd fd, const std::vector<iovec>& iov) const override {
+    StatusOr<int> ppoll(pollfd* fds, nfds_t nfds, std::chrono::nanoseconds timeout) const override {
+        const auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        timespec ts = {};
+        ts.tv_sec = secs.count();
+        ts.tv_nsec = (timeout - secs).count();
+        // ppoll() rejects negative timespecs, a negative timeout means no timeout as for poll().
+        const timespec* tsp = (timeout < timeout.zero()) ? nullptr : &ts;
+        auto rv = syscallRetry(::ppoll, fds, nfds, tsp, nullptr);
+        if (rv == -1) {
+            return statusFromErrno(errno, "ppoll() failed");
+        }
+        return rv;
+    }
+
+    StatusOr<size_t> writev(Fd fd, std::span<const iovec> iov) const override {
         auto rv = syscallRetry(::writev, fd.get(), iov.data(), iov.size());
         if (rv == -1) {
             return statusFromErrno(errno, "writev() failed");
         }
-        return rv;
+        return static_cast<size_t>(rv);
+    }
+
+    StatusOr<size_t> readv(Fd fd, std::span<const iovec> iov) const override {
+        auto rv = syscallRetry(::readv, fd.get(), iov.data(), iov.size());
+        if (rv == -1) {
+            return statusFromErrno(errno, "readv() failed");
+        }
+        return static_cast<size_t>(rv);
     }
 
     StatusOr<size_t> write(Fd fd, const Slice buf) const override {
@@ -171,6 +193,25 @@ class RealSyscalls final : public Syscalls {
         return take(dst, rv);
     }
 
+    StatusOr<size_t> sendmsg(Fd sock, const msghdr& msg, int flags) const override {
+        auto rv = syscallRetry(::sendmsg, sock.get(), &msg, flags);
+        if (rv == -1) {
+            return statusFromErrno(errno, "sendmsg() failed");
+        }
+        return static_cast<size_t>(rv);
+    }
+
+    StatusOr<size_t> recvmsg(Fd sock, msghdr* msg, int flags) const override {
+        auto rv = syscallRetry(::recvmsg, sock.get(), msg, flags);
+        if (rv == -1) {
+            return statusFromErrno(errno, "recvmsg() failed");
+        }
+        if (rv == 0) {
+            return status::eof;
+        }
+        return static_cast<size_t>(rv);
+    }
+
     Status shutdown(Fd fd, int how) const override {
         auto rv = ::shutdown(fd.get(), how);
         if (rv == -1) {
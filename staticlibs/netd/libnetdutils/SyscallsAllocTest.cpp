@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// This is a test binary of its own, since counting allocations means replacing the global
+// operator new and delete for everything linked into it.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <gtest/gtest.h>
+
+#include "netdutils/Syscalls.h"
+#include "netdutils/UniqueFd.h"
+
+// Counts heap allocations made by the current thread.
+static thread_local size_t sAllocations = 0;
+
+void* operator new(size_t size) {
+    ++sAllocations;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) abort();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace android {
+namespace netdutils {
+
+// Exercises the real implementations: a gather write plus scatter read, and a
+// sendmsg/recvmsg round trip, over a datagram socketpair must never hit the heap.
+TEST(syscalls, vectoredIoDoesNotAllocate) {
+    constexpr int kIterations = 1000;
+    int sv[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sv));
+    const UniqueFd tx(Fd{sv[0]}), rx(Fd{sv[1]});
+    const auto& sys = sSyscalls.get();
+
+    uint32_t hdr = 0x12345678, rxHdr = 0;
+    char payload[64] = "payload", rxPayload[64] = {};
+    const iovec txIov[] = {{&hdr, sizeof(hdr)}, {payload, sizeof(payload)}};
+    const iovec rxIov[] = {{&rxHdr, sizeof(rxHdr)}, {rxPayload, sizeof(rxPayload)}};
+    const msghdr txMsg = {.msg_iov = const_cast<iovec*>(txIov), .msg_iovlen = 2};
+    msghdr rxMsg = {.msg_iov = const_cast<iovec*>(rxIov), .msg_iovlen = 2};
+    pollfd pfd = {.fd = sv[1], .events = POLLIN};
+    constexpr size_t kLen = sizeof(hdr) + sizeof(payload);
+
+    const size_t before = sAllocations;
+    for (int i = 0; i < kIterations; ++i) {
+        const auto written = sys.writev(tx, txIov);
+        const auto polled = sys.ppoll(&pfd, 1, std::chrono::nanoseconds(0));
+        const auto read = sys.readv(rx, rxIov);
+        const auto sent = sys.sendmsg(tx, txMsg, 0);
+        const auto received = sys.recvmsg(rx, &rxMsg, 0);
+        ASSERT_EQ(kLen, written.value());
+        ASSERT_EQ(1, polled.value());
+        ASSERT_EQ(kLen, read.value());
+        ASSERT_EQ(kLen, sent.value());
+        ASSERT_EQ(kLen, received.value());
+    }
+    EXPECT_EQ(0U, sAllocations - before) << "allocations in " << kIterations << " iterations";
+    EXPECT_EQ(hdr, rxHdr);
+    EXPECT_STREQ(payload, rxPayload);
+}
+
+}  // namespace netdutils
+}  // namespace android
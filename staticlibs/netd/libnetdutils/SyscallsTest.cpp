@@ -15,9 +15,13 @@
  */
 
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <memory>
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+
 #include <gtest/gtest.h>
 
 #include "netdutils/Handle.h"
@@ -198,5 +202,55 @@ TEST_F(SyscallsTest, recvfrom) {
     EXPECT_EQ(expected, result.value().second);
 }
 
+TEST_F(SyscallsTest, ppollChrono) {
+    const std::array<Fd, 2> fds{{Fd(40), Fd(41)}};
+    const auto& sys = sSyscalls.get();
+
+    EXPECT_CALL(mSyscalls, ppoll(_, 2, std::chrono::nanoseconds(std::chrono::hours(1))))
+            .WillOnce(Invoke([](pollfd* pfds, nfds_t, std::chrono::nanoseconds) {
+                pfds[1].revents = POLLIN;
+                return 1;
+            }));
+    auto result = sys.ppoll(fds, POLLIN, std::chrono::hours(1));
+    EXPECT_EQ(status::ok, result.status());
+    EXPECT_EQ(0, result.value()[0]);
+    EXPECT_EQ(POLLIN, result.value()[1]);
+}
+
+TEST_F(SyscallsTest, writevReadv) {
+    constexpr Fd kFd(40);
+    char a[4], b[8];
+    const iovec iov[] = {{a, sizeof(a)}, {b, sizeof(b)}};
+    const auto& sys = sSyscalls.get();
+
+    EXPECT_CALL(mSyscalls, writev(kFd, _))
+            .WillOnce(Invoke([&iov](Fd, std::span<const iovec> got) -> StatusOr<size_t> {
+                EXPECT_EQ(iov, got.data());
+                EXPECT_EQ(2U, got.size());
+                return 12U;
+            }));
+    EXPECT_CALL(mSyscalls, readv(kFd, _)).WillOnce(Return(statusFromErrno(EAGAIN, "")));
+    const auto written = sys.writev(kFd, iov);
+    EXPECT_EQ(status::ok, written.status());
+    EXPECT_EQ(12U, written.value());
+    EXPECT_EQ(EAGAIN, sys.readv(kFd, iov).status().code());
+}
+
+// A negative timeout waits indefinitely, rather than failing with EINVAL.
+TEST(syscalls, ppollNegativeTimeout) {
+    int sv[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sv));
+    const UniqueFd tx(Fd{sv[0]}), rx(Fd{sv[1]});
+    const auto& sys = sSyscalls.get();
+    const char byte = 'x';
+    const auto written = sys.write(tx, makeSlice(byte));
+    ASSERT_EQ(1U, written.value());
+
+    const std::array<Fd, 1> fds{{rx}};
+    const auto result = sys.ppoll(fds, POLLIN, std::chrono::nanoseconds(-1));
+    ASSERT_EQ(status::ok, result.status());
+    EXPECT_EQ(POLLIN, result.value()[0]);
+}
+
 }  // namespace netdutils
 }  // namespace android
@@ -40,6 +40,24 @@ class MemBlock {
         copy(get(), src);
     }
 
+    // Like MemBlock(len), but without zero-filling the memory, for buffers which are
+    // about to be overwritten anyway (e.g. by read() or recvfrom()).
+    static MemBlock uninitialized(size_t len) {
+        return MemBlock(len, (len > 0U) ? new uint8_t[len] : nullptr, Deleter());
+    }
+
+    // Like uninitialized(len), but recycles memory through a small per-thread cache of
+    // power of two size classes (up to kMaxPooledSize), so that receive loops allocating
+    // a buffer per iteration neither hit the allocator nor pay for zeroing.
+    // The memory returns to the cache of whichever thread destroys the MemBlock.
+    // Larger requests are simply not pooled.
+    static MemBlock pooled(size_t len);
+
+    static constexpr size_t kMaxPooledSize = 64 * 1024;
+
+    // Total number of blocks currently cached by the pools of all threads, for tests.
+    static size_t pooledCacheSizeForTest();
+
     // No copy construction or assignment.
     MemBlock(const MemBlock&) = delete;
     MemBlock& operator=(const MemBlock&) = delete;
@@ -57,7 +75,26 @@ class MemBlock {
     operator const Slice() const noexcept { return get(); }
 
   private:
-    std::unique_ptr<uint8_t[]> mData;
+    // Frees with delete[], or hands the memory back to the pool if it came from there.
+    struct Deleter {
+        Deleter() : pooledCapacity(0) {}
+        explicit Deleter(size_t capacity) : pooledCapacity(capacity) {}
+
+        size_t pooledCapacity;  // 0 if not pooled
+        void operator()(uint8_t* p) const {
+            if (pooledCapacity) {
+                release(p, pooledCapacity);
+            } else {
+                delete[] p;
+            }
+        }
+    };
+
+    MemBlock(size_t len, uint8_t* data, Deleter deleter) : mData(data, deleter), mLen(len) {}
+
+    static void release(uint8_t* p, size_t capacity);
+
+    std::unique_ptr<uint8_t[], Deleter> mData;
     size_t mLen;
 };
 
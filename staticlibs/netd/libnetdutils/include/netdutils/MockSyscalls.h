@@ -49,14 +49,19 @@ class MockSyscalls : public Syscalls {
     // Use Return(ByMove(...)) to deal with movable return types.
     MOCK_CONST_METHOD2(eventfd, StatusOr<UniqueFd>(unsigned int initval, int flags));
     MOCK_CONST_METHOD3(ppoll, StatusOr<int>(pollfd* fds, nfds_t nfds, double timeout));
+    MOCK_CONST_METHOD3(ppoll, StatusOr<int>(pollfd* fds, nfds_t nfds,
+                                            std::chrono::nanoseconds timeout));
 
-    MOCK_CONST_METHOD2(writev, StatusOr<size_t>(Fd fd, const std::vector<iovec>& iov));
+    MOCK_CONST_METHOD2(writev, StatusOr<size_t>(Fd fd, std::span<const iovec> iov));
+    MOCK_CONST_METHOD2(readv, StatusOr<size_t>(Fd fd, std::span<const iovec> iov));
     MOCK_CONST_METHOD2(write, StatusOr<size_t>(Fd fd, const Slice buf));
     MOCK_CONST_METHOD2(read, StatusOr<Slice>(Fd fd, const Slice buf));
     MOCK_CONST_METHOD5(sendto, StatusOr<size_t>(Fd sock, const Slice buf, int flags,
                                                 const sockaddr* dst, socklen_t dstlen));
     MOCK_CONST_METHOD5(recvfrom, StatusOr<Slice>(Fd sock, const Slice dst, int flags, sockaddr* src,
                                                  socklen_t* srclen));
+    MOCK_CONST_METHOD3(sendmsg, StatusOr<size_t>(Fd sock, const msghdr& msg, int flags));
+    MOCK_CONST_METHOD3(recvmsg, StatusOr<size_t>(Fd sock, msghdr* msg, int flags));
     MOCK_CONST_METHOD2(shutdown, Status(Fd fd, int how));
     MOCK_CONST_METHOD1(close, Status(Fd fd));
 
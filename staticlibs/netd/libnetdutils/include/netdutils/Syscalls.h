@@ -17,7 +17,9 @@
 #ifndef NETDUTILS_SYSCALLS_H
 #define NETDUTILS_SYSCALLS_H
 
+#include <chrono>
 #include <memory>
+#include <span>
 
 #include <net/if.h>
 #include <poll.h>
@@ -65,7 +67,16 @@ class Syscalls {
 
     virtual StatusOr<int> ppoll(pollfd* fds, nfds_t nfds, double timeout) const = 0;
 
-    virtual StatusOr<size_t> writev(Fd fd, const std::vector<iovec>& iov) const = 0;
+    // As above, but without the floating point conversion on every call.  A negative timeout
+    // waits indefinitely, like poll()'s.
+    virtual StatusOr<int> ppoll(pollfd* fds, nfds_t nfds,
+                                std::chrono::nanoseconds timeout) const = 0;
+
+    // The iovec arrays are borrowed for the duration of the call only, so callers can
+    // keep them on the stack (a std::array or plain C array converts implicitly).
+    virtual StatusOr<size_t> writev(Fd fd, std::span<const iovec> iov) const = 0;
+
+    virtual StatusOr<size_t> readv(Fd fd, std::span<const iovec> iov) const = 0;
 
     virtual StatusOr<size_t> write(Fd fd, const Slice buf) const = 0;
 
@@ -77,6 +88,12 @@ class Syscalls {
     virtual StatusOr<Slice> recvfrom(Fd sock, const Slice dst, int flags, sockaddr* src,
                                      socklen_t* srclen) const = 0;
 
+    virtual StatusOr<size_t> sendmsg(Fd sock, const msghdr& msg, int flags) const = 0;
+
+    // Like recvfrom(), returns status::eof if nothing was read.
+    // On success msg->msg_namelen, msg->msg_controllen and msg->msg_flags are updated.
+    virtual StatusOr<size_t> recvmsg(Fd sock, msghdr* msg, int flags) const = 0;
+
     virtual Status shutdown(Fd fd, int how) const = 0;
 
     virtual Status close(Fd fd) const = 0;
@@ -144,18 +161,13 @@ class Syscalls {
     template <size_t size>
     StatusOr<std::array<uint16_t, size>> ppoll(const std::array<Fd, size>& fds, uint16_t events,
                                                double timeout) const {
-        std::array<pollfd, size> tmp;
-        for (size_t i = 0; i < size; ++i) {
-            tmp[i].fd = fds[i].get();
-            tmp[i].events = events;
-            tmp[i].revents = 0;
-        }
-        RETURN_IF_NOT_OK(ppoll(tmp.data(), tmp.size(), timeout).status());
-        std::array<uint16_t, size> out;
-        for (size_t i = 0; i < size; ++i) {
-            out[i] = tmp[i].revents;
-        }
-        return out;
+        return ppollArray(fds, events, timeout);
+    }
+
+    template <size_t size>
+    StatusOr<std::array<uint16_t, size>> ppoll(const std::array<Fd, size>& fds, uint16_t events,
+                                               std::chrono::nanoseconds timeout) const {
+        return ppollArray(fds, events, timeout);
     }
 
     template <typename SockaddrT>
@@ -175,6 +187,24 @@ class Syscalls {
         ASSIGN_OR_RETURN(auto used, recvfrom(sock, dst, flags, asSockaddrPtr(&addr), &addrlen));
         return std::make_pair(used, addr);
     }
+
+  private:
+    template <size_t size, typename TimeoutT>
+    StatusOr<std::array<uint16_t, size>> ppollArray(const std::array<Fd, size>& fds,
+                                                    uint16_t events, TimeoutT timeout) const {
+        std::array<pollfd, size> tmp;
+        for (size_t i = 0; i < size; ++i) {
+            tmp[i].fd = fds[i].get();
+            tmp[i].events = events;
+            tmp[i].revents = 0;
+        }
+        RETURN_IF_NOT_OK(ppoll(tmp.data(), tmp.size(), timeout).status());
+        std::array<uint16_t, size> out;
+        for (size_t i = 0; i < size; ++i) {
+            out[i] = tmp[i].revents;
+        }
+        return out;
+    }
 };
 
 // Specialized singleton that supports zero initialization and runtime
@@ -28,6 +28,11 @@ Firewall::Firewall() {
     result = mUidOwnerMap.init(UID_OWNER_MAP_PATH);
     EXPECT_RESULT_OK(result) << "init mUidOwnerMap failed";
 
+    // Like DATA_SAVER_ENABLED_MAP_PATH below, this map might not exist with an older tethering
+    // module. If it does, it must be kept in sync with mUidOwnerMap, since the bpf programs might
+    // be using either of them.
+    mUidOwnerMapB.init(UID_OWNER_MAP_B_PATH);
+
     // Do not check whether DATA_SAVER_ENABLED_MAP_PATH init succeeded or failed since the map is
     // defined in tethering module, but the user of this class may be in other modules. For example,
     // DNS resolver tests statically link to this class. But when running MTS, the test infra
@@ -73,14 +78,14 @@ Result<void> Firewall::addRule(uint32_t uid, UidOwnerMatchType match, uint32_t i
                 .iif = iif ? iif : oldMatch.value().iif,
                 .rule = oldMatch.value().rule | match,
         };
-        auto res = mUidOwnerMap.writeValue(uid, newMatch, BPF_ANY);
+        auto res = writeUidOwnerValue(uid, newMatch);
         if (!res.ok()) return Errorf("Failed to update rule: {}", res.error().message());
     } else {
         UidOwnerValue newMatch = {
                 .iif = iif,
                 .rule = match,
         };
-        auto res = mUidOwnerMap.writeValue(uid, newMatch, BPF_ANY);
+        auto res = writeUidOwnerValue(uid, newMatch);
         if (!res.ok()) return Errorf("Failed to add rule: {}", res.error().message());
     }
     return {};
@@ -96,15 +101,29 @@ Result<void> Firewall::removeRule(uint32_t uid, UidOwnerMatchType match) {
             .rule = oldMatch.value().rule & ~match,
     };
     if (newMatch.rule == 0) {
-        auto res = mUidOwnerMap.deleteValue(uid);
+        auto res = deleteUidOwnerValue(uid);
         if (!res.ok()) return Errorf("Failed to remove rule: {}", res.error().message());
     } else {
-        auto res = mUidOwnerMap.writeValue(uid, newMatch, BPF_ANY);
+        auto res = writeUidOwnerValue(uid, newMatch);
         if (!res.ok()) return Errorf("Failed to update rule: {}", res.error().message());
     }
     return {};
 }
 
+Result<void> Firewall::writeUidOwnerValue(uint32_t uid, const UidOwnerValue& value) {
+    auto res = mUidOwnerMap.writeValue(uid, value, BPF_ANY);
+    if (!res.ok() || !mUidOwnerMapB.isValid()) return res;
+    return mUidOwnerMapB.writeValue(uid, value, BPF_ANY);
+}
+
+Result<void> Firewall::deleteUidOwnerValue(uint32_t uid) {
+    auto res = mUidOwnerMap.deleteValue(uid);
+    if (!res.ok() || !mUidOwnerMapB.isValid()) return res;
+    res = mUidOwnerMapB.deleteValue(uid);
+    if (!res.ok() && res.error().code() == ENOENT) return {};
+    return res;
+}
+
 Result<void> Firewall::addUidInterfaceRules(const std::string& ifName,
                                             const std::vector<int32_t>& uids) {
     unsigned int iif = if_nametoindex(ifName.c_str());
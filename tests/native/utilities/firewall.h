@@ -37,8 +37,11 @@ class Firewall {
     Result<bool> getDataSaverSetting();
     Result<void> setDataSaver(bool enabled);
   private:
+    Result<void> writeUidOwnerValue(uint32_t uid, const UidOwnerValue& value) REQUIRES(mMutex);
+    Result<void> deleteUidOwnerValue(uint32_t uid) REQUIRES(mMutex);
     BpfMap<uint32_t, uint32_t> mConfigurationMap GUARDED_BY(mMutex);
     BpfMap<uint32_t, UidOwnerValue> mUidOwnerMap GUARDED_BY(mMutex);
+    BpfMap<uint32_t, UidOwnerValue> mUidOwnerMapB GUARDED_BY(mMutex);
     BpfMap<uint32_t, bool> mDataSaverEnabledMap GUARDED_BY(mMutex);
     std::mutex mMutex;
 };
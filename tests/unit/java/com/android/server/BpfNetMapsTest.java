@@ -19,6 +19,7 @@ package com.android.server;
 import static android.net.BpfNetMapsConstants.ALLOW_CHAINS;
 import static android.net.BpfNetMapsConstants.BACKGROUND_MATCH;
 import static android.net.BpfNetMapsConstants.CURRENT_STATS_MAP_CONFIGURATION_KEY;
+import static android.net.BpfNetMapsConstants.CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY;
 import static android.net.BpfNetMapsConstants.DATA_SAVER_ENABLED_KEY;
 import static android.net.BpfNetMapsConstants.DATA_SAVER_DISABLED;
 import static android.net.BpfNetMapsConstants.DATA_SAVER_ENABLED;
@@ -37,6 +38,7 @@ import static android.net.BpfNetMapsConstants.PENALTY_BOX_USER_MATCH;
 import static android.net.BpfNetMapsConstants.POWERSAVE_MATCH;
 import static android.net.BpfNetMapsConstants.RESTRICTED_MATCH;
 import static android.net.BpfNetMapsConstants.STANDBY_MATCH;
+import static android.net.BpfNetMapsConstants.UID_PERMISSION_GENERATION_KEY;
 import static android.net.BpfNetMapsConstants.UID_RULES_CONFIGURATION_KEY;
 import static android.net.ConnectivityManager.BLOCKED_METERED_REASON_ADMIN_DISABLED;
 import static android.net.ConnectivityManager.BLOCKED_METERED_REASON_DATA_SAVER;
@@ -65,6 +67,7 @@ import static android.net.INetd.PERMISSION_NONE;
 import static android.net.INetd.PERMISSION_UNINSTALLED;
 import static android.net.INetd.PERMISSION_UPDATE_DEVICE_STATS;
 import static android.system.OsConstants.EINVAL;
+import static android.system.OsConstants.EIO;
 import static android.system.OsConstants.EPERM;
 
 import static com.android.server.ConnectivityStatsLog.NETWORK_BPF_MAP_INFO;
@@ -99,6 +102,7 @@ import androidx.test.filters.SmallTest;
 
 import com.android.modules.utils.build.SdkLevel;
 import com.android.net.module.util.IBpfMap;
+import com.android.net.module.util.Struct;
 import com.android.net.module.util.Struct.S32;
 import com.android.net.module.util.Struct.U32;
 import com.android.net.module.util.Struct.U8;
@@ -125,6 +129,7 @@ import java.net.Inet4Address;
 import java.net.Inet6Address;
 import java.util.ArrayList;
 import java.util.List;
+import java.util.stream.IntStream;
 
 @RunWith(DevSdkIgnoreRunner.class)
 @SmallTest
@@ -155,6 +160,8 @@ public final class BpfNetMapsTest {
 
     private static final long STATS_SELECT_MAP_A = 0;
     private static final long STATS_SELECT_MAP_B = 1;
+    private static final long UID_OWNER_SELECT_MAP_A = 0;
+    private static final long UID_OWNER_SELECT_MAP_B = 1;
 
     private static final List<Integer> FIREWALL_CHAINS = new ArrayList<>();
     static {
@@ -170,6 +177,8 @@ public final class BpfNetMapsTest {
     private final IBpfMap<S32, U32> mConfigurationMap = new TestBpfMap<>(S32.class, U32.class);
     private final IBpfMap<S32, UidOwnerValue> mUidOwnerMap =
             new TestBpfMap<>(S32.class, UidOwnerValue.class);
+    private final IBpfMap<S32, UidOwnerValue> mUidOwnerMapB =
+            new TestBpfMap<>(S32.class, UidOwnerValue.class);
     private final IBpfMap<S32, U8> mUidPermissionMap = new TestBpfMap<>(S32.class, U8.class);
     private final IBpfMap<CookieTagMapKey, CookieTagMapValue> mCookieTagMap =
             spy(new TestBpfMap<>(CookieTagMapKey.class, CookieTagMapValue.class));
@@ -187,7 +196,10 @@ public final class BpfNetMapsTest {
         mConfigurationMap.updateEntry(UID_RULES_CONFIGURATION_KEY, new U32(0));
         mConfigurationMap.updateEntry(
                 CURRENT_STATS_MAP_CONFIGURATION_KEY, new U32(STATS_SELECT_MAP_A));
+        mConfigurationMap.updateEntry(
+                CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY, new U32(UID_OWNER_SELECT_MAP_A));
         BpfNetMaps.setUidOwnerMapForTest(mUidOwnerMap);
+        BpfNetMaps.setUidOwnerMapBForTest(mUidOwnerMapB);
         BpfNetMaps.setUidPermissionMapForTest(mUidPermissionMap);
         BpfNetMaps.setCookieTagMapForTest(mCookieTagMap);
         BpfNetMaps.setDataSaverEnabledMapForTest(mDataSaverEnabledMap);
@@ -728,6 +740,170 @@ public final class BpfNetMapsTest {
         checkUidOwnerValue(uid1, NULL_IIF, match1 | DOZABLE_MATCH);
     }
 
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.S_V2)
+    public void testReplaceUidChainSwitchesUidOwnerMap() throws Exception {
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, TEST_UIDS);
+        assertEquals(UID_OWNER_SELECT_MAP_B,
+                mConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val);
+
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, new int[]{TEST_UIDS[1]});
+        assertEquals(UID_OWNER_SELECT_MAP_A,
+                mConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val);
+
+        // Both maps end up with the same rules.
+        for (final IBpfMap<S32, UidOwnerValue> map : List.of(mUidOwnerMap, mUidOwnerMapB)) {
+            assertNull(map.getValue(new S32(TEST_UIDS[0])));
+            assertEquals(DOZABLE_MATCH, map.getValue(new S32(TEST_UIDS[1])).rule);
+        }
+
+        // Replacing a chain with its current contents does not switch maps.
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, new int[]{TEST_UIDS[1]});
+        assertEquals(UID_OWNER_SELECT_MAP_A,
+                mConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val);
+    }
+
+    // A uid owner map that counts the writes made to it while the bpf programs are using it.
+    private class InUseWriteCountingMap extends TestBpfMap<S32, UidOwnerValue> {
+        private final long mSelect;
+        int mInUseWrites = 0;
+
+        InUseWriteCountingMap(final long select) {
+            mSelect = select;
+        }
+
+        private void countIfInUse() throws ErrnoException {
+            if (mConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val
+                    == mSelect) {
+                mInUseWrites++;
+            }
+        }
+
+        @Override
+        public void updateEntry(final S32 key, final UidOwnerValue value) throws ErrnoException {
+            countIfInUse();
+            super.updateEntry(key, value);
+        }
+
+        @Override
+        public boolean deleteEntry(final Struct key) throws ErrnoException {
+            countIfInUse();
+            return super.deleteEntry(key);
+        }
+    }
+
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.S_V2)
+    public void testReplaceUidChainNoIntermediateState() throws Exception {
+        final InUseWriteCountingMap mapA = new InUseWriteCountingMap(UID_OWNER_SELECT_MAP_A);
+        final InUseWriteCountingMap mapB = new InUseWriteCountingMap(UID_OWNER_SELECT_MAP_B);
+        BpfNetMaps.setUidOwnerMapForTest(mapA);
+        BpfNetMaps.setUidOwnerMapBForTest(mapB);
+
+        // Two overlapping chains of 10k uids each, and some unrelated rules.
+        final int[] oldUids = IntStream.range(10_000, 20_000).toArray();
+        final int[] newUids = IntStream.range(15_000, 25_000).toArray();
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, oldUids);
+        mBpfNetMaps.setUidRule(FIREWALL_CHAIN_POWERSAVE, 12_345, FIREWALL_RULE_ALLOW);
+        mapA.mInUseWrites = 0;
+        mapB.mInUseWrites = 0;
+
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, newUids);
+
+        // The map in use was never written to, so the bpf programs saw either the old or
+        // the new chain, but nothing in between.
+        assertEquals(0, mapA.mInUseWrites + mapB.mInUseWrites);
+        for (final IBpfMap<S32, UidOwnerValue> map : List.of(mapA, mapB)) {
+            for (int uid = 10_000; uid < 25_000; uid++) {
+                final UidOwnerValue value = map.getValue(new S32(uid));
+                final long rule = (value == null) ? 0 : value.rule;
+                assertEquals(uid >= 15_000 ? DOZABLE_MATCH : 0, rule & DOZABLE_MATCH);
+            }
+            assertEquals(POWERSAVE_MATCH, map.getValue(new S32(12_345)).rule);
+        }
+    }
+
+    // A uid owner map whose writes fail after a number of successful ones.
+    private static class FailingWritesMap extends TestBpfMap<S32, UidOwnerValue> {
+        int mWritesBeforeFailure = 0;
+        int mFailures = 0;
+
+        private void maybeFail() throws ErrnoException {
+            if (mWritesBeforeFailure > 0) {
+                mWritesBeforeFailure--;
+            } else if (mFailures > 0) {
+                mFailures--;
+                throw new ErrnoException("write", EIO);
+            }
+        }
+
+        @Override
+        public void updateEntry(final S32 key, final UidOwnerValue value) throws ErrnoException {
+            maybeFail();
+            super.updateEntry(key, value);
+        }
+
+        @Override
+        public boolean deleteEntry(final Struct key) throws ErrnoException {
+            maybeFail();
+            return super.deleteEntry(key);
+        }
+    }
+
+    private void assertUidOwnerMapsEqual(final IBpfMap<S32, UidOwnerValue> mapA,
+            final IBpfMap<S32, UidOwnerValue> mapB) throws Exception {
+        mapA.forEach((uid, value) -> assertEquals(value, mapB.getValue(uid)));
+        mapB.forEach((uid, value) -> assertEquals(value, mapA.getValue(uid)));
+    }
+
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.S_V2)
+    public void testReplaceUidChainResyncsMapAfterSwitch() throws Exception {
+        final FailingWritesMap mapA = new FailingWritesMap();
+        BpfNetMaps.setUidOwnerMapForTest(mapA);
+        mBpfNetMaps.setUidRule(FIREWALL_CHAIN_POWERSAVE, 12_345, FIREWALL_RULE_ALLOW);
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, new int[]{TEST_UIDS[0]});
+        assertEquals(UID_OWNER_SELECT_MAP_B,
+                mConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val);
+
+        // Switching back to map A succeeds, but bringing map B up to date fails partway.
+        final FailingWritesMap mapB = new FailingWritesMap();
+        mUidOwnerMapB.forEach(mapB::updateEntry);
+        BpfNetMaps.setUidOwnerMapBForTest(mapB);
+        mapB.mWritesBeforeFailure = 1;
+        mapB.mFailures = 1;
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, new int[]{TEST_UIDS[1]});
+
+        // Map B was rebuilt from map A, so switching to it again won't resurrect the old chain.
+        assertEquals(UID_OWNER_SELECT_MAP_A,
+                mConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val);
+        assertNull(mapA.getValue(new S32(TEST_UIDS[0])));
+        assertEquals(DOZABLE_MATCH, mapA.getValue(new S32(TEST_UIDS[1])).rule);
+        assertUidOwnerMapsEqual(mapA, mapB);
+    }
+
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.S_V2)
+    public void testReplaceUidChainResyncsMapAfterFailedRollback() throws Exception {
+        final FailingWritesMap mapB = new FailingWritesMap();
+        BpfNetMaps.setUidOwnerMapBForTest(mapB);
+        mBpfNetMaps.setUidRule(FIREWALL_CHAIN_POWERSAVE, 12_345, FIREWALL_RULE_ALLOW);
+
+        // The first uid is written to map B, then both the second one and the rollback fail.
+        mapB.mWritesBeforeFailure = 1;
+        mapB.mFailures = 2;
+        mBpfNetMaps.replaceUidChain(FIREWALL_CHAIN_DOZABLE, TEST_UIDS);
+
+        // Nothing changed, and map B was rebuilt from map A.
+        assertEquals(UID_OWNER_SELECT_MAP_A,
+                mConfigurationMap.getValue(CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY).val);
+        for (final int uid : TEST_UIDS) {
+            assertNull(mUidOwnerMap.getValue(new S32(uid)));
+        }
+        assertEquals(POWERSAVE_MATCH, mUidOwnerMap.getValue(new S32(12_345)).rule);
+        assertUidOwnerMapsEqual(mUidOwnerMap, mapB);
+    }
+
     @Test
     @IgnoreUpTo(Build.VERSION_CODES.S_V2)
     public void testReplaceUidChainInvalidChain() {
@@ -798,6 +974,18 @@ public final class BpfNetMapsTest {
         assertEquals(PERMISSION_UPDATE_DEVICE_STATS, mUidPermissionMap.getValue(new S32(uid1)).val);
     }
 
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.S_V2)
+    public void testSetNetPermForUidsBumpsPermissionGeneration() throws Exception {
+        mConfigurationMap.updateEntry(UID_PERMISSION_GENERATION_KEY, new U32(0xffffffffL));
+
+        mBpfNetMaps.setNetPermForUids(PERMISSION_UPDATE_DEVICE_STATS, TEST_UIDS);
+        assertEquals(0, mConfigurationMap.getValue(UID_PERMISSION_GENERATION_KEY).val);
+
+        mBpfNetMaps.setNetPermForUids(PERMISSION_INTERNET, TEST_UIDS);
+        assertEquals(1, mConfigurationMap.getValue(UID_PERMISSION_GENERATION_KEY).val);
+    }
+
     @Test
     @IgnoreUpTo(Build.VERSION_CODES.S_V2)
     public void testSetNetPermForUidsRevokeMultiplePermissions() throws Exception {
@@ -1027,6 +1215,18 @@ public final class BpfNetMapsTest {
         assertDumpContains(getDump(), "current statsMap configuration: 1 SELECT_MAP_B");
     }
 
+    @Test
+    @IgnoreUpTo(Build.VERSION_CODES.S_V2)
+    public void testDumpCurrentUidOwnerMapConfig() throws Exception {
+        assertDumpContains(getDump(),
+                "current uidOwnerMap configuration: 0 SELECT_UID_OWNER_MAP_A");
+
+        mConfigurationMap.updateEntry(
+                CURRENT_UID_OWNER_MAP_CONFIGURATION_KEY, new U32(UID_OWNER_SELECT_MAP_B));
+        assertDumpContains(getDump(),
+                "current uidOwnerMap configuration: 1 SELECT_UID_OWNER_MAP_B");
+    }
+
     private void doTestDumpOwnerMatchConfig(final long match, final String matchString)
             throws Exception {
         mConfigurationMap.updateEntry(UID_RULES_CONFIGURATION_KEY, new U32(match));
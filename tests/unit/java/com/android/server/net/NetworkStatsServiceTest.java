@@ -668,6 +668,12 @@ public class NetworkStatsServiceTest extends NetworkStatsBaseTest {
             return mMockedTrafficStatsNativeStat;
         }
 
+        @Nullable
+        @Override
+        public NetworkStats.Entry nativeGetStatsUpdateErrors(int errorKey) {
+            return null;
+        }
+
         public void setNativeStat(NetworkStats.Entry entry) {
             mMockedTrafficStatsNativeStat = entry;
         }
@@ -21,16 +21,17 @@ import static android.system.OsConstants.IPPROTO_RAW;
 import static android.system.OsConstants.IPV6_CHECKSUM;
 import static android.system.OsConstants.IPV6_MULTICAST_HOPS;
 import static android.system.OsConstants.IPV6_RECVHOPLIMIT;
-import static android.system.OsConstants.IPV6_RECVPKTINFO;
 import static android.system.OsConstants.IPV6_UNICAST_HOPS;
 
-import android.net.util.SocketUtils;
+import android.net.IpPrefix;
 import android.os.ParcelFileDescriptor;
 import android.system.ErrnoException;
 import android.system.Os;
 
 import java.io.FileDescriptor;
 import java.io.IOException;
+import java.net.Inet6Address;
+import java.util.List;
 
 /** Controller for the infrastructure network interface. */
 public class InfraInterfaceController {
@@ -40,6 +41,9 @@ public class InfraInterfaceController {
     private static final int IPV6_CHECKSUM_OFFSET = 2;
     private static final int HOP_LIMIT = 255;
 
+    /** The maximum number of Neighbor Advertisement target prefixes a socket can filter on. */
+    public static final int MAX_NA_TARGET_PREFIXES = 16;
+
     static {
         System.loadLibrary("service-thread-jni");
     }
@@ -48,26 +52,57 @@ public class InfraInterfaceController {
      * Creates a socket on the infrastructure network interface for sending/receiving ICMPv6
      * Neighbor Discovery messages.
      *
+     * <p>The socket is bound to {@code infraInterfaceName} and only receives Router Solicitations,
+     * Router Advertisements and Neighbor Advertisements. Neighbor Advertisements are further
+     * dropped in the kernel unless their target address is within one of {@code
+     * naTargetPrefixes}, or {@code naTargetPrefixes} is empty.
+     *
      * @param infraInterfaceName the infrastructure network interface name.
+     * @param naTargetPrefixes the IPv6 prefixes of Neighbor Advertisement targets to receive, at
+     *     most {@link #MAX_NA_TARGET_PREFIXES}. An empty list receives all Neighbor
+     *     Advertisements.
      * @return an ICMPv6 socket file descriptor on the Infrastructure network interface.
      * @throws IOException when fails to create the socket.
+     * @throws IllegalArgumentException if {@code naTargetPrefixes} is not a valid prefix set.
      */
-    public ParcelFileDescriptor createIcmp6Socket(String infraInterfaceName) throws IOException {
+    public ParcelFileDescriptor createIcmp6Socket(
+            String infraInterfaceName, List<IpPrefix> naTargetPrefixes) throws IOException {
+        if (naTargetPrefixes.size() > MAX_NA_TARGET_PREFIXES) {
+            throw new IllegalArgumentException(
+                    "Too many NA target prefixes: " + naTargetPrefixes.size());
+        }
+        final byte[] prefixAddrs = new byte[naTargetPrefixes.size() * 16];
+        final int[] prefixLens = new int[naTargetPrefixes.size()];
+        for (int i = 0; i < naTargetPrefixes.size(); i++) {
+            final IpPrefix prefix = naTargetPrefixes.get(i);
+            if (!(prefix.getAddress() instanceof Inet6Address)) {
+                throw new IllegalArgumentException("Not an IPv6 NA target prefix: " + prefix);
+            }
+            System.arraycopy(prefix.getRawAddress(), 0, prefixAddrs, i * 16, 16);
+            prefixLens[i] = prefix.getPrefixLength();
+        }
+
+        final int ifIndex = Os.if_nametoindex(infraInterfaceName);
+        if (ifIndex == 0) {
+            throw new IOException("Unknown infrastructure interface " + infraInterfaceName);
+        }
+
         ParcelFileDescriptor parcelFd =
-                ParcelFileDescriptor.adoptFd(nativeCreateFilteredIcmp6Socket());
+                ParcelFileDescriptor.adoptFd(
+                        nativeCreateFilteredIcmp6Socket(ifIndex, prefixAddrs, prefixLens));
         FileDescriptor fd = parcelFd.getFileDescriptor();
         try {
             Os.setsockoptInt(fd, IPPROTO_RAW, IPV6_CHECKSUM, IPV6_CHECKSUM_OFFSET);
-            Os.setsockoptInt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, ENABLE);
             Os.setsockoptInt(fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, ENABLE);
             Os.setsockoptInt(fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, HOP_LIMIT);
             Os.setsockoptInt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, HOP_LIMIT);
-            SocketUtils.bindSocketToInterface(fd, infraInterfaceName);
         } catch (ErrnoException e) {
+            parcelFd.close();
             throw new IOException("Failed to setsockopt for the ICMPv6 socket", e);
         }
         return parcelFd;
     }
 
-    private static native int nativeCreateFilteredIcmp6Socket() throws IOException;
+    private static native int nativeCreateFilteredIcmp6Socket(
+            int ifIndex, byte[] naTargetPrefixAddrs, int[] naTargetPrefixLens) throws IOException;
 }
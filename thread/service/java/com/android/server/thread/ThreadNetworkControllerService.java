@@ -76,6 +76,7 @@ import android.content.IntentFilter;
 import android.content.res.Resources;
 import android.net.ConnectivityManager;
 import android.net.InetAddresses;
+import android.net.IpPrefix;
 import android.net.LinkProperties;
 import android.net.LocalNetworkConfig;
 import android.net.LocalNetworkInfo;
@@ -144,6 +145,7 @@ import java.time.Clock;
 import java.time.DateTimeException;
 import java.time.Instant;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.HashMap;
 import java.util.List;
 import java.util.Map;
@@ -429,6 +431,40 @@ final class ThreadNetworkControllerService extends IThreadNetworkController.Stub
         return txts;
     }
 
+    /**
+     * Parses the Neighbor Advertisement target prefixes which the infrastructure link ICMPv6
+     * socket is filtered on from resources. An empty list means no filtering.
+     *
+     * @throws IllegalStateException if invalid or too many prefixes are found in the resources
+     */
+    @VisibleForTesting
+    static List<IpPrefix> getInfraNaTargetPrefixes(Resources resources) {
+        final String[] prefixStrs =
+                resources.getStringArray(R.array.config_thread_infra_na_target_prefixes);
+        if (prefixStrs.length > InfraInterfaceController.MAX_NA_TARGET_PREFIXES) {
+            throw new IllegalStateException(
+                    "More than "
+                            + InfraInterfaceController.MAX_NA_TARGET_PREFIXES
+                            + " NA target prefixes: "
+                            + Arrays.toString(prefixStrs));
+        }
+
+        List<IpPrefix> prefixes = new ArrayList<>();
+        for (String prefixStr : prefixStrs) {
+            final IpPrefix prefix;
+            try {
+                prefix = new IpPrefix(prefixStr);
+            } catch (IllegalArgumentException e) {
+                throw new IllegalStateException("Invalid NA target prefix: " + prefixStr, e);
+            }
+            if (!(prefix.getAddress() instanceof Inet6Address)) {
+                throw new IllegalStateException("NA target prefix is not IPv6: " + prefixStr);
+            }
+            prefixes.add(prefix);
+        }
+        return prefixes;
+    }
+
     private void onOtDaemonDied() {
         checkOnHandlerThread();
         LOG.w("OT daemon is dead, clean up...");
@@ -1274,8 +1310,16 @@ final class ThreadNetworkControllerService extends IThreadNetworkController.Stub
         }
         ParcelFileDescriptor infraIcmp6Socket = null;
         if (newInfraLinkInterfaceName != null) {
+            List<IpPrefix> naTargetPrefixes = List.of();
+            try {
+                naTargetPrefixes = getInfraNaTargetPrefixes(mResources.get());
+            } catch (IllegalStateException e) {
+                LOG.e("Not filtering Neighbor Advertisements on infra network interface", e);
+            }
             try {
-                infraIcmp6Socket = mInfraIfController.createIcmp6Socket(newInfraLinkInterfaceName);
+                infraIcmp6Socket =
+                        mInfraIfController.createIcmp6Socket(
+                                newInfraLinkInterfaceName, naTargetPrefixes);
             } catch (IOException e) {
                 LOG.e("Failed to create ICMPv6 socket on infra network interface", e);
             }
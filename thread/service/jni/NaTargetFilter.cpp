@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "NaTargetFilter.h"
+
+#include <arpa/inet.h>
+#include <netinet/icmp6.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <bpf/BpfClassic.h>
+
+namespace android {
+
+std::vector<sock_filter> makeNaTargetFilter(const uint8_t *addrs, const int32_t *prefixLens,
+                                            int numPrefixes) {
+  std::vector<sock_filter> code = {
+      // Only Neighbor Advertisements are subject to filtering.
+      BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(nd_neighbor_advert, nd_na_type)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ND_NEIGHBOR_ADVERT, 1, 0),
+      BPF_ACCEPT,
+  };
+
+  for (int i = 0; i < numPrefixes; i++) {
+    const uint8_t *addr = addrs + i * sizeof(in6_addr);
+    const int prefixLen = prefixLens[i];
+
+    // Compares the prefix 32 bits at a time, on mismatch skipping to the next prefix.
+    std::vector<sock_filter> block;
+    for (int bit = 0; bit < prefixLen; bit += 32) {
+      const uint32_t ofs = offsetof(nd_neighbor_advert, nd_na_target) + bit / 8;
+      const uint32_t mask =
+          prefixLen - bit >= 32 ? 0xFFFFFFFF : ~(0xFFFFFFFF >> (prefixLen - bit));
+      uint32_t word;
+      memcpy(&word, addr + bit / 8, sizeof(word));
+      word = ntohl(word) & mask;
+      block.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ofs));
+      if (mask != 0xFFFFFFFF) block.push_back(BPF_STMT(BPF_ALU | BPF_AND | BPF_K, mask));
+      // The jump offset is patched below, once the block length is known.
+      block.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, word, 0, 0));
+    }
+    block.push_back(BPF_ACCEPT);
+    for (size_t j = 0; j < block.size(); j++) {
+      if (BPF_CLASS(block[j].code) == BPF_JMP) block[j].jf = block.size() - j - 1;
+    }
+    code.insert(code.end(), block.begin(), block.end());
+  }
+
+  if (numPrefixes) {
+    code.push_back(BPF_REJECT);
+  } else {
+    code.push_back(BPF_ACCEPT);
+  }
+  return code;
+}
+
+}  // namespace android
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <linux/filter.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace android {
+
+// Must match InfraInterfaceController#MAX_NA_TARGET_PREFIXES. Every NA on the link runs through
+// the whole filter before it is dropped, so this bounds the per-packet cost (and the program
+// size, at most 9 instructions per prefix).
+constexpr int kMaxNaTargetPrefixes = 16;
+
+// Builds a classic BPF program which passes everything except Neighbor Advertisements whose
+// target address is not within any of the given prefixes. An empty prefix set passes all.
+// |addrs| holds |numPrefixes| 16 byte addresses, and |prefixLens| their prefix lengths.
+//
+// On a raw IPPROTO_ICMPV6 socket the filter runs with skb->data at the ICMPv6 header (the
+// IPv6 header and any extension headers have already been pulled), so absolute loads are
+// relative to the start of the ICMPv6 message. Loads past the end of the packet reject it.
+std::vector<sock_filter> makeNaTargetFilter(const uint8_t *addrs, const int32_t *prefixLens,
+                                            int numPrefixes);
+
+}  // namespace android
@@ -21,6 +21,7 @@
 #include <fcntl.h>
 #include <ifaddrs.h>
 #include <inttypes.h>
+#include <linux/filter.h>
 #include <linux/if_arp.h>
 #include <linux/ioctl.h>
 #include <log/log.h>
@@ -36,14 +37,44 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <vector>
+
+#include "NaTargetFilter.h"
 #include "jni.h"
 #include "nativehelper/JNIHelp.h"
+#include "nativehelper/ScopedPrimitiveArray.h"
 #include "nativehelper/scoped_utf_chars.h"
 
 namespace android {
-static jint
-com_android_server_thread_InfraInterfaceController_createFilteredIcmp6Socket(JNIEnv *env,
-                                                                             jobject clazz) {
+
+static jint com_android_server_thread_InfraInterfaceController_createFilteredIcmp6Socket(
+    JNIEnv *env, jobject clazz, jint ifIndex, jbyteArray naTargetPrefixAddrs,
+    jintArray naTargetPrefixLens) {
+  ScopedByteArrayRO addrs(env, naTargetPrefixAddrs);
+  ScopedIntArrayRO prefixLens(env, naTargetPrefixLens);
+  const int numPrefixes = prefixLens.size();
+  if (numPrefixes > kMaxNaTargetPrefixes ||
+      addrs.size() != static_cast<size_t>(numPrefixes) * sizeof(in6_addr)) {
+    jniThrowExceptionFmt(env, "java/lang/IllegalArgumentException",
+                         "invalid NA target prefix set (%zu address bytes, %d prefixes)",
+                         addrs.size(), numPrefixes);
+    return -1;
+  }
+  for (int i = 0; i < numPrefixes; i++) {
+    if (prefixLens[i] < 0 || prefixLens[i] > 128) {
+      jniThrowExceptionFmt(env, "java/lang/IllegalArgumentException",
+                           "invalid NA target prefix length %d", prefixLens[i]);
+      return -1;
+    }
+  }
+
+  char ifName[IF_NAMESIZE];
+  if (if_indextoname(ifIndex, ifName) == nullptr) {
+    jniThrowExceptionFmt(env, "java/io/IOException", "failed to find interface %d (%s)", ifIndex,
+                         strerror(errno));
+    return -1;
+  }
+
   // Initializes the ICMPv6 socket.
   int sock = socket(AF_INET6, SOCK_RAW, IPPROTO_ICMPV6);
   if (sock == -1) {
@@ -67,6 +98,42 @@ com_android_server_thread_InfraInterfaceController_createFilteredIcmp6Socket(JNI
     return -1;
   }
 
+  // Further drop Neighbor Advertisements for targets we don't care about, so that NA heavy
+  // links don't keep waking up the border router.
+  const std::vector<sock_filter> code = makeNaTargetFilter(
+      reinterpret_cast<const uint8_t *>(addrs.get()), prefixLens.get(), numPrefixes);
+  const sock_fprog fprog = {
+      static_cast<unsigned short>(code.size()),
+      const_cast<sock_filter *>(code.data()),
+  };
+  if (setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) != 0) {
+    jniThrowExceptionFmt(env, "java/io/IOException",
+                         "failed to setsockopt SO_ATTACH_FILTER (%s)", strerror(errno));
+    close(sock);
+    return -1;
+  }
+
+  if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, ifName, strlen(ifName)) != 0) {
+    jniThrowExceptionFmt(env, "java/io/IOException", "failed to bind to %s (%s)", ifName,
+                         strerror(errno));
+    close(sock);
+    return -1;
+  }
+
+  const int on = 1;
+  if (setsockopt(sock, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on)) != 0) {
+    jniThrowExceptionFmt(env, "java/io/IOException",
+                         "failed to setsockopt IPV6_RECVPKTINFO (%s)", strerror(errno));
+    close(sock);
+    return -1;
+  }
+
+  // Anything queued before the filters and the binding took effect may have come from any
+  // interface, discard it.
+  uint8_t discard;
+  while (recv(sock, &discard, sizeof(discard), MSG_DONTWAIT | MSG_TRUNC) >= 0) {
+  }
+
   return sock;
 }
 
@@ -76,7 +143,7 @@ com_android_server_thread_InfraInterfaceController_createFilteredIcmp6Socket(JNI
 
 static const JNINativeMethod gMethods[] = {
     /* name, signature, funcPtr */
-    {"nativeCreateFilteredIcmp6Socket", "()I",
+    {"nativeCreateFilteredIcmp6Socket", "(I[B[I)I",
      (void *)com_android_server_thread_InfraInterfaceController_createFilteredIcmp6Socket},
 };
 
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/icmp6.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+
+#include "NaTargetFilter.h"
+
+namespace android {
+
+using base::unique_fd;
+
+// Sends crafted ICMPv6 messages over loopback to a raw socket with the filter attached, so that
+// the program runs with the kernel's real packet offsets.
+class NaTargetFilterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    mSender.reset(socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_ICMPV6));
+    ASSERT_NE(-1, mSender) << strerror(errno);
+    mReceiver.reset(socket(AF_INET6, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, IPPROTO_ICMPV6));
+    ASSERT_NE(-1, mReceiver) << strerror(errno);
+    ASSERT_EQ(0, setsockopt(mReceiver, SOL_SOCKET, SO_BINDTODEVICE, "lo", strlen("lo")))
+        << strerror(errno);
+  }
+
+  void attachFilter(const std::vector<std::pair<std::string, int>>& prefixes) {
+    std::vector<uint8_t> addrs(prefixes.size() * sizeof(in6_addr));
+    std::vector<int32_t> prefixLens;
+    for (size_t i = 0; i < prefixes.size(); i++) {
+      ASSERT_EQ(1, inet_pton(AF_INET6, prefixes[i].first.c_str(),
+                             addrs.data() + i * sizeof(in6_addr)));
+      prefixLens.push_back(prefixes[i].second);
+    }
+    const std::vector<sock_filter> code =
+        makeNaTargetFilter(addrs.data(), prefixLens.data(), prefixes.size());
+    const sock_fprog fprog = {
+        static_cast<unsigned short>(code.size()),
+        const_cast<sock_filter*>(code.data()),
+    };
+    ASSERT_EQ(0, setsockopt(mReceiver, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)))
+        << strerror(errno);
+
+    // Discard anything which arrived before the filter was attached.
+    uint8_t discard;
+    while (recv(mReceiver, &discard, sizeof(discard), MSG_TRUNC) >= 0) {
+    }
+  }
+
+  void send(const void* msg, size_t len) {
+    const sockaddr_in6 dst = {.sin6_family = AF_INET6, .sin6_addr = in6addr_loopback};
+    ASSERT_EQ(static_cast<ssize_t>(len),
+              sendto(mSender, msg, len, 0, reinterpret_cast<const sockaddr*>(&dst), sizeof(dst)))
+        << strerror(errno);
+  }
+
+  // Returns whether the filtered socket receives a message of the given type. It is followed by
+  // an echo request, which always passes and marks the point by which it would have arrived.
+  bool passes(const void* msg, size_t len) {
+    send(msg, len);
+    icmp6_hdr marker = {};
+    marker.icmp6_type = ICMP6_ECHO_REQUEST;
+    marker.icmp6_id = htons(++mMarkerId);
+    send(&marker, sizeof(marker));
+
+    const uint8_t type = static_cast<const uint8_t*>(msg)[0];
+    bool seen = false;
+    while (true) {
+      pollfd pfd = {.fd = mReceiver, .events = POLLIN};
+      if (poll(&pfd, 1, 1000) != 1) {
+        ADD_FAILURE() << "timed out waiting for the marker";
+        return seen;
+      }
+      uint8_t buf[1500];
+      const ssize_t n = recv(mReceiver, buf, sizeof(buf), 0);
+      if (n < static_cast<ssize_t>(sizeof(icmp6_hdr))) continue;
+      const icmp6_hdr* hdr = reinterpret_cast<const icmp6_hdr*>(buf);
+      if (hdr->icmp6_type == ICMP6_ECHO_REQUEST && hdr->icmp6_id == marker.icmp6_id) {
+        return seen;
+      }
+      if (hdr->icmp6_type == type && static_cast<size_t>(n) == len &&
+          !memcmp(buf + sizeof(icmp6_hdr), static_cast<const uint8_t*>(msg) + sizeof(icmp6_hdr),
+                  len - sizeof(icmp6_hdr))) {
+        seen = true;
+      }
+    }
+  }
+
+  bool naPasses(const char* target) {
+    nd_neighbor_advert na = {};
+    na.nd_na_type = ND_NEIGHBOR_ADVERT;
+    EXPECT_EQ(1, inet_pton(AF_INET6, target, &na.nd_na_target));
+    return passes(&na, sizeof(na));
+  }
+
+  unique_fd mSender;
+  unique_fd mReceiver;
+  uint16_t mMarkerId = 0;
+};
+
+TEST_F(NaTargetFilterTest, EmptyPrefixSetPassesAllNeighborAdvertisements) {
+  attachFilter({});
+  EXPECT_TRUE(naPasses("2001:db8::1"));
+  EXPECT_TRUE(naPasses("fe80::1"));
+}
+
+TEST_F(NaTargetFilterTest, NeighborAdvertisementTargets) {
+  attachFilter({{"2001:db8:1:2::", 64}, {"fe80::", 10}, {"2001:db0::", 29}, {"2001:db8::5", 128}});
+
+  EXPECT_TRUE(naPasses("2001:db8:1:2::1"));
+  EXPECT_TRUE(naPasses("2001:db8:1:2:ffff:ffff:ffff:ffff"));
+  EXPECT_TRUE(naPasses("fe80::1234"));
+  EXPECT_TRUE(naPasses("febf::1"));
+  EXPECT_TRUE(naPasses("2001:db7:7:3::1"));
+  EXPECT_TRUE(naPasses("2001:db8::5"));
+
+  EXPECT_FALSE(naPasses("2001:db8:1:3::1"));
+  EXPECT_FALSE(naPasses("fec0::1"));
+  EXPECT_FALSE(naPasses("2001:db8:8::1"));
+  EXPECT_FALSE(naPasses("2001:db8::4"));
+  EXPECT_FALSE(naPasses("::1"));
+}
+
+TEST_F(NaTargetFilterTest, OtherMessagesPass) {
+  attachFilter({{"2001:db8:1:2::", 64}});
+
+  nd_neighbor_solicit ns = {};
+  ns.nd_ns_type = ND_NEIGHBOR_SOLICIT;
+  ASSERT_EQ(1, inet_pton(AF_INET6, "2001:db8:9::1", &ns.nd_ns_target));
+  EXPECT_TRUE(passes(&ns, sizeof(ns)));
+
+  nd_router_advert ra = {};
+  ra.nd_ra_type = ND_ROUTER_ADVERT;
+  ra.nd_ra_router_lifetime = htons(1800);
+  EXPECT_TRUE(passes(&ra, sizeof(ra)));
+
+  nd_router_solicit rs = {};
+  rs.nd_rs_type = ND_ROUTER_SOLICIT;
+  EXPECT_TRUE(passes(&rs, sizeof(rs)));
+}
+
+TEST_F(NaTargetFilterTest, TruncatedNeighborAdvertisementIsDropped) {
+  // Matching the all zero target needs loads up to the end of the message.
+  attachFilter({{"::", 128}});
+
+  nd_neighbor_advert na = {};
+  na.nd_na_type = ND_NEIGHBOR_ADVERT;
+  EXPECT_TRUE(passes(&na, sizeof(na)));
+  EXPECT_FALSE(passes(&na, offsetof(nd_neighbor_advert, nd_na_target) + 8));
+}
+
+TEST_F(NaTargetFilterTest, MaxPrefixes) {
+  // The longest possible program: the maximum number of prefixes, each compared in 4 words.
+  std::vector<std::pair<std::string, int>> prefixes;
+  for (int i = 0; i < kMaxNaTargetPrefixes; i++) {
+    prefixes.emplace_back("2001:db8:" + std::to_string(i) + "::1", 127);
+  }
+  attachFilter(prefixes);
+
+  EXPECT_TRUE(naPasses("2001:db8:0::1"));
+  EXPECT_TRUE(naPasses(("2001:db8:" + std::to_string(kMaxNaTargetPrefixes - 1) + "::").c_str()));
+  EXPECT_FALSE(naPasses("2001:db8:0::2"));
+  EXPECT_FALSE(naPasses(("2001:db8:" + std::to_string(kMaxNaTargetPrefixes) + "::1").c_str()));
+}
+
+}  // namespace android
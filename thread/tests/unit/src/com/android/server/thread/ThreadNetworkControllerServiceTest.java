@@ -64,6 +64,7 @@ import android.content.Context;
 import android.content.Intent;
 import android.content.res.Resources;
 import android.net.ConnectivityManager;
+import android.net.IpPrefix;
 import android.net.LinkProperties;
 import android.net.Network;
 import android.net.NetworkAgent;
@@ -223,6 +224,8 @@ public final class ThreadNetworkControllerServiceTest {
                 .thenReturn(TEST_MODEL_NAME);
         when(mResources.getStringArray(eq(R.array.config_thread_mdns_vendor_specific_txts)))
                 .thenReturn(new String[] {});
+        when(mResources.getStringArray(eq(R.array.config_thread_infra_na_target_prefixes)))
+                .thenReturn(new String[] {});
 
         final AtomicFile storageFile = new AtomicFile(tempFolder.newFile("thread_settings.xml"));
         mPersistentSettings = new ThreadPersistentSettings(storageFile, mConnectivityResources);
@@ -331,6 +334,47 @@ public final class ThreadNetworkControllerServiceTest {
                 () -> getMeshcopTxtAttributesWithVendorOui("AB.CD.EF"));
     }
 
+    @Test
+    public void getInfraNaTargetPrefixes_emptyByDefault() {
+        assertThat(ThreadNetworkControllerService.getInfraNaTargetPrefixes(mResources)).isEmpty();
+    }
+
+    @Test
+    public void getInfraNaTargetPrefixes_validPrefixes_accepted() {
+        when(mResources.getStringArray(eq(R.array.config_thread_infra_na_target_prefixes)))
+                .thenReturn(new String[] {"fe80::/10", "2001:db8:1:2::/64"});
+
+        assertThat(ThreadNetworkControllerService.getInfraNaTargetPrefixes(mResources))
+                .containsExactly(new IpPrefix("fe80::/10"), new IpPrefix("2001:db8:1:2::/64"))
+                .inOrder();
+    }
+
+    @Test
+    public void getInfraNaTargetPrefixes_invalidPrefixes_throwsIllegalStateException() {
+        for (String invalid : new String[] {"fe80::", "2001:db8::/129", "192.168.1.0/24"}) {
+            when(mResources.getStringArray(eq(R.array.config_thread_infra_na_target_prefixes)))
+                    .thenReturn(new String[] {"fe80::/10", invalid});
+
+            assertThrows(
+                    IllegalStateException.class,
+                    () -> ThreadNetworkControllerService.getInfraNaTargetPrefixes(mResources));
+        }
+    }
+
+    @Test
+    public void getInfraNaTargetPrefixes_tooManyPrefixes_throwsIllegalStateException() {
+        String[] prefixes = new String[InfraInterfaceController.MAX_NA_TARGET_PREFIXES + 1];
+        for (int i = 0; i < prefixes.length; i++) {
+            prefixes[i] = "2001:db8:" + Integer.toHexString(i) + "::/48";
+        }
+        when(mResources.getStringArray(eq(R.array.config_thread_infra_na_target_prefixes)))
+                .thenReturn(prefixes);
+
+        assertThrows(
+                IllegalStateException.class,
+                () -> ThreadNetworkControllerService.getInfraNaTargetPrefixes(mResources));
+    }
+
     @Test
     public void getMeshcopTxtAttributes_validVendorOui_accepted() {
         assertThat(getMeshcopTxtAttributesWithVendorOui("010203")).isEqualTo(new byte[] {1, 2, 3});